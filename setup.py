@@ -7,9 +7,10 @@ setup(
     ext_modules = [
         Extension(
             "tokyotyrant", ['tokyotyrant.c'],
-            libraries=["tokyotyrant"]
+            libraries=["tokyotyrant", "tokyocabinet"]
         )
     ],
+    test_suite = "test_tokyotyrant",
     description = """tokyotyrant aims to be a complete python wrapper for the 
         Tokyo Tyrant client library by Mikio Hirabayashi (http://1978th.net/).""",
     author = "Elisha Cook",
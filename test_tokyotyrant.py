@@ -0,0 +1,305 @@
+import os
+import shutil
+import socket
+import tempfile
+import unittest
+
+import tokyotyrant
+
+
+def free_port():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.bind(("127.0.0.1", 0))
+    port = sock.getsockname()[1]
+    sock.close()
+    return port
+
+
+def connect(server, timeout=None):
+    db = tokyotyrant.Tyrant()
+    if timeout is not None:
+        db.tune(timeout, 0)
+    db.open(server.host, server.port)
+    return db
+
+
+class ServerTestCase(unittest.TestCase):
+    path = "*"
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.server = self.start_server()
+        self.db = connect(self.server)
+
+    def tearDown(self):
+        # A lost reply may already have closed the connection.
+        try:
+            self.db.close()
+        except tokyotyrant.error:
+            pass
+        self.server.stop()
+        shutil.rmtree(self.tmpdir)
+
+    def start_server(self, path=None, **kwargs):
+        server = tokyotyrant.TyrantServer("127.0.0.1", free_port(),
+            path or self.path, **kwargs)
+        server.start()
+        return server
+
+
+class TestServer(ServerTestCase):
+
+    def test_port_in_use(self):
+        other = tokyotyrant.TyrantServer("127.0.0.1", self.server.port)
+        self.assertRaises(tokyotyrant.error, other.start)
+        self.db.put("a", "1")
+        self.assertEqual(self.db.get("a"), "1")
+
+    def test_restart_keeps_data(self):
+        self.db.put("a", "1")
+        self.db.close()
+        self.server.stop()
+        self.server.start()
+        self.db = connect(self.server)
+        self.assertEqual(self.db.get("a"), "1")
+
+
+class TestRecords(ServerTestCase):
+
+    def test_put_get(self):
+        self.db.put("a", "1")
+        self.db.put("b", "2")
+        self.assertEqual(self.db.get("a"), "1")
+        self.assertEqual(self.db["b"], "2")
+        self.assertEqual(self.db.get("c"), None)
+        self.assertEqual(self.db.get("c", "x"), "x")
+        self.assertRaises(KeyError, lambda: self.db["c"])
+        self.assertEqual(self.server.stats()["rnum"], 2)
+
+    def test_mget(self):
+        self.db.putlist(["a", "1", "b", "2"])
+        self.assertEqual(self.db.mget(["a", "b", "c"]), {"a": "1", "b": "2"})
+        self.assertEqual(self.db.mget([]), {})
+
+    def test_cache_hits(self):
+        self.db.enable_cache(1 << 20)
+        self.db.put("a", "1")
+        self.assertEqual(self.db.get("a"), "1")
+        self.assertEqual(self.db.get("a"), "1")
+        self.assertEqual(self.db.mget(["a"]), {"a": "1"})
+        stats = self.db.cache_stats()
+        self.assertEqual(stats["misses"], 1)
+        self.assertEqual(stats["hits"], 2)
+        self.assertEqual(stats["entries"], 1)
+
+    def test_cache_invalidation(self):
+        self.db.enable_cache(1 << 20)
+        self.db.put("a", "1")
+        self.db.put("b", "2")
+        self.assertEqual(self.db.mget(["a", "b"]), {"a": "1", "b": "2"})
+        self.db.put("a", "3")
+        self.assertEqual(self.db.get("a"), "3")
+        self.db.out("a")
+        self.assertEqual(self.db.get("a"), None)
+        self.db.outlist(["b"])
+        self.assertEqual(self.db.get("b"), None)
+        self.db.put("c", "4")
+        self.assertEqual(self.db.get("c"), "4")
+        self.db.vanish()
+        self.assertEqual(self.db.get("c"), None)
+
+    def test_cache_writes_through_pipeline(self):
+        self.db.enable_cache(1 << 20)
+        self.db.put("a", "1")
+        self.assertEqual(self.db.get("a"), "1")
+        with self.db.pipeline() as pipe:
+            pipe.put("a", "2")
+        self.assertEqual(self.db.get("a"), "2")
+
+
+class TestPipeline(ServerTestCase):
+
+    def test_replies_in_order(self):
+        pipe = self.db.pipeline()
+        pipe.put("a", "1")
+        pipe.put("b", "2")
+        pipe.get("a")
+        pipe.get("c")
+        pipe.mget(["a", "b"])
+        pipe.vsiz("b")
+        pipe.rnum()
+        results = pipe.execute()
+        self.assertEqual(results, [None, None, "1", None, {"a": "1", "b": "2"}, 1, 2])
+        self.assertEqual(pipe.results, results)
+
+    def test_injected_failures(self):
+        self.server.failure_rate = 0.5
+        before = self.server.stats()
+        pipe = self.db.pipeline()
+        for i in range(100):
+            pipe.put("key%d" % i, "value%d" % i)
+        results = pipe.execute()
+        self.server.failure_rate = 0.0
+        after = self.server.stats()
+
+        failed = [i for i, r in enumerate(results) if isinstance(r, tokyotyrant.error)]
+        self.assertEqual(len(results), 100)
+        self.assertEqual(len(failed), after["failures"] - before["failures"])
+        self.assertTrue(0 < len(failed) < 100)
+        self.assertEqual(after["rnum"], 100 - len(failed))
+
+        # The connection stays in step with the server after failed replies.
+        for i in range(100):
+            expected = None if i in failed else "value%d" % i
+            self.assertEqual(self.db.get("key%d" % i), expected)
+
+    def test_failures_are_reproducible(self):
+        def run(seed):
+            server = self.start_server(failure_rate=0.3, seed=seed)
+            db = connect(server)
+            try:
+                pipe = db.pipeline()
+                for i in range(50):
+                    pipe.put(str(i), "x")
+                return [isinstance(r, tokyotyrant.error) for r in pipe.execute()]
+            finally:
+                db.close()
+                server.stop()
+        self.assertEqual(run(7), run(7))
+
+
+class TestLoadDump(ServerTestCase):
+
+    def write(self, name, lines):
+        path = os.path.join(self.tmpdir, name)
+        f = open(path, "w")
+        f.write("".join(line + "\n" for line in lines))
+        f.close()
+        return path
+
+    def read(self, path):
+        f = open(path)
+        lines = sorted(f.read().splitlines())
+        f.close()
+        return lines
+
+    def test_round_trip(self):
+        lines = ["key%04d\tvalue%d" % (i, i) for i in range(2500)]
+        path = self.write("in.tsv", lines)
+        result = self.db.load(path, batch=300)
+        self.assertEqual(result["loaded"], 2500)
+        self.assertEqual(result["failed"], 0)
+        self.assertEqual(result["malformed"], 0)
+        self.assertEqual(self.db.get("key0042"), "value42")
+
+        out = os.path.join(self.tmpdir, "out.tsv")
+        result = self.db.dump(out, batch=300)
+        self.assertEqual(result["dumped"], 2500)
+        self.assertEqual(self.read(out), sorted(lines))
+
+    def test_round_trip_kv(self):
+        lines = ["k%d=v%d" % (i, i) for i in range(100)] + ["malformed"]
+        result = self.db.load(self.write("in.kv", lines), format="kv")
+        self.assertEqual(result["loaded"], 100)
+        self.assertEqual(result["malformed"], 1)
+
+        out = os.path.join(self.tmpdir, "out.kv")
+        self.db.dump(out, format="kv")
+        self.assertEqual(self.read(out), sorted(lines[:-1]))
+
+    def test_progress(self):
+        calls = []
+        path = self.write("in.tsv", ["k%d\tv" % i for i in range(10)])
+        self.db.load(path, batch=3, progress=lambda loaded, failed: calls.append(loaded))
+        self.assertEqual(calls, [3, 6, 9, 10])
+
+    def test_stops_on_lost_connection(self):
+        self.db.close()
+        self.db = connect(self.server, timeout=0.5)
+        self.server.latency = 2.0
+        path = self.write("in.tsv", ["k%d\tv" % i for i in range(10)])
+        self.assertRaises(tokyotyrant.error, self.db.load, path, batch=3)
+        self.server.latency = 0.0
+
+
+class TestIterKeys(ServerTestCase):
+
+    def setUp(self):
+        ServerTestCase.setUp(self)
+        self.db.putlist(sum([["k%02d" % i, "v"] for i in range(20)], []))
+
+    def test_all_keys(self):
+        self.assertEqual(sorted(self.db.iterkeys(batch=3)), ["k%02d" % i for i in range(20)])
+
+    def test_timeout(self):
+        self.db.close()
+        self.db = connect(self.server, timeout=0.5)
+        keys = self.db.iterkeys(batch=5)
+        seen = [keys.next() for i in range(5)]
+        self.server.latency = 2.0
+        self.assertRaises(tokyotyrant.error, keys.next)
+        self.assertRaises(StopIteration, keys.next)
+        self.server.latency = 0.0
+
+        # The lost replies closed the connection rather than being read as
+        # answers to later commands.
+        self.assertRaises(tokyotyrant.error, self.db.put, "k00", "v")
+        db = connect(self.server)
+        self.assertEqual(len(set(seen)), 5)
+        self.assertEqual(len(list(db.iterkeys())), 20)
+        db.close()
+
+
+class TestShardedQuery(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.servers = []
+        for name in ("a.tct", "b.tct"):
+            server = tokyotyrant.TyrantServer("127.0.0.1", free_port(),
+                os.path.join(self.tmpdir, name))
+            server.start()
+            self.servers.append(server)
+        self.db = tokyotyrant.ShardedTyrant([(s.host, s.port) for s in self.servers])
+        for i in range(40):
+            self.db.tblput("row%02d" % i, {"n": str((i * 7) % 40), "even": str(i % 2 == 0)})
+
+    def tearDown(self):
+        for server in self.servers:
+            server.stop()
+        shutil.rmtree(self.tmpdir)
+
+    def expected(self, desc=False):
+        rows = [("row%02d" % i, (i * 7) % 40) for i in range(40)]
+        rows.sort(key=lambda row: row[1], reverse=desc)
+        return [key for key, n in rows]
+
+    def test_rows_on_both_servers(self):
+        counts = [server.stats()["rnum"] for server in self.servers]
+        self.assertEqual(sum(counts), 40)
+        self.assertTrue(all(counts))
+
+    def test_merge_ascending(self):
+        query = self.db.tblquery()
+        query.setorder("n", tokyotyrant.RDBQONUMASC)
+        self.assertEqual(query.search(), self.expected())
+
+    def test_merge_descending_with_limit(self):
+        query = self.db.tblquery()
+        query.setorder("n", tokyotyrant.RDBQONUMDESC)
+        query.setlimit(10, 5)
+        self.assertEqual(query.search(), self.expected(desc=True)[5:15])
+
+    def test_merge_with_condition(self):
+        query = self.db.tblquery()
+        query.addcond("even", tokyotyrant.RDBQCSTREQ, "True")
+        query.setorder("n", tokyotyrant.RDBQONUMASC)
+        rows = query.searchget()
+        expected = [key for key in self.expected() if int(key[3:]) % 2 == 0]
+        self.assertEqual([row[""] for row in rows], expected)
+        self.assertEqual([int(row["n"]) for row in rows], sorted(int(row["n"]) for row in rows))
+        self.assertEqual(query.searchcount(), 20)
+
+
+if __name__ == "__main__":
+    unittest.main()
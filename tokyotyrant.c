@@ -1,1744 +1,14095 @@
 #include <Python.h>
 #include <tcrdb.h>
+#include <tcadb.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
 
 
+#define COLNAME_CACHE_SIZE 256
+#define COLNAME_CACHE_MAXLEN 64
+
+static PyObject *colname_cache[COLNAME_CACHE_SIZE];
+
+
+/*
+ * Get an interned string for a column name. Table rows repeat the same few
+ * names over and over, so recently seen names are kept in a small hashed
+ * cache and shared between rows instead of being allocated per cell.
+ */
 static PyObject *
-tcmap2pydict(TCMAP *map)
+pycolname(const char *kbuf, int ksiz)
 {
-    const char *kstr, *vstr;
-    PyObject *dict, *value;
+    int i;
+    uint32_t hash = (uint32_t) ksiz;
+    PyObject **slot, *name;
     
-    dict = PyDict_New();
+    if (ksiz > COLNAME_CACHE_MAXLEN)
+    {
+        return PyString_FromStringAndSize(kbuf, ksiz);
+    }
     
-    if (dict == NULL)
+    for (i=0; i<ksiz; i++)
     {
-        PyErr_SetString(PyExc_MemoryError, "Could not allocate memory for dict.");
-        return NULL;
+        hash = hash * 31 + (unsigned char) kbuf[i];
     }
     
-    tcmapiterinit(map);
-    kstr = tcmapiternext2(map);
+    slot = &colname_cache[hash % COLNAME_CACHE_SIZE];
     
-    while (kstr != NULL)
+    if (*slot && PyString_GET_SIZE(*slot) == ksiz &&
+        !memcmp(PyString_AS_STRING(*slot), kbuf, ksiz))
     {
-        vstr = tcmapget2(map, kstr);
-        
-        if (vstr == NULL)
-        {
-            Py_DECREF(dict);
-            PyErr_SetString(PyExc_MemoryError, "Could not allocate memory for map value.");
-            return NULL;
-        }
-        
-        value = PyString_FromString(vstr);
-        
-        if (value == NULL)
-        {
-            Py_DECREF(dict);
-            PyErr_SetString(PyExc_MemoryError, "Could not allocate memory for dict value.");
-            return NULL;
-        }
-        
-        if (PyDict_SetItemString(dict, kstr, value) != 0)
-        {
-            Py_DECREF(value);
-            Py_DECREF(dict);
-            PyErr_SetString(PyExc_Exception, "Could not set dict item.");
-            return NULL;
-        }
-        
-        Py_DECREF(value);
-        
-        kstr = tcmapiternext2(map);
+        Py_INCREF(*slot);
+        return *slot;
     }
     
-    return dict;
+    name = PyString_FromStringAndSize(kbuf, ksiz);
+    
+    if (!name)
+    {
+        return NULL;
+    }
+    
+    PyString_InternInPlace(&name);
+    Py_XDECREF(*slot);
+    Py_INCREF(name);
+    *slot = name;
+    
+    return name;
 }
 
 
-static TCMAP *
-pydict2tcmap(PyObject *dict)
+/*
+ * Check that a column schema maps names to int, long, float or str.
+ * None means no schema.
+ */
+static int
+pyschema_check(PyObject *schema)
 {
-    if (!PyDict_Check(dict))
+    Py_ssize_t pos = 0;
+    PyObject *name, *type;
+    
+    if (schema == Py_None)
     {
-        PyErr_SetString(PyExc_TypeError, "Argument is not a dict.");
-        return NULL;
+        return 0;
     }
     
-    PyObject *key, *value;
-    int pos = 0;
-    const char *kstr, *vstr;
-    TCMAP *map;
-    
-    map = tcmapnew();
-    
-    if (map == NULL)
+    if (!PyDict_Check(schema))
     {
-        PyErr_SetString(PyExc_MemoryError, "Could not allocate map.");
-        return NULL;
+        PyErr_SetString(PyExc_TypeError, "Expected schema to be a dict.");
+        return -1;
     }
     
-    while (PyDict_Next(dict, &pos, &key, &value))
+    while (PyDict_Next(schema, &pos, &name, &type))
     {
-        if (!PyString_Check(value))
+        if (!PyString_Check(name) ||
+            (type != (PyObject *) &PyInt_Type && type != (PyObject *) &PyLong_Type &&
+             type != (PyObject *) &PyFloat_Type && type != (PyObject *) &PyString_Type))
         {
-            tcmapdel(map);
-            PyErr_SetString(PyExc_TypeError, "All values must be strings.");
-            return NULL;
+            PyErr_SetString(PyExc_TypeError,
+                "Expected schema to map column names to int, long, float or str.");
+            return -1;
         }
-        
-        kstr = PyString_AsString(key);
-        vstr = PyString_AsString(value);
-        
-        tcmapput2(map, kstr, vstr);
     }
     
-    return map;
+    return 0;
 }
 
 
-static PyObject *TyrantError;
-
-
-static void
-raise_tyrant_error(TCRDB *db)
+/*
+ * Parse a column value as a long or a double. The whole value must be
+ * consumed; errno is left at ERANGE when a long overflowed.
+ */
+static bool
+colnumparse(const char *vbuf, int vsiz, bool isfloat, long *lval, double *dval)
 {
-    int code = tcrdbecode(db);
-    const char *msg = tcrdberrmsg(code);
+    char num[64], *end;
     
-    if (code == TCENOREC)
+    if (vsiz <= 0 || vsiz >= (int) sizeof(num))
     {
-        PyErr_SetString(PyExc_KeyError, msg);
+        return false;
     }
-    else
+    
+    memcpy(num, vbuf, vsiz);
+    num[vsiz] = '\0';
+    errno = 0;
+    
+    if (isfloat)
     {
-        PyErr_SetString(TyrantError, msg);
+        *dval = strtod(num, &end);
     }
-}
-
-
-static PyTypeObject TyrantType;
-static PyTypeObject TyrantQueryType;
-
-
-typedef struct
-{
-    PyObject_HEAD
-    TCRDB *db;
-} Tyrant;
-
-
-typedef struct
-{
-    PyObject_HEAD
-    RDBQRY *q;
-} TyrantQuery;
-
-
-static long
-TyrantQuery_Hash(PyObject *self)
-{
-    PyErr_SetString(PyExc_TypeError, "Tyrant query objects are not hashable.");
-    return -1;
-}
-
-
-static void
-TyrantQuery_dealloc(TyrantQuery *self)
-{
-    if (self->q)
+    else
     {
-        Py_BEGIN_ALLOW_THREADS
-        tcrdbqrydel(self->q);
-        Py_END_ALLOW_THREADS
+        *lval = strtol(num, &end, 10);
     }
-    self->ob_type->tp_free(self);
+    
+    return *end == '\0';
 }
 
 
+/*
+ * Convert a column value to the number type given by a schema. Returns NULL
+ * without an exception set when the value does not parse, in which case it
+ * is kept as a string.
+ */
 static PyObject *
-TyrantQuery_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+pycolnumber(const char *vbuf, int vsiz, PyObject *type)
 {
-    TyrantQuery *self;
-    Tyrant *pydb;
+    long lval;
+    double dval;
+    PyObject *str, *value;
     
-    self = (TyrantQuery *) type->tp_alloc(type, 0);
-    if (!self)
+    if (!colnumparse(vbuf, vsiz, type == (PyObject *) &PyFloat_Type, &lval, &dval))
     {
-        PyErr_SetString(PyExc_MemoryError, "Cannot allocate TyrantQuery instance.");
         return NULL;
     }
     
-    if (PyArg_ParseTuple(args, "O!", &TyrantType, &pydb))
+    if (type == (PyObject *) &PyFloat_Type)
     {
-        self->q = tcrdbqrynew(pydb->db);
-        if (!self->q)
-        {
-            raise_tyrant_error(pydb->db);
-        }
-        else
+        return PyFloat_FromDouble(dval);
+    }
+    
+    if (errno == ERANGE)
+    {
+        str = PyString_FromStringAndSize(vbuf, vsiz);
+        if (!str)
         {
-            return (PyObject *) self;
+            return NULL;
         }
+        value = PyLong_FromString(PyString_AS_STRING(str), NULL, 10);
+        Py_DECREF(str);
+        return value;
     }
     
-    TyrantQuery_dealloc(self);
-    return NULL;
+    return type == (PyObject *) &PyLong_Type ? PyLong_FromLong(lval) : PyInt_FromLong(lval);
 }
 
 
-static PyObject *
-TyrantQuery_addcond(TyrantQuery *self, PyObject *args, PyObject *kwargs)
+static int
+pydictsetcol(PyObject *dict, const char *kbuf, int ksiz, const char *vbuf, int vsiz,
+    PyObject *schema)
 {
-    const char *name, *expr;
-    name = expr = NULL;
-    int op = 0;
+    int rv;
+    PyObject *key, *type, *value = NULL;
     
-    static char *kwlist[] = {"name", "op", "expr", NULL};
+    key = pycolname(kbuf, ksiz);
     
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|s:addcond", kwlist, 
-        &name, &op, &expr))
+    if (!key)
     {
-        return NULL;
+        return -1;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    tcrdbqryaddcond(self->q, name, op, expr);
-    Py_END_ALLOW_THREADS
+    type = schema ? PyDict_GetItem(schema, key) : NULL;
     
-    Py_RETURN_NONE;
-}
-
-
-static PyObject *
-TyrantQuery_setorder(TyrantQuery *self, PyObject *args)
-{
-    const char *name;
-    int type;
+    if (type && type != (PyObject *) &PyString_Type)
+    {
+        value = pycolnumber(vbuf, vsiz, type);
+    }
     
-    if (!PyArg_ParseTuple(args, "si:setorder", &name, &type))
+    if (!value && !PyErr_Occurred())
     {
-        return NULL;
+        value = PyString_FromStringAndSize(vbuf, vsiz);
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    tcrdbqrysetorder(self->q, name, type);
-    Py_END_ALLOW_THREADS
+    if (!value)
+    {
+        Py_DECREF(key);
+        return -1;
+    }
     
-    Py_RETURN_NONE;
+    rv = PyDict_SetItem(dict, key, value);
+    Py_DECREF(key);
+    Py_DECREF(value);
+    
+    return rv;
 }
 
 
 static PyObject *
-TyrantQuery_setlimit(TyrantQuery *self, PyObject *args)
+tcmap2pydict(TCMAP *map, PyObject *schema)
 {
-    int max, skip;
-    max = skip = -1;
+    const char *kbuf, *vbuf;
+    int ksiz, vsiz;
+    PyObject *dict;
     
-    if (!PyArg_ParseTuple(args, "ii:setlimit", &max, &skip))
+    dict = _PyDict_NewPresized(tcmaprnum(map));
+    
+    if (dict == NULL)
     {
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    tcrdbqrysetlimit(self->q, max, skip);
-    Py_END_ALLOW_THREADS
+    tcmapiterinit(map);
     
-    Py_RETURN_NONE;
+    while ((kbuf = tcmapiternext(map, &ksiz)) != NULL)
+    {
+        vbuf = tcmapiterval(kbuf, &vsiz);
+        
+        if (pydictsetcol(dict, kbuf, ksiz, vbuf, vsiz, schema) != 0)
+        {
+            Py_DECREF(dict);
+            return NULL;
+        }
+    }
+    
+    return dict;
 }
 
 
+/*
+ * Build a dict straight from a serialized row, the NUL separated list of
+ * names and values the server sends, without an intermediate TCMAP.
+ * Columns named in `schema` are converted to numbers.
+ */
 static PyObject *
-TyrantQuery_search(TyrantQuery *self)
+pycols2pydict(const char *buf, int siz, PyObject *schema)
 {
-    TCLIST *results;
-    int n = 0, i=0, vsiz = 0;
-    const char *vbuf;
-    PyObject *pylist, *val;
+    int i, n = 0, ksiz = 0;
+    const char *rp, *ep, *end, *kbuf = NULL;
+    PyObject *dict;
     
-    Py_BEGIN_ALLOW_THREADS
-    results = tcrdbqrysearch(self->q);
-    Py_END_ALLOW_THREADS
+    for (i=0; i<siz; i++)
+    {
+        n += buf[i] == '\0';
+    }
     
-    if (!results)
+    dict = _PyDict_NewPresized(n / 2 + 1);
+    
+    if (dict == NULL)
     {
-        PyErr_SetString(PyExc_MemoryError, "Cannot allocate memory for TCLIST object");
         return NULL;
     }
     
-    n = tclistnum(results);
-    pylist = PyList_New(n);
+    rp = buf;
+    end = buf + siz;
     
-    if (pylist)
+    while (rp <= end)
     {
-        for (i=0; i<n; i++)
+        ep = rp;
+        
+        while (ep < end && *ep != '\0')
         {
-            vbuf = tclistval(results, i, &vsiz);
-            val = PyString_FromStringAndSize(vbuf, vsiz);
-            PyList_SET_ITEM(pylist, i, val);
-            
-            vsiz = 0;
+            ep++;
+        }
+        
+        if (kbuf)
+        {
+            if (pydictsetcol(dict, kbuf, ksiz, rp, (int) (ep - rp), schema) != 0)
+            {
+                Py_DECREF(dict);
+                return NULL;
+            }
+            kbuf = NULL;
+        }
+        else
+        {
+            kbuf = rp;
+            ksiz = (int) (ep - rp);
         }
+        
+        rp = ep + 1;
     }
-    tclistdel(results);
     
-    return pylist;
+    return dict;
 }
 
 
-static PyObject *
-TyrantQuery_searchout(TyrantQuery *self)
+/*
+ * One column of a columnar search result. Numeric columns are packed into a
+ * raw buffer that becomes an array.array; the rest collect str objects.
+ * `type` is the schema type of a numeric column, borrowed from the schema.
+ */
+typedef struct
 {
-    bool success;
-    
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbqrysearchout(self->q);
-    Py_END_ALLOW_THREADS
-    
-    return Py_BuildValue("i", success);
-}
+    PyObject *name;
+    PyObject *type;
+    bool numeric;
+    bool isfloat;
+    TCXSTR *raw;
+    PyObject *list;
+    int rows;
+} TyrantColumn;
 
 
-static PyObject *
-TyrantQuery_searchget(TyrantQuery *self)
+/*
+ * Move the values packed so far into a list, once a row turns up that the
+ * array cannot represent: a gap, a value that does not parse or an int too
+ * large for a long.
+ */
+static int
+column_unpack(TyrantColumn *col)
 {
-    TCLIST *results;
-    int n=0, i=0;
-    TCMAP *map;
-    PyObject *pylist, *dict;
+    int i, n;
+    long lval;
+    double dval;
+    const char *raw;
+    PyObject *value;
     
-    Py_BEGIN_ALLOW_THREADS
-    results = tcrdbqrysearchget(self->q);
-    Py_END_ALLOW_THREADS
+    n = tcxstrsize(col->raw) / (col->isfloat ? sizeof(dval) : sizeof(lval));
+    raw = tcxstrptr(col->raw);
+    col->list = PyList_New(n);
     
-    if (!results)
+    if (!col->list)
     {
-        PyErr_SetString(PyExc_MemoryError, "Cannot allocate memory for TCLIST object");
-        return NULL;
+        return -1;
     }
     
-    n = tclistnum(results);
-    pylist = PyList_New(n);
-    
-    if (pylist)
+    for (i=0; i<n; i++)
     {
-        for (i=0; i<n; i++)
+        if (col->isfloat)
         {
-            map = tcrdbqryrescols(results, i);
-            
-            if (!map)
-            {
-                PyErr_SetString(PyExc_MemoryError, "Cannot allocate memory for TCMAP object");
-                tclistdel(results);
-                return NULL;
-            }
-            
-            dict = tcmap2pydict(map);
-            
-            if (!dict)
-            {
-                tcmapdel(map);
-                tclistdel(results);
-                return NULL;
-            }
-            
-            PyList_SET_ITEM(pylist, i, dict);
-            
-            tcmapdel(map);
+            memcpy(&dval, raw + i * sizeof(dval), sizeof(dval));
+            value = PyFloat_FromDouble(dval);
+        }
+        else
+        {
+            memcpy(&lval, raw + i * sizeof(lval), sizeof(lval));
+            value = col->type == (PyObject *) &PyLong_Type ?
+                PyLong_FromLong(lval) : PyInt_FromLong(lval);
+        }
+        
+        if (!value)
+        {
+            return -1;
         }
+        
+        PyList_SET_ITEM(col->list, i, value);
     }
-    tclistdel(results);
-    
-    return pylist;
-}
-
-
-static PyObject *
-TyrantQuery_searchcount(TyrantQuery *self)
-{
-    int n = 0;
-    
-    Py_BEGIN_ALLOW_THREADS
-    n = tcrdbqrysearchcount(self->q);
-    Py_END_ALLOW_THREADS
-    
-    return Py_BuildValue("i", n);
-}
-
-
-static PyObject *
-TyrantQuery_hint(TyrantQuery *self)
-{
-    const char *hint;
     
-    Py_BEGIN_ALLOW_THREADS
-    hint = tcrdbqryhint(self->q);
-    Py_END_ALLOW_THREADS
+    tcxstrdel(col->raw);
+    col->raw = NULL;
+    col->numeric = false;
     
-    return PyString_FromString(hint);
+    return 0;
 }
 
 
-static PyMethodDef TyrantQuery_methods[] = 
+static int
+column_push(TyrantColumn *col, const char *vbuf, int vsiz)
 {
-    {
-        "addcond", (PyCFunction) TyrantQuery_addcond,
-        METH_VARARGS | METH_KEYWORDS,
-        "Add a condition."
-    },
+    long lval = 0;
+    double dval = 0;
+    PyObject *value = NULL;
+    int rv;
     
+    if (col->numeric)
     {
-        "setorder", (PyCFunction) TyrantQuery_setorder,
-        METH_VARARGS,
-        "Set the column and direction to order by."
-    },
+        if (vbuf && colnumparse(vbuf, vsiz, col->isfloat, &lval, &dval) &&
+            (col->isfloat || errno != ERANGE))
+        {
+            if (col->isfloat)
+            {
+                tcxstrcat(col->raw, &dval, sizeof(dval));
+            }
+            else
+            {
+                tcxstrcat(col->raw, &lval, sizeof(lval));
+            }
+            col->rows++;
+            return 0;
+        }
+        
+        if (column_unpack(col) != 0)
+        {
+            return -1;
+        }
+    }
     
-    {
-        "setlimit", (PyCFunction) TyrantQuery_setlimit,
-        METH_VARARGS,
-        "Set the offset and limit of the results."
-    },
+    col->rows++;
     
+    if (!vbuf)
     {
-        "search", (PyCFunction) TyrantQuery_search,
-        METH_NOARGS,
-        "Run the query. Returns the keys of matching records"
-    },
+        return PyList_Append(col->list, Py_None);
+    }
     
+    /* Converted as in row mode: numbers where they parse, str otherwise. */
+    if (col->type)
     {
-        "searchout", (PyCFunction) TyrantQuery_searchout,
-        METH_NOARGS,
-        "Remove all matching records."
-    },
+        value = pycolnumber(vbuf, vsiz, col->type);
+    }
     
+    if (!value && !PyErr_Occurred())
     {
-        "searchget", (PyCFunction) TyrantQuery_searchget,
-        METH_NOARGS,
-        "Run the query. Returns the matching records."
-    },
+        value = PyString_FromStringAndSize(vbuf, vsiz);
+    }
     
+    if (!value)
     {
-        "searchcount", (PyCFunction) TyrantQuery_searchcount,
-        METH_NOARGS,
-        "Get a count of matching records."
-    },
+        return -1;
+    }
     
-    {
-        "hint", (PyCFunction) TyrantQuery_hint,
-        METH_NOARGS,
-        "Get the hint for a query."
-    },
+    rv = PyList_Append(col->list, value);
+    Py_DECREF(value);
     
-    { NULL }
-};
-
-
-static PyTypeObject TyrantQueryType = {
-  PyObject_HEAD_INIT(NULL)
-  0,                                           /* ob_size */
-  "tokyocabinet.tyrant.TyrantQuery",           /* tp_name */
-  sizeof(TyrantQuery),                         /* tp_basicsize */
-  0,                                           /* tp_itemsize */
-  (destructor)TyrantQuery_dealloc,             /* tp_dealloc */
-  0,                                           /* tp_print */
-  0,                                           /* tp_getattr */
-  0,                                           /* tp_setattr */
-  0,                                           /* tp_compare */
-  0,                                           /* tp_repr */
-  0,                                           /* tp_as_number */
-  0,                                           /* tp_as_sequence */
-  0,                                           /* tp_as_mapping */
-  TyrantQuery_Hash,                            /* tp_hash  */
-  0,                                           /* tp_call */
-  0,                                           /* tp_str */
-  0,                                           /* tp_getattro */
-  0,                                           /* tp_setattro */
-  0,                                           /* tp_as_buffer */
-  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
-  "Tyrant database query",                     /* tp_doc */
-  0,                                           /* tp_traverse */
-  0,                                           /* tp_clear */
-  0,                                           /* tp_richcompare */
-  0,                                           /* tp_weaklistoffset */
-  0,                                           /* tp_iter */
-  0,                                           /* tp_iternext */
-  TyrantQuery_methods,                         /* tp_methods */
-  0,                                           /* tp_members */
-  0,                                           /* tp_getset */
-  0,                                           /* tp_base */
-  0,                                           /* tp_dict */
-  0,                                           /* tp_descr_get */
-  0,                                           /* tp_descr_set */
-  0,                                           /* tp_dictoffset */
-  0,                                           /* tp_init */
-  0,                                           /* tp_alloc */
-  TyrantQuery_new,                             /* tp_new */
-};
-
-
-static long
-Tyrant_Hash(PyObject *self)
-{
-    PyErr_SetString(PyExc_TypeError, "Tyrant objects are not hashable.");
-    return -1;
+    return rv;
 }
 
 
-static void
-Tyrant_dealloc(Tyrant *self)
+static int
+column_pad(TyrantColumn *col, int rows)
 {
-    if (self->db)
+    while (col->rows < rows)
     {
-        Py_BEGIN_ALLOW_THREADS
-        tcrdbdel(self->db);
-        Py_END_ALLOW_THREADS
+        if (column_push(col, NULL, 0) != 0)
+        {
+            return -1;
+        }
     }
-    self->ob_type->tp_free(self);
+    
+    return 0;
 }
 
 
-static PyObject *
-Tyrant_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+static TyrantColumn *
+column_find(TyrantColumn **cols, int *ncols, PyObject *index, PyObject *schema,
+    const char *kbuf, int ksiz)
 {
-    Tyrant *self;
+    PyObject *name, *pos, *type;
+    TyrantColumn *col, *grown;
     
-    self = (Tyrant *) type->tp_alloc(type, 0);
-    if (!self)
+    name = pycolname(kbuf, ksiz);
+    
+    if (!name)
     {
-        PyErr_SetString(PyExc_MemoryError, "Cannot allocate Tyrant instance.");
         return NULL;
     }
     
-    self->db = tcrdbnew();
-    if (!self->db)
+    pos = PyDict_GetItem(index, name);
+    
+    if (pos)
     {
-        PyErr_SetString(PyExc_MemoryError, "Cannot allocate TCRDB instance.");
-        return NULL;
+        Py_DECREF(name);
+        return *cols + PyInt_AS_LONG(pos);
     }
     
-    return (PyObject *) self;
-}
-
-
-static PyObject *
-Tyrant_tune(Tyrant *self, PyObject *args, PyObject *kwargs)
-{
-    bool success = 0;
-    double timeout;
-    int opts = 0;
-    
-    static char *kwlist[] = {"timeout", "opts", NULL };
+    grown = realloc(*cols, sizeof(TyrantColumn) * (*ncols + 1));
+    pos = PyInt_FromLong(*ncols);
     
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "di:tune", kwlist, 
-        &timeout, &opts))
+    if (!grown || !pos || PyDict_SetItem(index, name, pos) != 0)
     {
+        if (grown)
+        {
+            *cols = grown;
+        }
+        Py_XDECREF(pos);
+        Py_DECREF(name);
+        if (!PyErr_Occurred())
+        {
+            PyErr_NoMemory();
+        }
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbtune(self->db, timeout, opts);
-    Py_END_ALLOW_THREADS
+    Py_DECREF(pos);
+    *cols = grown;
+    col = grown + (*ncols)++;
     
-    if (!success)
+    type = schema ? PyDict_GetItem(schema, name) : NULL;
+    col->name = name;
+    col->numeric = type && type != (PyObject *) &PyString_Type;
+    col->type = col->numeric ? type : NULL;
+    col->isfloat = type == (PyObject *) &PyFloat_Type;
+    col->raw = col->numeric ? tcxstrnew() : NULL;
+    col->list = col->numeric ? NULL : PyList_New(0);
+    col->rows = 0;
+    
+    if (!col->numeric && !col->list)
     {
-        raise_tyrant_error(self->db);
         return NULL;
     }
-    Py_RETURN_NONE;
+    
+    return col;
 }
 
 
+/*
+ * Pivot serialized rows into a dict of columns. Columns whose schema type is
+ * int or float become array.array('l') or array.array('d') when every row
+ * has a value that fits. Otherwise, and for all other columns, they become
+ * lists with None for gaps, holding the same values row mode would.
+ */
 static PyObject *
-Tyrant_open(Tyrant *self, PyObject *args, PyObject *kwargs)
+tclist2pycolumns(const TCLIST *rows, PyObject *schema)
 {
-    char *host = NULL;
-    int port = 0;
-    static char *kwlist[] = { "host", "port", NULL };
+    static PyObject *arraytype = NULL;
+    int i, j, n, siz, ksiz = 0, ncols = 0;
+    const char *buf, *rp, *ep, *end, *kbuf;
+    bool ok = true;
+    TyrantColumn *cols = NULL, *col;
+    PyObject *index, *result = NULL, *value, *module;
     
-    if (PyArg_ParseTupleAndKeywords(args, kwargs, "si:open", kwlist, &host, &port))
+    if (!arraytype)
     {
-        bool success = 0;
-        Py_BEGIN_ALLOW_THREADS
-        success = tcrdbopen(self->db, host, port);
-        Py_END_ALLOW_THREADS
-        if (success)
+        module = PyImport_ImportModule("array");
+        if (!module)
         {
-            Py_RETURN_NONE;
+            return NULL;
+        }
+        arraytype = PyObject_GetAttrString(module, "array");
+        Py_DECREF(module);
+        if (!arraytype)
+        {
+            return NULL;
         }
-        raise_tyrant_error(self->db);
-    }
-    return NULL;
-}
-
-
-static PyObject *
-Tyrant_close(Tyrant *self)
-{
-    bool success = 0;
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbclose(self->db);
-    Py_END_ALLOW_THREADS
-    if (!success)
-    {
-        raise_tyrant_error(self->db);
-        return NULL;
     }
-    Py_RETURN_NONE;
-}
-
-
-static PyObject *
-Tyrant_put(Tyrant *self, PyObject *args)
-{
-    bool success;
-    char *kbuf, *vbuf;
-    int ksiz, vsiz;
     
-    if (!PyArg_ParseTuple(args, "s#s#:put", &kbuf, &ksiz, &vbuf, &vsiz))
+    index = PyDict_New();
+    
+    if (!index)
     {
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbput(self->db, kbuf, ksiz, vbuf, vsiz);
-    Py_END_ALLOW_THREADS
+    n = tclistnum(rows);
     
-    if (!success)
+    for (i=0; ok && i<n; i++)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
-    }
-    Py_RETURN_NONE;
-}
+        buf = tclistval(rows, i, &siz);
+        rp = buf;
+        end = buf + siz;
+        kbuf = NULL;
+        
+        while (ok && rp <= end)
+        {
+            ep = rp;
+            
+            while (ep < end && *ep != '\0')
+            {
+                ep++;
+            }
+            
+            if (kbuf)
+            {
+                col = column_find(&cols, &ncols, index, schema, kbuf, ksiz);
+                ok = col && column_pad(col, i) == 0 &&
+                    (col->rows > i || column_push(col, rp, (int) (ep - rp)) == 0);
+                kbuf = NULL;
+            }
+            else
+            {
+                kbuf = rp;
+                ksiz = (int) (ep - rp);
+            }
+            
+            rp = ep + 1;
+        }
+    }
+    
+    if (ok)
+    {
+        result = _PyDict_NewPresized(ncols);
+    }
+    
+    for (j=0; result && j<ncols; j++)
+    {
+        col = cols + j;
+        
+        if (column_pad(col, n) != 0)
+        {
+            Py_CLEAR(result);
+            break;
+        }
+        
+        if (col->numeric)
+        {
+            value = PyObject_CallFunction(arraytype, "ss#", col->isfloat ? "d" : "l",
+                tcxstrptr(col->raw), tcxstrsize(col->raw));
+        }
+        else
+        {
+            value = col->list;
+            Py_INCREF(value);
+        }
+        
+        if (!value || PyDict_SetItem(result, col->name, value) != 0)
+        {
+            Py_CLEAR(result);
+        }
+        
+        Py_XDECREF(value);
+    }
+    
+    for (j=0; j<ncols; j++)
+    {
+        Py_XDECREF(cols[j].name);
+        Py_XDECREF(cols[j].list);
+        if (cols[j].raw)
+        {
+            tcxstrdel(cols[j].raw);
+        }
+    }
+    
+    free(cols);
+    Py_DECREF(index);
+    
+    return result;
+}
 
 
+/*
+ * Get a str for a column value or query operand. Numbers are written in the
+ * form the server's numeric conditions and orderings parse. Returns NULL
+ * without an exception set for other types.
+ */
 static PyObject *
-Tyrant_putkeep(Tyrant *self, PyObject *args)
+pyscalar2pystring(PyObject *value)
 {
-    bool success;
-    char *kbuf, *vbuf;
-    int ksiz, vsiz;
+    if (PyString_Check(value))
+    {
+        Py_INCREF(value);
+        return value;
+    }
     
-    if (!PyArg_ParseTuple(args, "s#s#:putkeep", &kbuf, &ksiz, &vbuf, &vsiz))
+    if (PyInt_Check(value))
     {
-        return NULL;
+        return PyString_FromFormat("%ld", PyInt_AS_LONG(value));
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbputkeep(self->db, kbuf, ksiz, vbuf, vsiz);
-    Py_END_ALLOW_THREADS
+    if (PyLong_Check(value))
+    {
+        return PyObject_Str(value);
+    }
     
-    if (!success)
+    if (PyFloat_Check(value))
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        return PyObject_Repr(value);
     }
-    Py_RETURN_NONE;
+    
+    return NULL;
 }
 
 
-static PyObject *
-Tyrant_putcat(Tyrant *self, PyObject *args)
+static TCMAP *
+pydict2tcmap(PyObject *dict)
 {
-    bool success;
-    char *kbuf, *vbuf;
-    int ksiz, vsiz;
-    
-    if (!PyArg_ParseTuple(args, "s#s#:putcat", &kbuf, &ksiz, &vbuf, &vsiz))
+    if (!PyDict_Check(dict))
     {
+        PyErr_SetString(PyExc_TypeError, "Argument is not a dict.");
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbputcat(self->db, kbuf, ksiz, vbuf, vsiz);
-    Py_END_ALLOW_THREADS
+    PyObject *key, *value, *str;
+    Py_ssize_t pos = 0;
+    TCMAP *map;
     
-    if (!success)
+    map = tcmapnew2((uint32_t) PyDict_Size(dict) + 1);
+    
+    if (map == NULL)
     {
-        raise_tyrant_error(self->db);
+        PyErr_SetString(PyExc_MemoryError, "Could not allocate map.");
         return NULL;
     }
-    Py_RETURN_NONE;
+    
+    while (PyDict_Next(dict, &pos, &key, &value))
+    {
+        str = pyscalar2pystring(value);
+        
+        if (!PyString_Check(key) || !str)
+        {
+            Py_XDECREF(str);
+            tcmapdel(map);
+            if (!PyErr_Occurred())
+            {
+                PyErr_SetString(PyExc_TypeError,
+                    "All keys must be strings and all values strings or numbers.");
+            }
+            return NULL;
+        }
+        
+        tcmapput(map, PyString_AS_STRING(key), (int) PyString_GET_SIZE(key),
+            PyString_AS_STRING(str), (int) PyString_GET_SIZE(str));
+        Py_DECREF(str);
+    }
+    
+    return map;
 }
 
 
-static PyObject *
-Tyrant_putnr(Tyrant *self, PyObject *args)
+/*
+ * Get a contiguous view of any object exposing a buffer. Python 2 objects
+ * such as mmap and array only implement the old buffer interface, so those
+ * are wrapped by hand. Release the view with PyBuffer_Release.
+ */
+static int
+pybuffer_get(PyObject *obj, Py_buffer *view, bool writable)
 {
-    bool success;
-    char *kbuf, *vbuf;
-    int ksiz, vsiz;
+    void *buf;
+    const void *rbuf;
+    Py_ssize_t len;
     
-    if (!PyArg_ParseTuple(args, "s#s#:putnr", &kbuf, &ksiz, &vbuf, &vsiz))
+    if (PyObject_CheckBuffer(obj))
     {
-        return NULL;
+        return PyObject_GetBuffer(obj, view,
+            writable ? PyBUF_WRITABLE : PyBUF_SIMPLE);
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbputnr(self->db, kbuf, ksiz, vbuf, vsiz);
-    Py_END_ALLOW_THREADS
-    
-    if (!success)
+    if (writable)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        if (PyObject_AsWriteBuffer(obj, &buf, &len) != 0)
+        {
+            return -1;
+        }
     }
-    Py_RETURN_NONE;
+    else
+    {
+        if (PyObject_AsReadBuffer(obj, &rbuf, &len) != 0)
+        {
+            return -1;
+        }
+        buf = (void *) rbuf;
+    }
+    
+    return PyBuffer_FillInfo(view, obj, buf, len, !writable,
+        writable ? PyBUF_WRITABLE : PyBUF_SIMPLE);
 }
 
 
-static PyObject *
-Tyrant_out(Tyrant *self, PyObject *args)
+static bool
+tclistpushpystring(TCLIST *list, PyObject *str)
 {
-    bool success;
-    char *kbuf;
-    int ksiz;
+    char *buf;
+    Py_ssize_t siz;
+    Py_buffer view;
     
-    if (!PyArg_ParseTuple(args, "s#:out", &kbuf, &ksiz))
+    if (PyString_Check(str))
     {
-        return NULL;
+        PyString_AsStringAndSize(str, &buf, &siz);
+        tclistpush(list, buf, (int) siz);
+        return true;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbout(self->db, kbuf, ksiz);
-    Py_END_ALLOW_THREADS
-    
-    if (!success)
+    if (pybuffer_get(str, &view, false) != 0)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        PyErr_Clear();
+        PyErr_SetString(PyExc_TypeError, "All keys and values must be strings or buffers.");
+        return false;
     }
-    Py_RETURN_NONE;
+    
+    tclistpush(list, view.buf, (int) view.len);
+    PyBuffer_Release(&view);
+    
+    return true;
 }
 
 
-static PyObject *
-Tyrant_get(Tyrant *self, PyObject *args, PyObject *kwargs)
+static TCLIST *
+pystrings2tclist(PyObject *strings)
 {
-    char *kbuf, *vbuf;
-    int ksiz, vsiz;
-    PyObject *default_value = NULL;
-    PyObject *value = NULL;
+    PyObject *iter, *str;
+    Py_ssize_t hint;
+    TCLIST *list;
     
-    static char *kwlist[] = {"key", "default", NULL};
+    iter = PyObject_GetIter(strings);
     
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|O:outdup", kwlist, &kbuf, &ksiz, &default_value))
+    if (!iter)
     {
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    vbuf = tcrdbget(self->db, kbuf, ksiz, &vsiz);
-    Py_END_ALLOW_THREADS
+    hint = _PyObject_LengthHint(strings, 0);
     
-    if (!vbuf)
+    if (hint < 0)
     {
-        if (default_value)
-        {
-            return default_value;
-        }
-        Py_RETURN_NONE;
+        PyErr_Clear();
+        hint = 0;
     }
     
-    value = PyString_FromStringAndSize(vbuf, vsiz);
-    free(vbuf);
+    list = tclistnew2((int) hint);
     
-    if (!value)
+    if (!list)
     {
+        Py_DECREF(iter);
+        PyErr_SetString(PyExc_MemoryError, "Could not allocate list.");
         return NULL;
     }
     
-    return value;
-}
-
-
-static PyObject *
-Tyrant_vsiz(Tyrant *self, PyObject *args)
-{
-    char *kbuf;
-    int ksiz, vsiz;
+    while ((str = PyIter_Next(iter)) != NULL)
+    {
+        if (!tclistpushpystring(list, str))
+        {
+            Py_DECREF(str);
+            break;
+        }
+        
+        Py_DECREF(str);
+    }
     
-    if (!PyArg_ParseTuple(args, "s#:vsiz", &kbuf, &ksiz))
+    Py_DECREF(iter);
+    
+    if (PyErr_Occurred())
     {
+        tclistdel(list);
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    vsiz = tcrdbvsiz(self->db, kbuf, ksiz);
-    Py_END_ALLOW_THREADS
-    
-    return Py_BuildValue("i", vsiz);
+    return list;
 }
 
 
-static PyObject *
-Tyrant_fwmkeys(Tyrant *self, PyObject *args, PyObject *kwargs)
+static TCLIST *
+pyitems2tclist(PyObject *items)
 {
-    char *pbuf;
-    int psiz, i, n;
-    int max = -1;
-    PyObject *pylist;
+    PyObject *iter, *item, *key, *value;
+    Py_ssize_t pos = 0, hint;
     TCLIST *list;
     
-    static char *kwlist[] = {"prefix", "max", NULL};
+    if (PyDict_Check(items))
+    {
+        list = tclistnew2((int) PyDict_Size(items) * 2);
+        
+        if (!list)
+        {
+            PyErr_SetString(PyExc_MemoryError, "Could not allocate list.");
+            return NULL;
+        }
+        
+        while (PyDict_Next(items, &pos, &key, &value))
+        {
+            if (!tclistpushpystring(list, key) || !tclistpushpystring(list, value))
+            {
+                tclistdel(list);
+                return NULL;
+            }
+        }
+        
+        return list;
+    }
     
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|i:fwmkeys", kwlist,
-        &pbuf, &psiz, &max))
+    if (PyObject_HasAttrString(items, "iteritems"))
+    {
+        iter = PyObject_CallMethod(items, "iteritems", NULL);
+    }
+    else
+    {
+        iter = PyObject_GetIter(items);
+    }
+    
+    if (!iter)
     {
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    list = tcrdbfwmkeys(self->db, pbuf, psiz, max);
-    Py_END_ALLOW_THREADS
+    hint = _PyObject_LengthHint(items, 0);
+    
+    if (hint < 0)
+    {
+        PyErr_Clear();
+        hint = 0;
+    }
+    
+    list = tclistnew2((int) hint * 2);
     
     if (!list)
     {
-        PyErr_SetString(PyExc_MemoryError, "Cannot allocate memort for TCLIST object");
+        Py_DECREF(iter);
+        PyErr_SetString(PyExc_MemoryError, "Could not allocate list.");
         return NULL;
     }
     
-    n = tclistnum(list);
-    pylist = PyList_New(n);
-    if (pylist)
+    while ((item = PyIter_Next(iter)) != NULL)
     {
-        for (i=0; i<n; i++)
+        if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2)
         {
-            int vsiz;
-            const char *vbuf;
-            PyObject *value;
-            
-            vbuf = tclistval(list, i, &vsiz);
-            value = PyString_FromStringAndSize(vbuf, vsiz);
-            PyList_SET_ITEM(pylist, i, value);
+            Py_DECREF(item);
+            PyErr_SetString(PyExc_TypeError, "Expected a mapping or (key, value) pairs.");
+            break;
+        }
+        
+        if (!tclistpushpystring(list, PyTuple_GET_ITEM(item, 0)) ||
+            !tclistpushpystring(list, PyTuple_GET_ITEM(item, 1)))
+        {
+            Py_DECREF(item);
+            break;
         }
+        
+        Py_DECREF(item);
     }
-    tclistdel(list);
     
-    return pylist;
-}
-
-
-static PyObject *
-Tyrant_addint(Tyrant *self, PyObject *args)
-{
-    char *kbuf;
-    int ksiz, num, result;
+    Py_DECREF(iter);
     
-    if (!PyArg_ParseTuple(args, "s#i:addint", &kbuf, &ksiz, &num))
+    if (PyErr_Occurred())
     {
+        tclistdel(list);
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    result = tcrdbaddint(self->db, kbuf, ksiz, num);
-    Py_END_ALLOW_THREADS
-    
-    return PyInt_FromLong((long) result);
+    return list;
 }
 
 
 static PyObject *
-Tyrant_adddouble(Tyrant *self, PyObject *args)
+tclist2pylist(const TCLIST *list)
 {
-    char *kbuf;
-    int ksiz;
-    double num, result;
+    int i, n, vsiz;
+    const char *vbuf;
+    PyObject *pylist, *value;
     
-    if (!PyArg_ParseTuple(args, "s#d:adddouble", &kbuf, &ksiz, &num))
+    n = tclistnum(list);
+    pylist = PyList_New(n);
+    
+    if (!pylist)
     {
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    result = tcrdbadddouble(self->db, kbuf, ksiz, num);
-    Py_END_ALLOW_THREADS
-    
-    return PyFloat_FromDouble(result);
-}
-
-
-static PyObject *
-Tyrant_sync(Tyrant *self)
-{
-    bool success;
-    
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbsync(self->db);
-    Py_END_ALLOW_THREADS
-    
-    if (!success)
+    for (i=0; i<n; i++)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        vbuf = tclistval(list, i, &vsiz);
+        value = PyString_FromStringAndSize(vbuf, vsiz);
+        
+        if (!value)
+        {
+            Py_DECREF(pylist);
+            return NULL;
+        }
+        
+        PyList_SET_ITEM(pylist, i, value);
     }
     
-    Py_RETURN_NONE;
+    return pylist;
 }
 
 
-static PyObject *
-Tyrant_optimize(Tyrant *self, PyObject *args, PyObject *kwargs)
+static PyObject *TyrantError;
+
+
+static void
+raise_tyrant_error(TCRDB *db)
 {
-    bool success = 0;
-    char *params = NULL;
-    
-    static char *kwlist[] = {"params", NULL };
+    int code = tcrdbecode(db);
+    const char *msg = tcrdberrmsg(code);
     
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s:optimize", kwlist, 
-        &params))
+    if (code == TCENOREC)
     {
-        return NULL;
+        PyErr_SetString(PyExc_KeyError, msg);
     }
-    
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdboptimize(self->db, params);
-    Py_END_ALLOW_THREADS
-    
-    if (!success)
+    else
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        PyErr_SetString(TyrantError, msg);
     }
-    Py_RETURN_NONE;
 }
 
 
-static PyObject *
-Tyrant_vanish(Tyrant *self)
+static void
+raise_tyrant_code(int code)
 {
-    bool success;
-    
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbvanish(self->db);
-    Py_END_ALLOW_THREADS
-    
-    if (!success)
+    if (code == TTENOREC)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        PyErr_SetString(PyExc_KeyError, tcrdberrmsg(code));
+    }
+    else
+    {
+        PyErr_SetString(TyrantError, tcrdberrmsg(code));
     }
-    
-    Py_RETURN_NONE;
 }
 
 
-static PyObject *
-Tyrant_copy(Tyrant *self, PyObject *args)
+/*
+ * Send `num` iternext commands in one write and read the replies back in
+ * order, pushing each key onto `keys`. The server processes them one after
+ * another, so this costs a single round trip. Returns TTENOREC once the
+ * iterator is exhausted. If the replies cannot all be read the connection
+ * is closed. Must be called without the GIL.
+ */
+static int
+rdbiternextbatch(TCRDB *rdb, int num, TCLIST *keys)
 {
-    bool success;
-    char *path;
+    int i, code, ksiz, ecode = TTESUCCESS;
+    bool broken = false;
+    char *buf, *kbuf;
     
-    if (!PyArg_ParseTuple(args, "s", &path))
+    pthread_mutex_lock(&rdb->mmtx);
+    
+    if (rdb->fd < 0 || !rdb->sock)
     {
-        return NULL;
+        pthread_mutex_unlock(&rdb->mmtx);
+        return TTEINVALID;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbcopy(self->db, path);
-    Py_END_ALLOW_THREADS
+    buf = malloc(num * 2);
     
-    if (!success)
+    if (!buf)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        pthread_mutex_unlock(&rdb->mmtx);
+        return TTEMISC;
     }
     
-    Py_RETURN_NONE;
-}
-
-
-static PyObject *
-Tyrant_restore(Tyrant *self, PyObject *args, PyObject *kwargs)
-{
-    bool success = 0;
-    char *path = NULL;
-    uint64_t ts = 0;
-    int opts = 0;
+    for (i=0; i<num; i++)
+    {
+        buf[i*2] = (char) TTMAGICNUM;
+        buf[i*2+1] = (char) TTCMDITERNEXT;
+    }
     
-    static char *kwlist[] = {"path", "ts", "opts", NULL };
+    if (!ttsocksend(rdb->sock, buf, num * 2))
+    {
+        ecode = TTESEND;
+        broken = true;
+        num = 0;
+    }
     
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sK|i:restore", kwlist, 
-        &path, &ts, &opts))
+    free(buf);
+    
+    for (i=0; i<num; i++)
     {
-        return NULL;
+        code = ttsockgetc(rdb->sock);
+        
+        if (code == -1)
+        {
+            ecode = TTERECV;
+            broken = true;
+            break;
+        }
+        
+        if (code != 0)
+        {
+            ecode = TTENOREC;
+            continue;
+        }
+        
+        ksiz = ttsockgetint32(rdb->sock);
+        
+        if (ttsockcheckend(rdb->sock) || ksiz < 0)
+        {
+            ecode = TTERECV;
+            broken = true;
+            break;
+        }
+        
+        kbuf = malloc(ksiz + 1);
+        
+        if (!kbuf)
+        {
+            ecode = TTEMISC;
+            broken = true;
+            break;
+        }
+        
+        if (!ttsockrecv(rdb->sock, kbuf, ksiz))
+        {
+            free(kbuf);
+            ecode = TTERECV;
+            broken = true;
+            break;
+        }
+        
+        kbuf[ksiz] = '\0';
+        tclistpushmalloc(keys, kbuf, ksiz);
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbrestore(self->db, path, ts, opts);
-    Py_END_ALLOW_THREADS
+    pthread_mutex_unlock(&rdb->mmtx);
     
-    if (!success)
+    /* Replies still owed would be read as the answers to later commands. */
+    if (broken)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        tcrdbclose(rdb);
     }
-    Py_RETURN_NONE;
+    
+    return ecode;
 }
 
 
-static PyObject *
-Tyrant_setmst(Tyrant *self, PyObject *args, PyObject *kwargs)
+/*
+ * Wait until the descriptor of a socket is readable. The wait is bounded by
+ * the timeout set on the socket, as ttsockrecv() would be; on timeout or
+ * error the socket is marked as ended. Must be called without the GIL.
+ */
+static bool
+ttsockwait(TTSOCK *sock)
 {
-    bool success = 0;
-    char *host = NULL;
-    int port = 0;
-    uint64_t ts = 0;
-    int opts = 0;
+    int rv, ms;
+    struct pollfd pfd;
     
-    static char *kwlist[] = {"host", "port", "ts", "opts", NULL };
+    pfd.fd = sock->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ms = sock->to > 0 ? (sock->to * 1000 < INT_MAX ? (int) (sock->to * 1000) : INT_MAX) : -1;
     
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "siK|i:restore", kwlist, 
-        &host, &port, &ts, &opts))
+    do
     {
-        return NULL;
-    }
-    
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbsetmst(self->db, host, port, ts, opts);
-    Py_END_ALLOW_THREADS
+        rv = poll(&pfd, 1, ms);
+    } while (rv < 0 && errno == EINTR);
     
-    if (!success)
+    if (rv <= 0)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        sock->end = true;
+        return false;
     }
-    Py_RETURN_NONE;
+    
+    return true;
 }
 
 
-static PyObject *
-Tyrant_rnum(Tyrant *self)
+/*
+ * Read `size` bytes from a socket into `buf`, taking whatever is already
+ * buffered first and then receiving the rest directly. Each receive waits
+ * no longer than the socket timeout. A NULL `buf` discards the bytes. Must
+ * be called without the GIL.
+ */
+static bool
+ttsockrecvdirect(TTSOCK *sock, char *buf, int64_t size)
 {
-    uint64_t rnum;
+    int64_t n;
+    ssize_t rsiz;
+    char chunk[0x1000];
     
-    Py_BEGIN_ALLOW_THREADS
-    rnum = tcrdbrnum(self->db);
-    Py_END_ALLOW_THREADS
+    n = sock->ep - sock->rp;
+    n = n < size ? n : size;
     
-    return PyLong_FromLongLong(rnum);
-}
-
-
-static PyObject *
-Tyrant_size(Tyrant *self)
-{
-    uint64_t fsiz;
+    if (n > 0)
+    {
+        if (buf)
+        {
+            memcpy(buf, sock->rp, n);
+            buf += n;
+        }
+        sock->rp += n;
+        size -= n;
+    }
     
-    Py_BEGIN_ALLOW_THREADS
-    fsiz = tcrdbsize(self->db);
-    Py_END_ALLOW_THREADS
+    while (size > 0)
+    {
+        if (!ttsockwait(sock))
+        {
+            return false;
+        }
+        
+        n = buf ? size : (size < (int64_t) sizeof(chunk) ? size : (int64_t) sizeof(chunk));
+        rsiz = recv(sock->fd, buf ? buf : chunk, n, 0);
+        
+        if (rsiz <= 0)
+        {
+            if (rsiz < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            sock->end = true;
+            return false;
+        }
+        
+        if (buf)
+        {
+            buf += rsiz;
+        }
+        size -= rsiz;
+    }
     
-    return PyLong_FromLongLong(fsiz);
+    return true;
 }
 
 
-static PyObject *
-Tyrant_stat(Tyrant *self)
+/*
+ * Fetch a value into a caller-owned buffer instead of a freshly allocated
+ * one. The value length is stored in `vsiz`; if it is larger than `bsiz` the
+ * value is drained from the socket and TTEKEEP is returned so the caller can
+ * retry with a bigger buffer. If the reply cannot be read in full the
+ * connection is closed. Must be called without the GIL.
+ */
+static int
+rdbgetinto(TCRDB *rdb, const char *kbuf, int ksiz, char *buf, int64_t bsiz, int *vsiz)
 {
-    char *stat;
+    int code, ecode = TTESUCCESS;
+    char *cmd;
     
-    Py_BEGIN_ALLOW_THREADS
-    stat = tcrdbstat(self->db);
-    Py_END_ALLOW_THREADS
+    pthread_mutex_lock(&rdb->mmtx);
     
-    return PyString_FromString(stat);
-}
-
-
-static PyObject *
-Tyrant_tblput(Tyrant *self, PyObject *args)
-{
-    bool success;
-    char *kbuf;
-    int ksiz;
-    TCMAP *cols;
-    PyObject *dict;
+    if (rdb->fd < 0 || !rdb->sock)
+    {
+        pthread_mutex_unlock(&rdb->mmtx);
+        return TTEINVALID;
+    }
     
-    if (!PyArg_ParseTuple(args, "s#O:put", &kbuf, &ksiz, &dict))
+    cmd = malloc(ksiz + 6);
+    
+    if (!cmd)
     {
-        return NULL;
+        pthread_mutex_unlock(&rdb->mmtx);
+        return TTEMISC;
     }
     
-    cols = pydict2tcmap(dict);
+    cmd[0] = (char) TTMAGICNUM;
+    cmd[1] = (char) TTCMDGET;
+    cmd[2] = (char) (ksiz >> 24);
+    cmd[3] = (char) (ksiz >> 16);
+    cmd[4] = (char) (ksiz >> 8);
+    cmd[5] = (char) ksiz;
+    memcpy(cmd + 6, kbuf, ksiz);
     
-    if (cols == NULL)
+    if (!ttsocksend(rdb->sock, cmd, ksiz + 6))
     {
-        return NULL;
+        free(cmd);
+        pthread_mutex_unlock(&rdb->mmtx);
+        tcrdbclose(rdb);
+        return TTESEND;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbtblput(self->db, kbuf, ksiz, cols);
-    Py_END_ALLOW_THREADS
+    free(cmd);
+    code = ttsockgetc(rdb->sock);
     
-    tcmapdel(cols);
+    if (code == -1)
+    {
+        ecode = TTERECV;
+    }
+    else if (code != 0)
+    {
+        ecode = TTENOREC;
+    }
+    else
+    {
+        *vsiz = ttsockgetint32(rdb->sock);
+        
+        if (ttsockcheckend(rdb->sock) || *vsiz < 0)
+        {
+            ecode = TTERECV;
+        }
+        else if (*vsiz > bsiz)
+        {
+            ecode = ttsockrecvdirect(rdb->sock, NULL, *vsiz) ? TTEKEEP : TTERECV;
+        }
+        else if (!ttsockrecvdirect(rdb->sock, buf, *vsiz))
+        {
+            ecode = TTERECV;
+        }
+    }
     
-    if (!success)
+    pthread_mutex_unlock(&rdb->mmtx);
+    
+    /* The rest of the reply would be read as the answer to a later command. */
+    if (ecode == TTERECV)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        tcrdbclose(rdb);
     }
     
-    Py_RETURN_NONE;
+    return ecode;
 }
 
 
-static PyObject *
-Tyrant_tblputkeep(Tyrant *self, PyObject *args)
+static PyTypeObject TyrantType;
+static PyTypeObject TyrantQueryType;
+static PyTypeObject TyrantIterType;
+static PyTypeObject TyrantSearchIterType;
+
+
+#define TYRANT_ITER_BATCH 1024
+
+
+/*
+ * Client-side read cache. Entries live in a TCMAP, which keeps insertion
+ * order, so moving a hit to the end and cutting from the front gives LRU
+ * eviction. Each value is prefixed with its expiry time. `epoch` counts
+ * invalidations, so a fetch made without the GIL can tell whether a write
+ * raced with it before filling the cache.
+ */
+typedef struct
 {
-    bool success;
-    char *kbuf;
-    int ksiz;
-    TCMAP *cols;
-    PyObject *dict;
+    TCMAP *map;
+    uint64_t epoch;
+    uint64_t max_bytes;
+    double ttl;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} TyrantCache;
+
+
+static TyrantCache *
+tyrant_cache_new(uint64_t max_bytes, double ttl)
+{
+    TyrantCache *cache;
     
-    if (!PyArg_ParseTuple(args, "s#O:put", &kbuf, &ksiz, &dict))
+    cache = calloc(1, sizeof(TyrantCache));
+    
+    if (!cache)
     {
         return NULL;
     }
     
-    cols = pydict2tcmap(dict);
+    cache->map = tcmapnew();
+    cache->max_bytes = max_bytes;
+    cache->ttl = ttl;
     
-    if (cols == NULL)
+    if (!cache->map)
     {
+        free(cache);
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbtblputkeep(self->db, kbuf, ksiz, cols);
-    Py_END_ALLOW_THREADS
-    
-    tcmapdel(cols);
-    
-    if (!success)
+    return cache;
+}
+
+
+static void
+tyrant_cache_del(TyrantCache *cache)
+{
+    if (cache)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        tcmapdel(cache->map);
+        free(cache);
     }
-    Py_RETURN_NONE;
 }
 
 
-static PyObject *
-Tyrant_tblputcat(Tyrant *self, PyObject *args)
+static const char *
+tyrant_cache_get(TyrantCache *cache, const char *kbuf, int ksiz, int *vsiz)
 {
-    bool success;
-    char *kbuf;
-    int ksiz;
-    TCMAP *cols;
-    PyObject *dict;
+    const char *vbuf;
+    double expires;
     
-    if (!PyArg_ParseTuple(args, "s#O:put", &kbuf, &ksiz, &dict))
+    vbuf = tcmapget(cache->map, kbuf, ksiz, vsiz);
+    
+    if (!vbuf)
     {
+        cache->misses++;
         return NULL;
     }
     
-    cols = pydict2tcmap(dict);
+    memcpy(&expires, vbuf, sizeof(expires));
     
-    if (cols == NULL)
+    if (expires > 0 && expires < tctime())
     {
+        tcmapout(cache->map, kbuf, ksiz);
+        cache->misses++;
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbtblputcat(self->db, kbuf, ksiz, cols);
-    Py_END_ALLOW_THREADS
-    
-    tcmapdel(cols);
+    tcmapmove(cache->map, kbuf, ksiz, false);
+    cache->hits++;
+    *vsiz -= sizeof(expires);
     
-    if (!success)
-    {
-        raise_tyrant_error(self->db);
-        return NULL;
-    }
-    Py_RETURN_NONE;
+    return vbuf + sizeof(expires);
 }
 
 
-static PyObject *
-Tyrant_tblout(Tyrant *self, PyObject *args)
+static void
+tyrant_cache_put(TyrantCache *cache, const char *kbuf, int ksiz,
+    const char *vbuf, int vsiz)
 {
-    bool success;
-    char *kbuf;
-    int ksiz;
+    char *rec;
+    double expires;
     
-    if (!PyArg_ParseTuple(args, "s#:out", &kbuf, &ksiz))
+    if ((uint64_t) ksiz + vsiz + sizeof(expires) > cache->max_bytes)
     {
-        return NULL;
+        return;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbtblout(self->db, kbuf, ksiz);
-    Py_END_ALLOW_THREADS
+    rec = malloc(sizeof(expires) + vsiz);
     
-    if (!success)
+    if (!rec)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        return;
+    }
+    
+    expires = cache->ttl > 0 ? tctime() + cache->ttl : 0;
+    memcpy(rec, &expires, sizeof(expires));
+    memcpy(rec + sizeof(expires), vbuf, vsiz);
+    tcmapput(cache->map, kbuf, ksiz, rec, sizeof(expires) + vsiz);
+    free(rec);
+    
+    while (tcmapmsiz(cache->map) > cache->max_bytes && tcmaprnum(cache->map) > 1)
+    {
+        tcmapcutfront(cache->map, 1);
+        cache->evictions++;
     }
-    Py_RETURN_NONE;
 }
 
 
-static PyObject *
-Tyrant_tblget(Tyrant *self, PyObject *args)
+/*
+ * Per-method call metrics, kept in a TCMAP from method name to stats.
+ * Instrumented methods run through a wrapper that sets a thread-local flag;
+ * the TYRANT_WIRE_BEGIN/END pair, used in place of Py_BEGIN/END_ALLOW_THREADS,
+ * only reads the clock while it is set. The time spent without the GIL
+ * counts as wire time, the wait to get the GIL back as GIL time, and the
+ * rest of the call as conversion time.
+ */
+#define METRICS_BUCKETS 24
+
+typedef struct
 {
-    char *kbuf;
-    int ksiz;
-    TCMAP *cols;
-    PyObject *value;
-    
-    if (!PyArg_ParseTuple(args, "s#:get", &kbuf, &ksiz))
-    {
-        return NULL;
-    }
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t sent;
+    uint64_t received;
+    double wire;
+    double gil;
+    double conversion;
+    uint64_t wire_hist[METRICS_BUCKETS];
+    uint64_t conversion_hist[METRICS_BUCKETS];
+} TyrantMethodStats;
+
+
+static __thread bool metrics_active = false;
+static __thread double metrics_wire = 0;
+static __thread double metrics_gil = 0;
+
+
+static double
+metrics_now(void)
+{
+    struct timespec ts;
     
-    Py_BEGIN_ALLOW_THREADS
-    cols = tcrdbtblget(self->db, kbuf, ksiz);
-    Py_END_ALLOW_THREADS
+    clock_gettime(CLOCK_MONOTONIC, &ts);
     
-    if (!cols)
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+#define TYRANT_WIRE_BEGIN \
+    { \
+        double _wire_t0 = metrics_active ? metrics_now() : 0, _wire_t1 = 0; \
+        Py_BEGIN_ALLOW_THREADS
+        
+#define TYRANT_WIRE_END \
+        if (_wire_t0 > 0) \
+        { \
+            _wire_t1 = metrics_now(); \
+        } \
+        Py_END_ALLOW_THREADS \
+        if (_wire_t0 > 0) \
+        { \
+            metrics_wire += _wire_t1 - _wire_t0; \
+            metrics_gil += metrics_now() - _wire_t1; \
+        } \
+    }
+
+
+/*
+ * The server keeps one key iterator per connection, so `iterating` is set
+ * while a TyrantIter or dump owns it and a second user is refused.
+ */
+typedef struct
+{
+    PyObject_HEAD
+    TCRDB *db;
+    TyrantCache *cache;
+    TCMAP *metrics;
+    bool iterating;
+} Tyrant;
+
+
+static bool
+tyrant_iter_claim(Tyrant *self)
+{
+    if (self->iterating)
     {
-        Py_RETURN_NONE;
+        PyErr_SetString(TyrantError,
+            "The key iterator of this connection is already in use.");
+        return false;
     }
     
-    value = tcmap2pydict(cols);
-    tcmapdel(cols);
-    
-    if (!value)
+    self->iterating = true;
+    return true;
+}
+
+
+static void
+tyrant_cache_out(Tyrant *self, const char *kbuf, int ksiz)
+{
+    if (self->cache)
     {
-        return NULL;
+        self->cache->epoch++;
+        tcmapout(self->cache->map, kbuf, ksiz);
     }
-    
-    return value;
 }
 
 
-static PyObject *
-Tyrant_tblsetindex(Tyrant *self, PyObject *args)
+static void
+tyrant_cache_outlist(Tyrant *self, const TCLIST *list, int stride)
 {
-    bool success = 0;
-    const char *name;
-    int opts;
+    int i, ksiz;
+    const char *kbuf;
     
-    if (!PyArg_ParseTuple(args, "si:setindex", &name, &opts))
+    if (self->cache)
     {
-        return NULL;
+        self->cache->epoch++;
+        for (i=0; i<tclistnum(list); i+=stride)
+        {
+            kbuf = tclistval(list, i, &ksiz);
+            tcmapout(self->cache->map, kbuf, ksiz);
+        }
     }
-    
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbtblsetindex(self->db, name, opts);
-    Py_END_ALLOW_THREADS
-    
-    if (!success)
+}
+
+
+static void
+tyrant_cache_clear(Tyrant *self)
+{
+    if (self->cache)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        self->cache->epoch++;
+        tcmapclear(self->cache->map);
     }
-    Py_RETURN_NONE;
 }
 
 
-static PyObject *
-Tyrant_tblgenuid(Tyrant *self)
+/*
+ * Note the cache and its epoch before a fetch, so that tyrant_cache_fill()
+ * can drop the result if the cache was replaced or invalidated meanwhile.
+ */
+static TyrantCache *
+tyrant_cache_watch(Tyrant *self, uint64_t *epoch)
 {
-    int64_t id = 0;
-    
-    Py_BEGIN_ALLOW_THREADS
-    id = tcrdbtblgenuid(self->db);
-    Py_END_ALLOW_THREADS
-    
-    if (id < 0)
+    *epoch = self->cache ? self->cache->epoch : 0;
+    return self->cache;
+}
+
+
+static void
+tyrant_cache_fill(Tyrant *self, TyrantCache *cache, uint64_t epoch,
+    const char *kbuf, int ksiz, const char *vbuf, int vsiz)
+{
+    if (cache && self->cache == cache && cache->epoch == epoch)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        tyrant_cache_put(cache, kbuf, ksiz, vbuf, vsiz);
     }
-    
-    return Py_BuildValue("L", id);
 }
 
 
-static PyObject *
-Tyrant_tblquery(Tyrant *self)
+static int
+metrics_bucket(double seconds)
 {
-    PyObject *query;
-    PyObject *args;
+    int bucket = 0;
+    double us = seconds * 1e6;
     
-    args = Py_BuildValue("(O)", self);
-    query = TyrantQuery_new(&TyrantQueryType, args, NULL);
-    Py_DECREF(args);
-    
-    if (!query)
+    while (us >= 2 && bucket < METRICS_BUCKETS - 1)
     {
-        raise_tyrant_error(self->db);
-        return NULL;
+        us /= 2;
+        bucket++;
     }
     
-    return query;
+    return bucket;
 }
 
 
-static PyObject *
-Tyrant_metasearch(Tyrant *self, PyObject *args)
+/*
+ * Count the payload bytes of a call argument or result: strings and buffers,
+ * and the strings inside lists, tuples and dicts one level down.
+ */
+static uint64_t
+metrics_payload(PyObject *obj, int depth)
 {
-    RDBQRY **queries;
-    TyrantQuery *query;
-    TCLIST *results;
-    int n = 0, i=0, vsiz = 0, type = 0;
-    const char *vbuf;
-    PyObject *pyresults, *val, *pyqueries, *item;
+    uint64_t size = 0;
+    Py_ssize_t i, pos = 0;
+    PyObject *key, *value;
     
-    if (!PyArg_ParseTuple(args, "Oi:metasearch", &pyqueries, &type))
+    if (!obj)
     {
-        return NULL;
+        return 0;
     }
     
-    if (!PyList_Check(pyqueries))
+    if (PyString_Check(obj))
     {
-        return NULL;
+        return PyString_GET_SIZE(obj);
     }
     
-    n = PyList_Size(pyqueries);
-    
-    if (n == 0)
+    if (depth > 1)
     {
-        pyresults = PyList_New(0);
-        return pyresults;
+        return 0;
     }
     
-    queries = (RDBQRY **) malloc(sizeof(RDBQRY *) * n);
-    
-    if (queries == NULL)
+    if (PyList_Check(obj) || PyTuple_Check(obj))
     {
-        PyErr_SetString(PyExc_MemoryError, "Could not allocate queries list.");
-        return NULL;
+        for (i=0; i<PySequence_Fast_GET_SIZE(obj); i++)
+        {
+            size += metrics_payload(PySequence_Fast_GET_ITEM(obj, i), depth + 1);
+        }
     }
-    
-    for (i=0; i<n; i++)
+    else if (PyDict_Check(obj))
     {
-        item = PyList_GetItem(pyqueries, i);
-        
-        if (!PyObject_TypeCheck(item, &TyrantQueryType))
+        while (PyDict_Next(obj, &pos, &key, &value))
         {
-            PyErr_SetString(PyExc_TypeError, "Expected a list of tyrant query objects.");
-            free(queries);
-            return NULL;
+            size += metrics_payload(key, depth + 1) + metrics_payload(value, depth + 1);
         }
-        
-        query = (TyrantQuery *) item;
-        queries[i] = query->q;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    results = tcrdbmetasearch(queries, n, type);
-    Py_END_ALLOW_THREADS
+    return size;
+}
+
+
+static void
+metrics_record(TCMAP *metrics, const char *name, bool failed, uint64_t sent,
+    uint64_t received, double wire, double gil, double conversion)
+{
+    int vsiz, nsiz = (int) strlen(name);
+    const void *vbuf;
+    TyrantMethodStats stats;
     
-    free(queries);
+    vbuf = tcmapget(metrics, name, nsiz, &vsiz);
     
-    if (!results)
+    if (vbuf && vsiz == sizeof(stats))
     {
-        PyErr_SetString(PyExc_MemoryError, "Cannot allocate memory for TCLIST object");
-        return NULL;
+        memcpy(&stats, vbuf, sizeof(stats));
+    }
+    else
+    {
+        memset(&stats, 0, sizeof(stats));
     }
     
-    n = tclistnum(results);
-    pyresults = PyList_New(n);
+    stats.calls++;
+    stats.errors += failed ? 1 : 0;
+    stats.sent += sent;
+    stats.received += received;
+    stats.wire += wire;
+    stats.gil += gil;
+    stats.conversion += conversion;
+    stats.wire_hist[metrics_bucket(wire)]++;
+    stats.conversion_hist[metrics_bucket(conversion)]++;
+    
+    tcmapput(metrics, name, nsiz, &stats, sizeof(stats));
+}
+
+
+typedef struct
+{
+    bool active;
+    double wire;
+    double gil;
+    double start;
+} MetricsFrame;
+
+
+static void
+metrics_enter(MetricsFrame *frame)
+{
+    frame->active = metrics_active;
+    frame->wire = metrics_wire;
+    frame->gil = metrics_gil;
     
-    if (pyresults)
+    metrics_active = true;
+    metrics_wire = metrics_gil = 0;
+    
+    frame->start = metrics_now();
+}
+
+
+/*
+ * Record the call timed since metrics_enter() under `name`, unless metrics
+ * were disabled meanwhile. Nested instrumented calls also count towards
+ * the enclosing one, so its counters are restored with ours added.
+ */
+static void
+metrics_leave(MetricsFrame *frame, TCMAP *metrics, const char *name,
+    bool failed, uint64_t sent, uint64_t received)
+{
+    double total = metrics_now() - frame->start;
+    
+    metrics_active = frame->active;
+    
+    if (metrics)
     {
-        for (i=0; i<n; i++)
-        {
-            vbuf = tclistval(results, i, &vsiz);
-            val = PyString_FromStringAndSize(vbuf, vsiz);
-            PyList_SET_ITEM(pyresults, i, val);
-            
-            vsiz = 0;
-        }
+        metrics_record(metrics, name, failed, sent, received,
+            metrics_wire, metrics_gil, total - metrics_wire - metrics_gil);
     }
-    tclistdel(results);
     
-    return pyresults;
+    metrics_wire += frame->wire;
+    metrics_gil += frame->gil;
+}
+
+
+/*
+ * A method of Tyrant or TyrantQuery bound to its instance, standing in for
+ * the builtin bound method while metrics are enabled. Entries of the
+ * per-type name caches are unbound ones, with `db` and `self` NULL.
+ */
+typedef struct
+{
+    PyObject_HEAD
+    Tyrant *db;
+    PyObject *self;
+    PyMethodDef *ml;
+    PyObject *name;
+} TyrantMetricsMethod;
+
+
+static PyTypeObject TyrantMetricsMethodType;
+
+static PyObject *tyrant_metrics_methods = NULL;
+static PyObject *query_metrics_methods = NULL;
+
+static const char *metrics_unwrapped[] =
+{
+    "enable_metrics", "disable_metrics", "reset_metrics", "metrics", NULL
+};
+
+
+static void
+TyrantMetricsMethod_dealloc(TyrantMetricsMethod *self)
+{
+    Py_XDECREF(self->db);
+    Py_XDECREF(self->self);
+    Py_XDECREF(self->name);
+    self->ob_type->tp_free(self);
+}
+
+
+/*
+ * Call a C method the way a builtin bound method would.
+ */
+static PyObject *
+metrics_call_method(PyMethodDef *ml, PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t n = PyTuple_GET_SIZE(args);
+    int flags = ml->ml_flags & ~(METH_CLASS | METH_STATIC | METH_COEXIST);
+    
+    if (flags & METH_KEYWORDS)
+    {
+        return ((PyCFunctionWithKeywords) ml->ml_meth)(self, args, kwargs);
+    }
+    
+    if (kwargs && PyDict_Size(kwargs) != 0)
+    {
+        PyErr_Format(PyExc_TypeError, "%.200s() takes no keyword arguments",
+            ml->ml_name);
+        return NULL;
+    }
+    
+    switch (flags)
+    {
+        case METH_VARARGS:
+            return ml->ml_meth(self, args);
+        case METH_NOARGS:
+            if (n == 0)
+            {
+                return ml->ml_meth(self, NULL);
+            }
+            PyErr_Format(PyExc_TypeError, "%.200s() takes no arguments (%zd given)",
+                ml->ml_name, n);
+            return NULL;
+        case METH_O:
+            if (n == 1)
+            {
+                return ml->ml_meth(self, PyTuple_GET_ITEM(args, 0));
+            }
+            PyErr_Format(PyExc_TypeError, "%.200s() takes exactly one argument (%zd given)",
+                ml->ml_name, n);
+            return NULL;
+    }
+    
+    PyErr_BadInternalCall();
+    return NULL;
+}
+
+
+static PyObject *
+TyrantMetricsMethod_call(TyrantMetricsMethod *self, PyObject *args, PyObject *kwargs)
+{
+    MetricsFrame frame;
+    PyObject *result;
+    
+    metrics_enter(&frame);
+    result = metrics_call_method(self->ml, self->self, args, kwargs);
+    metrics_leave(&frame, self->db->metrics, PyString_AS_STRING(self->name), !result,
+        metrics_payload(args, 0) + metrics_payload(kwargs, 0),
+        metrics_payload(result, 0));
+    
+    return result;
+}
+
+
+static PyTypeObject TyrantMetricsMethodType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantMetricsMethod",   /* tp_name */
+  sizeof(TyrantMetricsMethod),                 /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantMetricsMethod_dealloc,     /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  (ternaryfunc)TyrantMetricsMethod_call,       /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Tyrant method that records call metrics",   /* tp_doc */
+};
+
+
+/*
+ * Find the unbound metrics method for `name` in the method table of `base`,
+ * or None if the name is not an instrumented method.
+ */
+static PyObject *
+metrics_method_lookup(PyTypeObject *base, const char *prefix, PyObject *name)
+{
+    int i;
+    const char *cname = PyString_AS_STRING(name);
+    PyMethodDef *ml;
+    TyrantMetricsMethod *method;
+    
+    for (i=0; metrics_unwrapped[i]; i++)
+    {
+        if (!strcmp(cname, metrics_unwrapped[i]))
+        {
+            Py_RETURN_NONE;
+        }
+    }
+    
+    for (ml=base->tp_methods; ml && ml->ml_name; ml++)
+    {
+        if (!strcmp(cname, ml->ml_name))
+        {
+            break;
+        }
+    }
+    
+    if (!ml || !ml->ml_name)
+    {
+        Py_RETURN_NONE;
+    }
+    
+    method = PyObject_New(TyrantMetricsMethod, &TyrantMetricsMethodType);
+    
+    if (!method)
+    {
+        return NULL;
+    }
+    
+    method->db = NULL;
+    method->self = NULL;
+    method->ml = ml;
+    method->name = PyString_FromFormat("%s%s", prefix, cname);
+    
+    if (!method->name)
+    {
+        Py_DECREF(method);
+        return NULL;
+    }
+    
+    return (PyObject *) method;
+}
+
+
+/*
+ * Attribute lookup of Tyrant and TyrantQuery while metrics are enabled.
+ * Methods of `base` are returned bound in a TyrantMetricsMethod in place of
+ * the builtin bound method, so a lookup allocates no more than without
+ * metrics; their metric names are kept in `*cache` per attribute name.
+ * Anything else, including methods a subclass overrides, is looked up as
+ * usual.
+ */
+static PyObject *
+metrics_getattr(Tyrant *db, PyObject *self, PyTypeObject *base, PyObject **cache,
+    const char *prefix, PyObject *name)
+{
+    PyObject *unbound, *attr;
+    TyrantMetricsMethod *method;
+    
+    /* Only names defined on the base type are cached, so unknown attribute
+       lookups cannot grow the cache. */
+    if (!PyString_CheckExact(name) ||
+        !(attr = PyDict_GetItem(base->tp_dict, name)) ||
+        _PyType_Lookup(Py_TYPE(self), name) != attr)
+    {
+        return PyObject_GenericGetAttr(self, name);
+    }
+    
+    if (!*cache && !(*cache = PyDict_New()))
+    {
+        return NULL;
+    }
+    
+    unbound = PyDict_GetItem(*cache, name);
+    
+    if (!unbound)
+    {
+        unbound = metrics_method_lookup(base, prefix, name);
+        
+        if (!unbound || PyDict_SetItem(*cache, name, unbound) != 0)
+        {
+            Py_XDECREF(unbound);
+            return NULL;
+        }
+        
+        Py_DECREF(unbound);
+    }
+    
+    if (unbound == Py_None)
+    {
+        return PyObject_GenericGetAttr(self, name);
+    }
+    
+    method = PyObject_New(TyrantMetricsMethod, &TyrantMetricsMethodType);
+    
+    if (!method)
+    {
+        return NULL;
+    }
+    
+    Py_INCREF(db);
+    method->db = db;
+    Py_INCREF(self);
+    method->self = self;
+    method->ml = ((TyrantMetricsMethod *) unbound)->ml;
+    method->name = ((TyrantMetricsMethod *) unbound)->name;
+    Py_INCREF(method->name);
+    
+    return (PyObject *) method;
+}
+
+
+typedef struct
+{
+    PyObject_HEAD
+    Tyrant *db;
+    TCLIST *keys;
+    int index;
+    int batch;
+    bool done;
+    bool active;
+} TyrantIter;
+
+
+typedef struct
+{
+    PyObject_HEAD
+    RDBQRY *q;
+    Tyrant *db;
+    PyObject *schema;
+    TCLIST *columns;
+} TyrantQuery;
+
+
+typedef struct
+{
+    PyObject_HEAD
+    TCLIST *results;
+    PyObject *schema;
+} TyrantSearchIter;
+
+
+static long
+TyrantQuery_Hash(PyObject *self)
+{
+    PyErr_SetString(PyExc_TypeError, "Tyrant query objects are not hashable.");
+    return -1;
+}
+
+
+static PyObject *
+TyrantQuery_getattro(TyrantQuery *self, PyObject *name)
+{
+    if (!self->db || !self->db->metrics)
+    {
+        return PyObject_GenericGetAttr((PyObject *) self, name);
+    }
+    
+    return metrics_getattr(self->db, (PyObject *) self, &TyrantQueryType,
+        &query_metrics_methods, "query.", name);
+}
+
+
+static void
+TyrantQuery_dealloc(TyrantQuery *self)
+{
+    if (self->q)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        tcrdbqrydel(self->q);
+        Py_END_ALLOW_THREADS
+    }
+    if (self->columns)
+    {
+        tclistdel(self->columns);
+    }
+    Py_XDECREF(self->schema);
+    Py_XDECREF(self->db);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+TyrantQuery_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    TyrantQuery *self;
+    Tyrant *pydb;
+    
+    self = (TyrantQuery *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate TyrantQuery instance.");
+        return NULL;
+    }
+    
+    if (PyArg_ParseTuple(args, "O!", &TyrantType, &pydb))
+    {
+        self->q = tcrdbqrynew(pydb->db);
+        if (!self->q)
+        {
+            raise_tyrant_error(pydb->db);
+        }
+        else
+        {
+            Py_INCREF(pydb);
+            self->db = pydb;
+            return (PyObject *) self;
+        }
+    }
+    
+    TyrantQuery_dealloc(self);
+    return NULL;
+}
+
+
+static PyObject *
+TyrantQuery_addcond(TyrantQuery *self, PyObject *args, PyObject *kwargs)
+{
+    const char *name, *expr;
+    name = expr = NULL;
+    int op = 0;
+    
+    static char *kwlist[] = {"name", "op", "expr", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|s:addcond", kwlist, 
+        &name, &op, &expr))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    tcrdbqryaddcond(self->q, name, op, expr);
+    Py_END_ALLOW_THREADS
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+TyrantQuery_setorder(TyrantQuery *self, PyObject *args)
+{
+    const char *name;
+    int type;
+    
+    if (!PyArg_ParseTuple(args, "si:setorder", &name, &type))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    tcrdbqrysetorder(self->q, name, type);
+    Py_END_ALLOW_THREADS
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+TyrantQuery_setlimit(TyrantQuery *self, PyObject *args)
+{
+    int max, skip;
+    max = skip = -1;
+    
+    if (!PyArg_ParseTuple(args, "ii:setlimit", &max, &skip))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    tcrdbqrysetlimit(self->q, max, skip);
+    Py_END_ALLOW_THREADS
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+TyrantQuery_search(TyrantQuery *self)
+{
+    TCLIST *results;
+    int n = 0, i=0, vsiz = 0;
+    const char *vbuf;
+    PyObject *pylist, *val;
+    
+    TYRANT_WIRE_BEGIN
+    results = tcrdbqrysearch(self->q);
+    TYRANT_WIRE_END
+    
+    if (!results)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate memory for TCLIST object");
+        return NULL;
+    }
+    
+    n = tclistnum(results);
+    pylist = PyList_New(n);
+    
+    if (pylist)
+    {
+        for (i=0; i<n; i++)
+        {
+            vbuf = tclistval(results, i, &vsiz);
+            val = PyString_FromStringAndSize(vbuf, vsiz);
+            PyList_SET_ITEM(pylist, i, val);
+            
+            vsiz = 0;
+        }
+    }
+    tclistdel(results);
+    
+    return pylist;
+}
+
+
+static PyObject *
+TyrantQuery_searchout(TyrantQuery *self)
+{
+    bool success;
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbqrysearchout(self->q);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_clear(self->db);
+    
+    return Py_BuildValue("i", success);
+}
+
+
+/*
+ * Fetch the matching records. With a projection the search misc function is
+ * called directly with a "get" clause naming the columns, so the server only
+ * sends those.
+ */
+static TCLIST *
+TyrantQuery_fetch(TyrantQuery *self, const TCLIST *columns)
+{
+    int i, csiz;
+    const char *cbuf;
+    TCLIST *args, *results;
+    TCXSTR *get;
+    
+    if (!columns)
+    {
+        TYRANT_WIRE_BEGIN
+        results = tcrdbqrysearchget(self->q);
+        TYRANT_WIRE_END
+        
+        if (!results)
+        {
+            PyErr_SetString(PyExc_MemoryError, "Cannot allocate memory for TCLIST object");
+        }
+        return results;
+    }
+    
+    args = tclistdup(self->q->args);
+    get = tcxstrnew();
+    tcxstrcat2(get, "get");
+    
+    for (i=0; i<tclistnum(columns); i++)
+    {
+        cbuf = tclistval(columns, i, &csiz);
+        tcxstrcat(get, "\0", 1);
+        tcxstrcat(get, cbuf, csiz);
+    }
+    
+    tclistpush(args, tcxstrptr(get), tcxstrsize(get));
+    tcxstrdel(get);
+    
+    TYRANT_WIRE_BEGIN
+    results = tcrdbmisc(self->db->db, "search", RDBMONOULOG, args);
+    TYRANT_WIRE_END
+    
+    tclistdel(args);
+    
+    if (!results)
+    {
+        raise_tyrant_error(self->db->db);
+    }
+    
+    return results;
+}
+
+
+static PyObject *
+TyrantQuery_searchget(TyrantQuery *self, PyObject *args, PyObject *kwargs)
+{
+    TCLIST *results, *columns = NULL;
+    int n=0, i=0, csiz;
+    const char *cbuf;
+    PyObject *pylist, *dict, *columnar = NULL, *pycolumns = Py_None;
+    
+    static char *kwlist[] = {"columnar", "columns", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO:searchget", kwlist,
+        &columnar, &pycolumns))
+    {
+        return NULL;
+    }
+    
+    if (pycolumns != Py_None)
+    {
+        columns = pystrings2tclist(pycolumns);
+        if (!columns)
+        {
+            return NULL;
+        }
+    }
+    
+    results = TyrantQuery_fetch(self, columns ? columns : self->columns);
+    
+    if (columns)
+    {
+        tclistdel(columns);
+    }
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    if (columnar && PyObject_IsTrue(columnar))
+    {
+        pylist = tclist2pycolumns(results, self->schema);
+        tclistdel(results);
+        return pylist;
+    }
+    
+    n = tclistnum(results);
+    pylist = PyList_New(n);
+    
+    if (pylist)
+    {
+        for (i=0; i<n; i++)
+        {
+            cbuf = tclistval(results, i, &csiz);
+            dict = pycols2pydict(cbuf, csiz, self->schema);
+            
+            if (!dict)
+            {
+                Py_DECREF(pylist);
+                tclistdel(results);
+                return NULL;
+            }
+            
+            PyList_SET_ITEM(pylist, i, dict);
+        }
+    }
+    tclistdel(results);
+    
+    return pylist;
+}
+
+
+static void
+TyrantSearchIter_dealloc(TyrantSearchIter *self)
+{
+    if (self->results)
+    {
+        tclistdel(self->results);
+    }
+    Py_XDECREF(self->schema);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+TyrantSearchIter_iternext(TyrantSearchIter *self)
+{
+    char *rbuf;
+    int rsiz;
+    PyObject *dict;
+    
+    /* Rows are shifted off the front of the list so each one is released as
+       soon as it has been converted. */
+    rbuf = tclistshift(self->results, &rsiz);
+    
+    if (!rbuf)
+    {
+        return NULL;
+    }
+    
+    dict = pycols2pydict(rbuf, rsiz, self->schema);
+    free(rbuf);
+    
+    return dict;
+}
+
+
+static PyTypeObject TyrantSearchIterType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantSearchIter",      /* tp_name */
+  sizeof(TyrantSearchIter),                    /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantSearchIter_dealloc,        /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Tyrant query result iterator",              /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  PyObject_SelfIter,                           /* tp_iter */
+  (iternextfunc)TyrantSearchIter_iternext,     /* tp_iternext */
+  0,                                           /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  0,                                           /* tp_new */
+};
+
+
+static PyObject *
+TyrantQuery_itersearchget(TyrantQuery *self)
+{
+    TCLIST *results;
+    TyrantSearchIter *iter;
+    
+    results = TyrantQuery_fetch(self, self->columns);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    iter = PyObject_New(TyrantSearchIter, &TyrantSearchIterType);
+    
+    if (!iter)
+    {
+        tclistdel(results);
+        return NULL;
+    }
+    
+    iter->results = results;
+    iter->schema = self->schema;
+    Py_XINCREF(iter->schema);
+    
+    return (PyObject *) iter;
+}
+
+
+static PyObject *
+TyrantQuery_setschema(TyrantQuery *self, PyObject *args)
+{
+    PyObject *schema;
+    
+    if (!PyArg_ParseTuple(args, "O:setschema", &schema))
+    {
+        return NULL;
+    }
+    
+    if (pyschema_check(schema) != 0)
+    {
+        return NULL;
+    }
+    
+    Py_CLEAR(self->schema);
+    
+    if (schema != Py_None)
+    {
+        Py_INCREF(schema);
+        self->schema = schema;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+TyrantQuery_setprojection(TyrantQuery *self, PyObject *args)
+{
+    PyObject *pycolumns;
+    TCLIST *columns = NULL;
+    
+    if (!PyArg_ParseTuple(args, "O:setprojection", &pycolumns))
+    {
+        return NULL;
+    }
+    
+    if (pycolumns != Py_None)
+    {
+        columns = pystrings2tclist(pycolumns);
+        if (!columns)
+        {
+            return NULL;
+        }
+    }
+    
+    if (self->columns)
+    {
+        tclistdel(self->columns);
+    }
+    self->columns = columns;
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+TyrantQuery_searchcount(TyrantQuery *self)
+{
+    int n = 0;
+    
+    TYRANT_WIRE_BEGIN
+    n = tcrdbqrysearchcount(self->q);
+    TYRANT_WIRE_END
+    
+    return Py_BuildValue("i", n);
+}
+
+
+static PyObject *
+TyrantQuery_hint(TyrantQuery *self)
+{
+    const char *hint;
+    
+    TYRANT_WIRE_BEGIN
+    hint = tcrdbqryhint(self->q);
+    TYRANT_WIRE_END
+    
+    return PyString_FromString(hint);
+}
+
+
+static PyMethodDef TyrantQuery_methods[] = 
+{
+    {
+        "addcond", (PyCFunction) TyrantQuery_addcond,
+        METH_VARARGS | METH_KEYWORDS,
+        "Add a condition."
+    },
+    
+    {
+        "setorder", (PyCFunction) TyrantQuery_setorder,
+        METH_VARARGS,
+        "Set the column and direction to order by."
+    },
+    
+    {
+        "setlimit", (PyCFunction) TyrantQuery_setlimit,
+        METH_VARARGS,
+        "Set the offset and limit of the results."
+    },
+    
+    {
+        "search", (PyCFunction) TyrantQuery_search,
+        METH_NOARGS,
+        "Run the query. Returns the keys of matching records"
+    },
+    
+    {
+        "searchout", (PyCFunction) TyrantQuery_searchout,
+        METH_NOARGS,
+        "Remove all matching records."
+    },
+    
+    {
+        "searchget", (PyCFunction) TyrantQuery_searchget,
+        METH_VARARGS | METH_KEYWORDS,
+        "Run the query. Returns the matching records, or a dict of columns if columnar is true. Only the named columns are fetched if columns is given."
+    },
+    
+    {
+        "itersearchget", (PyCFunction) TyrantQuery_itersearchget,
+        METH_NOARGS,
+        "Run the query. Returns an iterator that converts the matching records one at a time."
+    },
+    
+    {
+        "setschema", (PyCFunction) TyrantQuery_setschema,
+        METH_VARARGS,
+        "Set a dict of column names to int or float. Matching columns of fetched records are converted."
+    },
+    
+    {
+        "setprojection", (PyCFunction) TyrantQuery_setprojection,
+        METH_VARARGS,
+        "Set the columns fetched by searchget and itersearchget. None fetches every column."
+    },
+    
+    {
+        "searchcount", (PyCFunction) TyrantQuery_searchcount,
+        METH_NOARGS,
+        "Get a count of matching records."
+    },
+    
+    {
+        "hint", (PyCFunction) TyrantQuery_hint,
+        METH_NOARGS,
+        "Get the hint for a query."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject TyrantQueryType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantQuery",           /* tp_name */
+  sizeof(TyrantQuery),                         /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantQuery_dealloc,             /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  TyrantQuery_Hash,                            /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  (getattrofunc)TyrantQuery_getattro,         /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
+  "Tyrant database query",                     /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  0,                                           /* tp_iter */
+  0,                                           /* tp_iternext */
+  TyrantQuery_methods,                         /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  TyrantQuery_new,                             /* tp_new */
+};
+
+
+static void
+TyrantIter_finish(TyrantIter *self)
+{
+    self->done = true;
+    
+    if (self->active)
+    {
+        self->active = false;
+        self->db->iterating = false;
+    }
+}
+
+
+static void
+TyrantIter_dealloc(TyrantIter *self)
+{
+    if (self->db)
+    {
+        TyrantIter_finish(self);
+    }
+    if (self->keys)
+    {
+        tclistdel(self->keys);
+    }
+    Py_XDECREF(self->db);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+TyrantIter_iternext(TyrantIter *self)
+{
+    int ecode, ksiz;
+    const char *kbuf;
+    
+    if (self->index >= tclistnum(self->keys))
+    {
+        if (self->done)
+        {
+            return NULL;
+        }
+        
+        tclistclear(self->keys);
+        self->index = 0;
+        
+        Py_BEGIN_ALLOW_THREADS
+        ecode = rdbiternextbatch(self->db->db, self->batch, self->keys);
+        Py_END_ALLOW_THREADS
+        
+        if (ecode == TTENOREC)
+        {
+            TyrantIter_finish(self);
+        }
+        else if (ecode != TTESUCCESS)
+        {
+            TyrantIter_finish(self);
+            raise_tyrant_code(ecode);
+            return NULL;
+        }
+        
+        if (tclistnum(self->keys) == 0)
+        {
+            return NULL;
+        }
+    }
+    
+    kbuf = tclistval(self->keys, self->index++, &ksiz);
+    
+    return PyString_FromStringAndSize(kbuf, ksiz);
+}
+
+
+static PyTypeObject TyrantIterType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantIter",            /* tp_name */
+  sizeof(TyrantIter),                          /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantIter_dealloc,              /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Tyrant database key iterator",              /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  PyObject_SelfIter,                           /* tp_iter */
+  (iternextfunc)TyrantIter_iternext,           /* tp_iternext */
+  0,                                           /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  0,                                           /* tp_new */
+};
+
+
+static PyObject *Tyrant_pipeline(Tyrant *self);
+static PyObject *Tyrant_load(Tyrant *self, PyObject *args, PyObject *kwargs);
+static PyObject *Tyrant_dump(Tyrant *self, PyObject *args, PyObject *kwargs);
+
+
+static long
+Tyrant_Hash(PyObject *self)
+{
+    PyErr_SetString(PyExc_TypeError, "Tyrant objects are not hashable.");
+    return -1;
+}
+
+
+static void
+Tyrant_dealloc(Tyrant *self)
+{
+    if (self->db)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        tcrdbdel(self->db);
+        Py_END_ALLOW_THREADS
+    }
+    tyrant_cache_del(self->cache);
+    if (self->metrics)
+    {
+        tcmapdel(self->metrics);
+    }
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+Tyrant_getattro(Tyrant *self, PyObject *name)
+{
+    if (!self->metrics)
+    {
+        return PyObject_GenericGetAttr((PyObject *) self, name);
+    }
+    
+    return metrics_getattr(self, (PyObject *) self, &TyrantType,
+        &tyrant_metrics_methods, "", name);
+}
+
+
+static PyObject *
+Tyrant_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    Tyrant *self;
+    
+    self = (Tyrant *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate Tyrant instance.");
+        return NULL;
+    }
+    
+    self->db = tcrdbnew();
+    if (!self->db)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate TCRDB instance.");
+        return NULL;
+    }
+    
+    return (PyObject *) self;
+}
+
+
+static PyObject *
+Tyrant_tune(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    bool success = 0;
+    double timeout;
+    int opts = 0;
+    
+    static char *kwlist[] = {"timeout", "opts", NULL };
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "di:tune", kwlist, 
+        &timeout, &opts))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbtune(self->db, timeout, opts);
+    TYRANT_WIRE_END
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_open(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    char *host = NULL;
+    int port = 0;
+    static char *kwlist[] = { "host", "port", NULL };
+    
+    if (PyArg_ParseTupleAndKeywords(args, kwargs, "si:open", kwlist, &host, &port))
+    {
+        bool success = 0;
+        TYRANT_WIRE_BEGIN
+        success = tcrdbopen(self->db, host, port);
+        TYRANT_WIRE_END
+        if (success)
+        {
+            Py_RETURN_NONE;
+        }
+        raise_tyrant_error(self->db);
+    }
+    return NULL;
+}
+
+
+static PyObject *
+Tyrant_close(Tyrant *self)
+{
+    bool success = 0;
+    TYRANT_WIRE_BEGIN
+    success = tcrdbclose(self->db);
+    TYRANT_WIRE_END
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_put(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    Py_buffer value;
+    
+    if (!PyArg_ParseTuple(args, "s#s*:put", &kbuf, &ksiz, &value))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbput(self->db, kbuf, ksiz, value.buf, (int) value.len);
+    TYRANT_WIRE_END
+    
+    PyBuffer_Release(&value);
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_putkeep(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    Py_buffer value;
+    
+    if (!PyArg_ParseTuple(args, "s#s*:putkeep", &kbuf, &ksiz, &value))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbputkeep(self->db, kbuf, ksiz, value.buf, (int) value.len);
+    TYRANT_WIRE_END
+    
+    PyBuffer_Release(&value);
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_putcat(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    Py_buffer value;
+    
+    if (!PyArg_ParseTuple(args, "s#s*:putcat", &kbuf, &ksiz, &value))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbputcat(self->db, kbuf, ksiz, value.buf, (int) value.len);
+    TYRANT_WIRE_END
+    
+    PyBuffer_Release(&value);
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_putnr(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    Py_buffer value;
+    
+    if (!PyArg_ParseTuple(args, "s#s*:putnr", &kbuf, &ksiz, &value))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbputnr(self->db, kbuf, ksiz, value.buf, (int) value.len);
+    TYRANT_WIRE_END
+    
+    PyBuffer_Release(&value);
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_out(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    
+    if (!PyArg_ParseTuple(args, "s#:out", &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbout(self->db, kbuf, ksiz);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_putlist(Tyrant *self, PyObject *args)
+{
+    TCLIST *list, *results;
+    PyObject *items;
+    
+    if (!PyArg_ParseTuple(args, "O:putlist", &items))
+    {
+        return NULL;
+    }
+    
+    list = pyitems2tclist(items);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    results = tcrdbmisc(self->db, "putlist", 0, list);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_outlist(self, list, 2);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    tclistdel(results);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_outlist(Tyrant *self, PyObject *args)
+{
+    TCLIST *list, *results;
+    PyObject *keys;
+    
+    if (!PyArg_ParseTuple(args, "O:outlist", &keys))
+    {
+        return NULL;
+    }
+    
+    list = pystrings2tclist(keys);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    results = tcrdbmisc(self->db, "outlist", 0, list);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_outlist(self, list, 1);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    tclistdel(results);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_get(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    char *kbuf, *vbuf;
+    const char *cbuf;
+    int ksiz, vsiz;
+    uint64_t epoch;
+    TyrantCache *cache;
+    PyObject *default_value = NULL;
+    PyObject *value = NULL;
+    
+    static char *kwlist[] = {"key", "default", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|O:get", kwlist, &kbuf, &ksiz, &default_value))
+    {
+        return NULL;
+    }
+    
+    if (self->cache)
+    {
+        cbuf = tyrant_cache_get(self->cache, kbuf, ksiz, &vsiz);
+        if (cbuf)
+        {
+            return PyString_FromStringAndSize(cbuf, vsiz);
+        }
+    }
+    
+    cache = tyrant_cache_watch(self, &epoch);
+    
+    TYRANT_WIRE_BEGIN
+    vbuf = tcrdbget(self->db, kbuf, ksiz, &vsiz);
+    TYRANT_WIRE_END
+    
+    if (!vbuf)
+    {
+        if (default_value)
+        {
+            Py_INCREF(default_value);
+            return default_value;
+        }
+        Py_RETURN_NONE;
+    }
+    
+    tyrant_cache_fill(self, cache, epoch, kbuf, ksiz, vbuf, vsiz);
+    
+    value = PyString_FromStringAndSize(vbuf, vsiz);
+    free(vbuf);
+    
+    if (!value)
+    {
+        return NULL;
+    }
+    
+    return value;
+}
+
+
+static PyObject *
+Tyrant_get_into(Tyrant *self, PyObject *args)
+{
+    char *kbuf;
+    const char *cbuf;
+    int ksiz, vsiz = 0, ecode;
+    PyObject *target;
+    Py_buffer view;
+    
+    if (!PyArg_ParseTuple(args, "s#O:get_into", &kbuf, &ksiz, &target))
+    {
+        return NULL;
+    }
+    
+    if (pybuffer_get(target, &view, true) != 0)
+    {
+        return NULL;
+    }
+    
+    cbuf = self->cache ? tyrant_cache_get(self->cache, kbuf, ksiz, &vsiz) : NULL;
+    
+    if (cbuf)
+    {
+        ecode = vsiz > view.len ? TTEKEEP : TTESUCCESS;
+        if (ecode == TTESUCCESS)
+        {
+            memcpy(view.buf, cbuf, vsiz);
+        }
+    }
+    else
+    {
+        TYRANT_WIRE_BEGIN
+        ecode = rdbgetinto(self->db, kbuf, ksiz, view.buf, view.len, &vsiz);
+        TYRANT_WIRE_END
+    }
+    
+    PyBuffer_Release(&view);
+    
+    if (ecode == TTENOREC)
+    {
+        Py_RETURN_NONE;
+    }
+    
+    if (ecode == TTEKEEP)
+    {
+        PyErr_Format(PyExc_ValueError, "Buffer too small, value is %d bytes.", vsiz);
+        return NULL;
+    }
+    
+    if (ecode != TTESUCCESS)
+    {
+        raise_tyrant_code(ecode);
+        return NULL;
+    }
+    
+    return PyInt_FromLong(vsiz);
+}
+
+
+static PyObject *
+Tyrant_mget(Tyrant *self, PyObject *args)
+{
+    bool success = true;
+    char *kbuf;
+    const char *rkbuf, *rvbuf, *cbuf;
+    Py_ssize_t ksiz, hint;
+    int rksiz, rvsiz, csiz;
+    uint64_t epoch;
+    TCMAP *recs;
+    TyrantCache *cache;
+    PyObject *keys, *iter, *key, *dict, *rkey, *rvalue;
+    
+    if (!PyArg_ParseTuple(args, "O:mget", &keys))
+    {
+        return NULL;
+    }
+    
+    iter = PyObject_GetIter(keys);
+    
+    if (!iter)
+    {
+        return NULL;
+    }
+    
+    hint = _PyObject_LengthHint(keys, 0);
+    
+    if (hint < 0)
+    {
+        PyErr_Clear();
+        hint = 0;
+    }
+    
+    recs = hint > 0 ? tcmapnew2((uint32_t) hint) : tcmapnew();
+    dict = PyDict_New();
+    
+    if (!recs || !dict)
+    {
+        Py_DECREF(iter);
+        Py_XDECREF(dict);
+        if (recs)
+        {
+            tcmapdel(recs);
+        }
+        PyErr_SetString(PyExc_MemoryError, "Could not allocate map.");
+        return NULL;
+    }
+    
+    while ((key = PyIter_Next(iter)) != NULL)
+    {
+        if (!PyString_Check(key))
+        {
+            Py_DECREF(key);
+            PyErr_SetString(PyExc_TypeError, "Expected keys to be strings.");
+            break;
+        }
+        
+        PyString_AsStringAndSize(key, &kbuf, &ksiz);
+        
+        /* Keys found in the cache are answered here and left out of the request. */
+        cbuf = self->cache ? tyrant_cache_get(self->cache, kbuf, (int) ksiz, &csiz) : NULL;
+        
+        if (cbuf)
+        {
+            rvalue = PyString_FromStringAndSize(cbuf, csiz);
+            if (!rvalue || PyDict_SetItem(dict, key, rvalue) != 0)
+            {
+                Py_XDECREF(rvalue);
+                Py_DECREF(key);
+                break;
+            }
+            Py_DECREF(rvalue);
+        }
+        else
+        {
+            tcmapput(recs, kbuf, (int) ksiz, "", 0);
+        }
+        
+        Py_DECREF(key);
+    }
+    
+    Py_DECREF(iter);
+    
+    if (PyErr_Occurred())
+    {
+        Py_DECREF(dict);
+        tcmapdel(recs);
+        return NULL;
+    }
+    
+    cache = tyrant_cache_watch(self, &epoch);
+    
+    if (tcmaprnum(recs) > 0)
+    {
+        TYRANT_WIRE_BEGIN
+        success = tcrdbget3(self->db, recs);
+        TYRANT_WIRE_END
+    }
+    
+    if (!success)
+    {
+        Py_DECREF(dict);
+        tcmapdel(recs);
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    tcmapiterinit(recs);
+    
+    while ((rkbuf = tcmapiternext(recs, &rksiz)) != NULL)
+    {
+        rvbuf = tcmapiterval(rkbuf, &rvsiz);
+        
+        tyrant_cache_fill(self, cache, epoch, rkbuf, rksiz, rvbuf, rvsiz);
+        
+        rkey = PyString_FromStringAndSize(rkbuf, rksiz);
+        rvalue = PyString_FromStringAndSize(rvbuf, rvsiz);
+        
+        if (!rkey || !rvalue || PyDict_SetItem(dict, rkey, rvalue) != 0)
+        {
+            Py_XDECREF(rkey);
+            Py_XDECREF(rvalue);
+            Py_DECREF(dict);
+            tcmapdel(recs);
+            return NULL;
+        }
+        
+        Py_DECREF(rkey);
+        Py_DECREF(rvalue);
+    }
+    
+    tcmapdel(recs);
+    
+    return dict;
+}
+
+
+static PyObject *
+Tyrant_vsiz(Tyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz, vsiz;
+    
+    if (!PyArg_ParseTuple(args, "s#:vsiz", &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    vsiz = tcrdbvsiz(self->db, kbuf, ksiz);
+    TYRANT_WIRE_END
+    
+    return Py_BuildValue("i", vsiz);
+}
+
+
+static PyObject *
+Tyrant_fwmkeys(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    char *pbuf;
+    int psiz, i, n;
+    int max = -1;
+    PyObject *pylist;
+    TCLIST *list;
+    
+    static char *kwlist[] = {"prefix", "max", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|i:fwmkeys", kwlist,
+        &pbuf, &psiz, &max))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    list = tcrdbfwmkeys(self->db, pbuf, psiz, max);
+    TYRANT_WIRE_END
+    
+    if (!list)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate memort for TCLIST object");
+        return NULL;
+    }
+    
+    n = tclistnum(list);
+    pylist = PyList_New(n);
+    if (pylist)
+    {
+        for (i=0; i<n; i++)
+        {
+            int vsiz;
+            const char *vbuf;
+            PyObject *value;
+            
+            vbuf = tclistval(list, i, &vsiz);
+            value = PyString_FromStringAndSize(vbuf, vsiz);
+            PyList_SET_ITEM(pylist, i, value);
+        }
+    }
+    tclistdel(list);
+    
+    return pylist;
+}
+
+
+static PyObject *
+Tyrant_iterkeys(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    bool success;
+    int batch = TYRANT_ITER_BATCH;
+    TyrantIter *iter;
+    
+    static char *kwlist[] = {"batch", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i:iterkeys", kwlist, &batch))
+    {
+        return NULL;
+    }
+    
+    if (batch < 1)
+    {
+        PyErr_SetString(PyExc_ValueError, "Batch size must be positive.");
+        return NULL;
+    }
+    
+    iter = PyObject_New(TyrantIter, &TyrantIterType);
+    
+    if (!iter)
+    {
+        return NULL;
+    }
+    
+    Py_INCREF(self);
+    iter->db = self;
+    iter->index = 0;
+    iter->batch = batch;
+    iter->done = false;
+    iter->active = false;
+    iter->keys = tclistnew2(batch);
+    
+    if (!iter->keys)
+    {
+        Py_DECREF(iter);
+        PyErr_SetString(PyExc_MemoryError, "Could not allocate list.");
+        return NULL;
+    }
+    
+    if (!tyrant_iter_claim(self))
+    {
+        Py_DECREF(iter);
+        return NULL;
+    }
+    
+    iter->active = true;
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbiterinit(self->db);
+    TYRANT_WIRE_END
+    
+    if (!success)
+    {
+        Py_DECREF(iter);
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    return (PyObject *) iter;
+}
+
+
+static PyObject *
+Tyrant_iter(Tyrant *self)
+{
+    PyObject *args, *iter;
+    
+    args = PyTuple_New(0);
+    
+    if (!args)
+    {
+        return NULL;
+    }
+    
+    iter = Tyrant_iterkeys(self, args, NULL);
+    Py_DECREF(args);
+    
+    return iter;
+}
+
+
+static PyObject *
+Tyrant_addint(Tyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz, num, result;
+    
+    if (!PyArg_ParseTuple(args, "s#i:addint", &kbuf, &ksiz, &num))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    result = tcrdbaddint(self->db, kbuf, ksiz, num);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    return PyInt_FromLong((long) result);
+}
+
+
+static PyObject *
+Tyrant_adddouble(Tyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz;
+    double num, result;
+    
+    if (!PyArg_ParseTuple(args, "s#d:adddouble", &kbuf, &ksiz, &num))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    result = tcrdbadddouble(self->db, kbuf, ksiz, num);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    return PyFloat_FromDouble(result);
+}
+
+
+static PyObject *
+Tyrant_sync(Tyrant *self)
+{
+    bool success;
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbsync(self->db);
+    TYRANT_WIRE_END
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_optimize(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    bool success = 0;
+    char *params = NULL;
+    
+    static char *kwlist[] = {"params", NULL };
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s:optimize", kwlist, 
+        &params))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdboptimize(self->db, params);
+    TYRANT_WIRE_END
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_vanish(Tyrant *self)
+{
+    bool success;
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbvanish(self->db);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_clear(self);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_copy(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *path;
+    
+    if (!PyArg_ParseTuple(args, "s", &path))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbcopy(self->db, path);
+    TYRANT_WIRE_END
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_restore(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    bool success = 0;
+    char *path = NULL;
+    uint64_t ts = 0;
+    int opts = 0;
+    
+    static char *kwlist[] = {"path", "ts", "opts", NULL };
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sK|i:restore", kwlist, 
+        &path, &ts, &opts))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbrestore(self->db, path, ts, opts);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_clear(self);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_setmst(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    bool success = 0;
+    char *host = NULL;
+    int port = 0;
+    uint64_t ts = 0;
+    int opts = 0;
+    
+    static char *kwlist[] = {"host", "port", "ts", "opts", NULL };
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "siK|i:restore", kwlist, 
+        &host, &port, &ts, &opts))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbsetmst(self->db, host, port, ts, opts);
+    TYRANT_WIRE_END
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_rnum(Tyrant *self)
+{
+    uint64_t rnum;
+    
+    TYRANT_WIRE_BEGIN
+    rnum = tcrdbrnum(self->db);
+    TYRANT_WIRE_END
+    
+    return PyLong_FromLongLong(rnum);
+}
+
+
+static PyObject *
+Tyrant_size(Tyrant *self)
+{
+    uint64_t fsiz;
+    
+    TYRANT_WIRE_BEGIN
+    fsiz = tcrdbsize(self->db);
+    TYRANT_WIRE_END
+    
+    return PyLong_FromLongLong(fsiz);
+}
+
+
+static PyObject *
+Tyrant_stat(Tyrant *self)
+{
+    char *stat;
+    
+    TYRANT_WIRE_BEGIN
+    stat = tcrdbstat(self->db);
+    TYRANT_WIRE_END
+    
+    return PyString_FromString(stat);
+}
+
+
+static PyObject *
+Tyrant_misc(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    const char *name;
+    int opts = 0;
+    TCLIST *list, *results;
+    PyObject *pyargs = NULL, *pyresults;
+    
+    static char *kwlist[] = {"name", "args", "opts", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|Oi:misc", kwlist,
+        &name, &pyargs, &opts))
+    {
+        return NULL;
+    }
+    
+    list = pyargs ? pystrings2tclist(pyargs) : tclistnew2(1);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    results = tcrdbmisc(self->db, name, opts, list);
+    TYRANT_WIRE_END
+    
+    tclistdel(list);
+    
+    /* Any function that is not known to be read-only may have changed records. */
+    if (strcmp(name, "get") && strcmp(name, "getlist") && strcmp(name, "iternext") &&
+        strcmp(name, "range") && strcmp(name, "regex") &&
+        strcmp(name, "getpart"))
+    {
+        tyrant_cache_clear(self);
+    }
+    
+    if (!results)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    pyresults = tclist2pylist(results);
+    tclistdel(results);
+    
+    return pyresults;
+}
+
+
+static PyObject *
+Tyrant_enable_cache(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    unsigned PY_LONG_LONG max_bytes;
+    double ttl = 0;
+    TyrantCache *cache;
+    
+    static char *kwlist[] = {"max_bytes", "ttl", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "K|d:enable_cache", kwlist,
+        &max_bytes, &ttl))
+    {
+        return NULL;
+    }
+    
+    cache = tyrant_cache_new((uint64_t) max_bytes, ttl);
+    
+    if (!cache)
+    {
+        return PyErr_NoMemory();
+    }
+    
+    tyrant_cache_del(self->cache);
+    self->cache = cache;
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_disable_cache(Tyrant *self)
+{
+    tyrant_cache_del(self->cache);
+    self->cache = NULL;
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_cache_stats(Tyrant *self)
+{
+    TyrantCache *cache = self->cache;
+    
+    if (!cache)
+    {
+        Py_RETURN_NONE;
+    }
+    
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K}",
+        "hits", (unsigned PY_LONG_LONG) cache->hits,
+        "misses", (unsigned PY_LONG_LONG) cache->misses,
+        "evictions", (unsigned PY_LONG_LONG) cache->evictions,
+        "entries", (unsigned PY_LONG_LONG) tcmaprnum(cache->map),
+        "bytes", (unsigned PY_LONG_LONG) tcmapmsiz(cache->map));
+}
+
+
+static PyObject *
+Tyrant_enable_metrics(Tyrant *self)
+{
+    if (!self->metrics)
+    {
+        self->metrics = tcmapnew2(64);
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_disable_metrics(Tyrant *self)
+{
+    if (self->metrics)
+    {
+        tcmapdel(self->metrics);
+        self->metrics = NULL;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_reset_metrics(Tyrant *self)
+{
+    if (self->metrics)
+    {
+        tcmapclear(self->metrics);
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+metrics_histogram(uint64_t *hist)
+{
+    int i;
+    PyObject *pyhist, *pycount;
+    
+    pyhist = PyTuple_New(METRICS_BUCKETS);
+    
+    if (!pyhist)
+    {
+        return NULL;
+    }
+    
+    for (i=0; i<METRICS_BUCKETS; i++)
+    {
+        pycount = PyLong_FromUnsignedLongLong(hist[i]);
+        
+        if (!pycount)
+        {
+            Py_DECREF(pyhist);
+            return NULL;
+        }
+        
+        PyTuple_SET_ITEM(pyhist, i, pycount);
+    }
+    
+    return pyhist;
+}
+
+
+static PyObject *
+Tyrant_metrics(Tyrant *self)
+{
+    int ksiz, vsiz;
+    const char *kbuf, *vbuf;
+    TyrantMethodStats stats;
+    PyObject *pymetrics, *pystats, *wire_hist, *conversion_hist;
+    
+    if (!self->metrics)
+    {
+        Py_RETURN_NONE;
+    }
+    
+    pymetrics = PyDict_New();
+    
+    if (!pymetrics)
+    {
+        return NULL;
+    }
+    
+    tcmapiterinit(self->metrics);
+    
+    while ((kbuf = tcmapiternext(self->metrics, &ksiz)) != NULL)
+    {
+        vbuf = tcmapiterval(kbuf, &vsiz);
+        memcpy(&stats, vbuf, sizeof(stats));
+        
+        wire_hist = metrics_histogram(stats.wire_hist);
+        conversion_hist = metrics_histogram(stats.conversion_hist);
+        
+        if (!wire_hist || !conversion_hist)
+        {
+            Py_XDECREF(wire_hist);
+            Py_XDECREF(conversion_hist);
+            Py_DECREF(pymetrics);
+            return NULL;
+        }
+        
+        pystats = Py_BuildValue("{s:K,s:K,s:K,s:K,s:d,s:d,s:d,s:N,s:N}",
+            "calls", (unsigned PY_LONG_LONG) stats.calls,
+            "errors", (unsigned PY_LONG_LONG) stats.errors,
+            "bytes_sent", (unsigned PY_LONG_LONG) stats.sent,
+            "bytes_received", (unsigned PY_LONG_LONG) stats.received,
+            "wire_time", stats.wire,
+            "gil_time", stats.gil,
+            "conversion_time", stats.conversion,
+            "wire_hist", wire_hist,
+            "conversion_hist", conversion_hist);
+        
+        if (!pystats || PyDict_SetItemString(pymetrics, kbuf, pystats))
+        {
+            Py_XDECREF(pystats);
+            Py_DECREF(pymetrics);
+            return NULL;
+        }
+        
+        Py_DECREF(pystats);
+    }
+    
+    return pymetrics;
+}
+
+
+static PyObject *
+Tyrant_tblput(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    TCMAP *cols;
+    PyObject *dict;
+    
+    if (!PyArg_ParseTuple(args, "s#O:put", &kbuf, &ksiz, &dict))
+    {
+        return NULL;
+    }
+    
+    cols = pydict2tcmap(dict);
+    
+    if (cols == NULL)
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbtblput(self->db, kbuf, ksiz, cols);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    tcmapdel(cols);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_tblputkeep(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    TCMAP *cols;
+    PyObject *dict;
+    
+    if (!PyArg_ParseTuple(args, "s#O:put", &kbuf, &ksiz, &dict))
+    {
+        return NULL;
+    }
+    
+    cols = pydict2tcmap(dict);
+    
+    if (cols == NULL)
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbtblputkeep(self->db, kbuf, ksiz, cols);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    tcmapdel(cols);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_tblputcat(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    TCMAP *cols;
+    PyObject *dict;
+    
+    if (!PyArg_ParseTuple(args, "s#O:put", &kbuf, &ksiz, &dict))
+    {
+        return NULL;
+    }
+    
+    cols = pydict2tcmap(dict);
+    
+    if (cols == NULL)
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbtblputcat(self->db, kbuf, ksiz, cols);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    tcmapdel(cols);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_tblout(Tyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    
+    if (!PyArg_ParseTuple(args, "s#:out", &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbtblout(self->db, kbuf, ksiz);
+    TYRANT_WIRE_END
+    
+    tyrant_cache_out(self, kbuf, ksiz);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_tblget(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    char *kbuf;
+    int ksiz;
+    TCMAP *cols;
+    PyObject *value, *schema = Py_None;
+    
+    static char *kwlist[] = {"key", "schema", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|O:get", kwlist,
+        &kbuf, &ksiz, &schema))
+    {
+        return NULL;
+    }
+    
+    if (pyschema_check(schema) != 0)
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    cols = tcrdbtblget(self->db, kbuf, ksiz);
+    TYRANT_WIRE_END
+    
+    if (!cols)
+    {
+        Py_RETURN_NONE;
+    }
+    
+    value = tcmap2pydict(cols, schema != Py_None ? schema : NULL);
+    tcmapdel(cols);
+    
+    if (!value)
+    {
+        return NULL;
+    }
+    
+    return value;
+}
+
+
+static PyObject *
+Tyrant_tblsetindex(Tyrant *self, PyObject *args)
+{
+    bool success = 0;
+    const char *name;
+    int opts;
+    
+    if (!PyArg_ParseTuple(args, "si:setindex", &name, &opts))
+    {
+        return NULL;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbtblsetindex(self->db, name, opts);
+    TYRANT_WIRE_END
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+Tyrant_tblgenuid(Tyrant *self)
+{
+    int64_t id = 0;
+    
+    TYRANT_WIRE_BEGIN
+    id = tcrdbtblgenuid(self->db);
+    TYRANT_WIRE_END
+    
+    if (id < 0)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    return Py_BuildValue("L", id);
+}
+
+
+static PyObject *
+Tyrant_tblquery(Tyrant *self)
+{
+    PyObject *query;
+    PyObject *args;
+    
+    args = Py_BuildValue("(O)", self);
+    query = TyrantQuery_new(&TyrantQueryType, args, NULL);
+    Py_DECREF(args);
+    
+    if (!query)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    return query;
+}
+
+
+static PyObject *
+Tyrant_metasearch(Tyrant *self, PyObject *args)
+{
+    RDBQRY **queries;
+    TyrantQuery *query;
+    TCLIST *results;
+    int n = 0, i=0, vsiz = 0, type = 0;
+    const char *vbuf;
+    PyObject *pyresults, *val, *pyqueries, *item;
+    
+    if (!PyArg_ParseTuple(args, "Oi:metasearch", &pyqueries, &type))
+    {
+        return NULL;
+    }
+    
+    if (!PyList_Check(pyqueries))
+    {
+        return NULL;
+    }
+    
+    n = PyList_Size(pyqueries);
+    
+    if (n == 0)
+    {
+        pyresults = PyList_New(0);
+        return pyresults;
+    }
+    
+    queries = (RDBQRY **) malloc(sizeof(RDBQRY *) * n);
+    
+    if (queries == NULL)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Could not allocate queries list.");
+        return NULL;
+    }
+    
+    for (i=0; i<n; i++)
+    {
+        item = PyList_GetItem(pyqueries, i);
+        
+        if (!PyObject_TypeCheck(item, &TyrantQueryType))
+        {
+            PyErr_SetString(PyExc_TypeError, "Expected a list of tyrant query objects.");
+            free(queries);
+            return NULL;
+        }
+        
+        query = (TyrantQuery *) item;
+        queries[i] = query->q;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    results = tcrdbmetasearch(queries, n, type);
+    TYRANT_WIRE_END
+    
+    free(queries);
+    
+    if (!results)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate memory for TCLIST object");
+        return NULL;
+    }
+    
+    n = tclistnum(results);
+    pyresults = PyList_New(n);
+    
+    if (pyresults)
+    {
+        for (i=0; i<n; i++)
+        {
+            vbuf = tclistval(results, i, &vsiz);
+            val = PyString_FromStringAndSize(vbuf, vsiz);
+            PyList_SET_ITEM(pyresults, i, val);
+            
+            vsiz = 0;
+        }
+    }
+    tclistdel(results);
+    
+    return pyresults;
+}
+
+
+static Py_ssize_t
+Tyrant_length(Tyrant *self)
+{
+    uint64_t rnum;
+    
+    TYRANT_WIRE_BEGIN
+    rnum = tcrdbrnum(self->db);
+    TYRANT_WIRE_END
+    
+    return (Py_ssize_t) rnum;
+}
+
+
+static PyObject *
+Tyrant_subscript(Tyrant *self, PyObject *key)
+{
+    char *kbuf, *vbuf;
+    const char *cbuf;
+    Py_ssize_t ksiz;
+    int vsiz;
+    uint64_t epoch;
+    TyrantCache *cache;
+    PyObject *value;
+    
+    if (!PyString_Check(key))
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected key to be a string.");
+        return NULL;
+    }
+    
+    PyString_AsStringAndSize(key, &kbuf, &ksiz);
+    
+    if (!kbuf)
+    {
+        return NULL;
+    }
+    
+    if (self->cache)
+    {
+        cbuf = tyrant_cache_get(self->cache, kbuf, (int) ksiz, &vsiz);
+        if (cbuf)
+        {
+            return PyString_FromStringAndSize(cbuf, vsiz);
+        }
+    }
+    
+    cache = tyrant_cache_watch(self, &epoch);
+    
+    TYRANT_WIRE_BEGIN
+    vbuf = tcrdbget(self->db, kbuf, (int) ksiz, &vsiz);
+    TYRANT_WIRE_END
+    
+    if (!vbuf)
+    {
+        raise_tyrant_error(self->db);
+        return NULL;
+    }
+    
+    tyrant_cache_fill(self, cache, epoch, kbuf, (int) ksiz, vbuf, vsiz);
+    
+    value = PyString_FromStringAndSize(vbuf, vsiz);
+    free(vbuf);
+    
+    if (!value)
+    {
+        return NULL;
+    }
+    
+    return value;
+}
+
+
+static int
+Tyrant_ass_subscript(Tyrant *self, PyObject *key, PyObject *value)
+{
+    bool success;
+    char *kbuf;
+    Py_ssize_t ksiz;
+    Py_buffer view;
+    
+    if (!PyString_Check(key))
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected key to be a string.");
+        return -1;
+    }
+    
+    if (!value || pybuffer_get(value, &view, false) != 0)
+    {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_ValueError, "Expected value to be a string or buffer.");
+        return -1;
+    }
+    
+    PyString_AsStringAndSize(key, &kbuf, &ksiz);
+    if (!kbuf)
+    {
+        PyBuffer_Release(&view);
+        return -1;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    success = tcrdbput(self->db, kbuf, (int) ksiz, view.buf, (int) view.len);
+    TYRANT_WIRE_END
+    
+    PyBuffer_Release(&view);
+    
+    tyrant_cache_out(self, kbuf, (int) ksiz);
+    
+    if (!success)
+    {
+        raise_tyrant_error(self->db);
+        return -1;
+    }
+    
+    return 0;
+}
+
+
+/*
+ * The mapping and sequence slots bypass attribute lookup, so while metrics
+ * are enabled they are timed here under the names of their special methods.
+ */
+static Py_ssize_t
+Tyrant_metered_length(Tyrant *self)
+{
+    Py_ssize_t n;
+    MetricsFrame frame;
+    
+    if (!self->metrics)
+    {
+        return Tyrant_length(self);
+    }
+    
+    metrics_enter(&frame);
+    n = Tyrant_length(self);
+    metrics_leave(&frame, self->metrics, "__len__", n < 0, 0, 0);
+    
+    return n;
+}
+
+
+static PyObject *
+Tyrant_metered_subscript(Tyrant *self, PyObject *key)
+{
+    PyObject *result;
+    MetricsFrame frame;
+    
+    if (!self->metrics)
+    {
+        return Tyrant_subscript(self, key);
+    }
+    
+    metrics_enter(&frame);
+    result = Tyrant_subscript(self, key);
+    metrics_leave(&frame, self->metrics, "__getitem__", !result,
+        metrics_payload(key, 0), metrics_payload(result, 0));
+    
+    return result;
+}
+
+
+static int
+Tyrant_metered_ass_subscript(Tyrant *self, PyObject *key, PyObject *value)
+{
+    int rv;
+    MetricsFrame frame;
+    
+    /* Deletion is always rejected, so there is no __delitem__ to record. */
+    if (!self->metrics || !value)
+    {
+        return Tyrant_ass_subscript(self, key, value);
+    }
+    
+    metrics_enter(&frame);
+    rv = Tyrant_ass_subscript(self, key, value);
+    metrics_leave(&frame, self->metrics, "__setitem__", rv != 0,
+        metrics_payload(key, 0) + metrics_payload(value, 0), 0);
+    
+    return rv;
+}
+
+
+static PyMappingMethods Tyrant_as_mapping = 
+{
+    (lenfunc) Tyrant_metered_length,
+    (binaryfunc) Tyrant_metered_subscript,
+    (objobjargproc) Tyrant_metered_ass_subscript
+};
+
+
+static int
+Tyrant_contains(Tyrant *self, PyObject *value)
+{
+    char *kbuf;
+    Py_ssize_t ksiz;
+    int vsiz;
+    
+    if (!PyString_Check(value))
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected value to be a string");
+        return -1;
+    }
+    
+    PyString_AsStringAndSize(value, &kbuf, &ksiz);
+    if (!kbuf)
+    {
+        return -1;
+    }
+    
+    TYRANT_WIRE_BEGIN
+    vsiz = tcrdbvsiz(self->db, kbuf, (int) ksiz);
+    TYRANT_WIRE_END
+    
+    return vsiz != -1;
+}
+
+
+static int
+Tyrant_metered_contains(Tyrant *self, PyObject *value)
+{
+    int rv;
+    MetricsFrame frame;
+    
+    if (!self->metrics)
+    {
+        return Tyrant_contains(self, value);
+    }
+    
+    metrics_enter(&frame);
+    rv = Tyrant_contains(self, value);
+    metrics_leave(&frame, self->metrics, "__contains__", rv < 0,
+        metrics_payload(value, 0), 0);
+    
+    return rv;
+}
+
+
+static PySequenceMethods Tyrant_as_sequence = 
+{
+    0,                                     /* sq_length */
+    0,                                     /* sq_concat */
+    0,                                     /* sq_repeat */
+    0,                                     /* sq_item */
+    0,                                     /* sq_slice */
+    0,                                     /* sq_ass_item */
+    0,                                     /* sq_ass_slice */
+    (objobjproc) Tyrant_metered_contains,  /* sq_contains */
+    0,                                     /* sq_inplace_concat */
+    0                                      /* sq_inplace_repeat */
+};
+
+
+static PyMethodDef Tyrant_methods[] = 
+{
+    {
+        "tune", (PyCFunction) Tyrant_tune,
+        METH_VARARGS | METH_KEYWORDS,
+        "Set tuning parameters."
+    },
+    
+    {
+        "open", (PyCFunction) Tyrant_open, 
+        METH_VARARGS | METH_KEYWORDS,
+        "Open the database connection"
+    },
+    
+    {
+        "close", (PyCFunction) Tyrant_close,
+        METH_NOARGS,
+        "Close the database connection"
+    },
+    
+    {
+        "put", (PyCFunction) Tyrant_put,
+        METH_VARARGS,
+        "Store a record. Overwrite existing record."
+    },
+    
+    {
+        "putkeep", (PyCFunction) Tyrant_putkeep,
+        METH_VARARGS,
+        "Store a record. Don't overwrite an existing record."
+    },
+    
+    {
+        "putcat", (PyCFunction) Tyrant_putcat,
+        METH_VARARGS,
+        "Concatenate value on the end of a record. Creates the record if it doesn't exist."
+    },
+    
+    {
+        "putnr", (PyCFunction) Tyrant_putnr,
+        METH_VARARGS,
+        "Store a record. Overwrite existing record. Don't wait for a server response."
+    },
+    
+    {
+        "out", (PyCFunction) Tyrant_out,
+        METH_VARARGS,
+        "Remove a record. If there are duplicates only the first is removed."
+    },
+    
+    {
+        "putlist", (PyCFunction) Tyrant_putlist,
+        METH_VARARGS,
+        "Store multiple records in one request. Takes a mapping or (key, value) pairs."
+    },
+    
+    {
+        "outlist", (PyCFunction) Tyrant_outlist,
+        METH_VARARGS,
+        "Remove multiple records in one request."
+    },
+    
+    {
+        "get", (PyCFunction) Tyrant_get,
+        METH_VARARGS | METH_KEYWORDS,
+        "Retrieve a record. If none is found None or the supplied default value is returned."
+    },
+    
+    {
+        "get_into", (PyCFunction) Tyrant_get_into,
+        METH_VARARGS,
+        "Read a value into a writable buffer. Returns the number of bytes written, or None if the key is missing."
+    },
+    
+    {
+        "mget", (PyCFunction) Tyrant_mget,
+        METH_VARARGS,
+        "Retrieve multiple records in one request. Returns a dict of the keys that were found."
+    },
+    
+    {
+        "vsiz", (PyCFunction) Tyrant_vsiz,
+        METH_VARARGS,
+        "Get the size of the of the record for key. If duplicates are found, the first record is used."
+    },
+    
+    {
+        "fwmkeys", (PyCFunction) Tyrant_fwmkeys,
+        METH_VARARGS | METH_KEYWORDS,
+        "Get a list of of keys that match the given prefix."
+    },
+    
+    {
+        "iterkeys", (PyCFunction) Tyrant_iterkeys,
+        METH_VARARGS | METH_KEYWORDS,
+        "Iterate over every key in the database, fetching them from the server in batches. Only one iteration or dump can be active on a connection at a time."
+    },
+    
+    {
+        "addint", (PyCFunction) Tyrant_addint,
+        METH_VARARGS,
+        "Add an integer to the selected record."
+    },
+    
+    {
+        "adddouble", (PyCFunction) Tyrant_adddouble,
+        METH_VARARGS,
+        "Add a double to the selected record."
+    },
+    
+    {
+        "sync", (PyCFunction) Tyrant_sync,
+        METH_NOARGS,
+        "Sync data with the disk device."
+    },
+    
+    {
+        "optimize", (PyCFunction) Tyrant_optimize,
+        METH_VARARGS,
+        "Optimize a fragmented database."
+    },
+    
+    {
+        "vanish", (PyCFunction) Tyrant_vanish,
+        METH_NOARGS,
+        "Remove all records from the database."
+    },
+    
+    {
+        "copy", (PyCFunction) Tyrant_copy,
+        METH_VARARGS,
+        "Copy the database to a new file."
+    },
+    
+    {
+        "restore", (PyCFunction) Tyrant_restore,
+        METH_VARARGS | METH_KEYWORDS,
+        "Restore the database from the update logs."
+    },
+    
+    {
+        "setmst", (PyCFunction) Tyrant_setmst,
+        METH_VARARGS | METH_KEYWORDS,
+        "Set the replication master."
+    },
+    
+    {
+        "rnum", (PyCFunction) Tyrant_rnum,
+        METH_NOARGS,
+        "Get the number of records in the database."
+    },
+    
+    {
+        "size", (PyCFunction) Tyrant_size,
+        METH_NOARGS,
+        "Get the size of the database in bytes."
+    },
+    
+    {
+        "stat", (PyCFunction) Tyrant_stat,
+        METH_NOARGS,
+        "Get the server status string."
+    },
+    
+    {
+        "misc", (PyCFunction) Tyrant_misc,
+        METH_VARARGS | METH_KEYWORDS,
+        "Call a server-side function by name with a list of string arguments. Returns a list."
+    },
+    
+    {
+        "tblput", (PyCFunction) Tyrant_tblput,
+        METH_VARARGS,
+        "Store a record. Overwrite existing record."
+    },
+    
+    {
+        "tblputkeep", (PyCFunction) Tyrant_tblputkeep,
+        METH_VARARGS,
+        "Store a record. Don't overwrite an existing record."
+    },
+    
+    {
+        "tblputcat", (PyCFunction) Tyrant_tblputcat,
+        METH_VARARGS,
+        "Concatenate value on the end of a record. Creates the record if it doesn't exist."
+    },
+    
+    {
+        "tblout", (PyCFunction) Tyrant_tblout,
+        METH_VARARGS,
+        "Remove a record. If there are duplicates only the first is removed."
+    },
+    
+    {
+        "tblget", (PyCFunction) Tyrant_tblget,
+        METH_VARARGS | METH_KEYWORDS,
+        "Retrieve a record. If none is found None is returned. Columns named in the optional schema are converted."
+    },
+    
+    {
+        "tblsetindex", (PyCFunction) Tyrant_tblsetindex,
+        METH_VARARGS,
+        "Set an index on a column."
+    },
+    
+    {
+        "tblgenuid", (PyCFunction) Tyrant_tblgenuid,
+        METH_VARARGS,
+        "Generate a unique record id."
+    },
+    
+    {
+        "tblquery", (PyCFunction) Tyrant_tblquery,
+        METH_NOARGS,
+        "Get a query object for this database."
+    },
+    
+    {
+        "metasearch", (PyCFunction) Tyrant_metasearch,
+        METH_VARARGS,
+        "Use multiple query objects and a set operation to retrieve records."
+    },
+    
+    {
+        "pipeline", (PyCFunction) Tyrant_pipeline,
+        METH_NOARGS,
+        "Get a pipeline that queues commands and sends them to the server together."
+    },
+    
+    {
+        "load", (PyCFunction) Tyrant_load,
+        METH_VARARGS | METH_KEYWORDS,
+        "Bulk load records from a tsv or kv file. Returns a dict of loaded, failed and malformed counts."
+    },
+    
+    {
+        "dump", (PyCFunction) Tyrant_dump,
+        METH_VARARGS | METH_KEYWORDS,
+        "Write every record to a path or file descriptor in the format read by load. Returns a dict of dumped and skipped counts."
+    },
+    
+    {
+        "enable_cache", (PyCFunction) Tyrant_enable_cache,
+        METH_VARARGS | METH_KEYWORDS,
+        "Cache values read with get and mget locally, up to max_bytes, for at most ttl seconds."
+    },
+    
+    {
+        "disable_cache", (PyCFunction) Tyrant_disable_cache,
+        METH_NOARGS,
+        "Drop the local read cache."
+    },
+    
+    {
+        "cache_stats", (PyCFunction) Tyrant_cache_stats,
+        METH_NOARGS,
+        "Get hit, miss and eviction counts for the local read cache. Returns None if it is disabled."
+    },
+    
+    {
+        "enable_metrics", (PyCFunction) Tyrant_enable_metrics,
+        METH_NOARGS,
+        "Record call counts, payload bytes and wire, GIL and conversion times per method."
+    },
+    
+    {
+        "disable_metrics", (PyCFunction) Tyrant_disable_metrics,
+        METH_NOARGS,
+        "Stop recording method metrics and drop those collected."
+    },
+    
+    {
+        "reset_metrics", (PyCFunction) Tyrant_reset_metrics,
+        METH_NOARGS,
+        "Zero the collected method metrics."
+    },
+    
+    {
+        "metrics", (PyCFunction) Tyrant_metrics,
+        METH_NOARGS,
+        "Get a dict of stats for each method called since metrics were enabled. Query methods are keyed as query.<name> and item access as __getitem__, __setitem__, __len__ and __contains__. Returns None if metrics are disabled."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject TyrantType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.Tyrant",                /* tp_name */
+  sizeof(Tyrant),                              /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)Tyrant_dealloc,                  /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  &Tyrant_as_sequence,                         /* tp_as_sequence */
+  &Tyrant_as_mapping,                          /* tp_as_mapping */
+  Tyrant_Hash,                                 /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  (getattrofunc)Tyrant_getattro,               /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
+  "Tyrant database",                           /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  (getiterfunc)Tyrant_iter,                    /* tp_iter */
+  0,                                           /* tp_iternext */
+  Tyrant_methods,                              /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  Tyrant_new,                                  /* tp_new */
+};
+
+
+typedef struct
+{
+    Tyrant *conn;
+    bool open;
+} TyrantPoolSlot;
+
+
+typedef struct
+{
+    PyObject_HEAD
+    char *host;
+    int port;
+    double timeout;
+    int size;
+    TyrantPoolSlot *slots;
+    int *idle;
+    int nidle;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} TyrantPool;
+
+
+typedef struct
+{
+    PyObject_HEAD
+    TyrantPool *pool;
+    PyObject *name;
+} TyrantPoolMethod;
+
+
+static PyTypeObject TyrantPoolType;
+static PyTypeObject TyrantPoolMethodType;
+
+
+/*
+ * Take an idle handle from the pool, blocking until one is free, and open
+ * its connection if it is not already open. Returns the slot index, or -1
+ * with the error code in `ecode`. Must be called without the GIL.
+ */
+static int
+tyrantpool_acquire(TyrantPool *pool, int *ecode)
+{
+    int slot;
+    TCRDB *db;
+    
+    pthread_mutex_lock(&pool->mutex);
+    
+    while (pool->nidle == 0)
+    {
+        pthread_cond_wait(&pool->cond, &pool->mutex);
+    }
+    
+    slot = pool->idle[--pool->nidle];
+    
+    pthread_mutex_unlock(&pool->mutex);
+    
+    if (!pool->slots[slot].open)
+    {
+        db = pool->slots[slot].conn->db;
+        
+        if (!tcrdbtune(db, pool->timeout, RDBTRECON) ||
+            !tcrdbopen(db, pool->host, pool->port))
+        {
+            *ecode = tcrdbecode(db);
+            
+            pthread_mutex_lock(&pool->mutex);
+            pool->idle[pool->nidle++] = slot;
+            pthread_cond_signal(&pool->cond);
+            pthread_mutex_unlock(&pool->mutex);
+            
+            return -1;
+        }
+        
+        pool->slots[slot].open = true;
+    }
+    
+    return slot;
+}
+
+
+/*
+ * Hand a handle back to the pool. A handle whose last call failed at the
+ * connection level is closed so that the next user reconnects it.
+ */
+static void
+tyrantpool_release(TyrantPool *pool, int slot, bool healthy)
+{
+    if (!healthy && pool->slots[slot].open)
+    {
+        tcrdbclose(pool->slots[slot].conn->db);
+        pool->slots[slot].open = false;
+    }
+    
+    pthread_mutex_lock(&pool->mutex);
+    pool->idle[pool->nidle++] = slot;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+
+static bool
+tyrant_ecode_healthy(int ecode)
+{
+    switch (ecode)
+    {
+        case TTEINVALID:
+        case TTENOHOST:
+        case TTEREFUSED:
+        case TTESEND:
+        case TTERECV:
+            return false;
+        default:
+            return true;
+    }
+}
+
+
+/*
+ * Call the method `name` on a pooled handle. If `healthy` is given it is set
+ * to whether the call failed at the connection level.
+ */
+static PyObject *
+tyrantpool_call(TyrantPool *pool, PyObject *name, PyObject *args, PyObject *kwargs,
+    bool *phealthy)
+{
+    int slot, ecode = TTESUCCESS;
+    bool healthy = true;
+    PyObject *method, *result;
+    
+    if (phealthy)
+    {
+        *phealthy = true;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    slot = tyrantpool_acquire(pool, &ecode);
+    Py_END_ALLOW_THREADS
+    
+    if (slot < 0)
+    {
+        if (phealthy)
+        {
+            *phealthy = false;
+        }
+        raise_tyrant_code(ecode);
+        return NULL;
+    }
+    
+    method = PyObject_GetAttr((PyObject *) pool->slots[slot].conn, name);
+    
+    if (!method)
+    {
+        tyrantpool_release(pool, slot, true);
+        return NULL;
+    }
+    
+    result = PyObject_Call(method, args, kwargs);
+    Py_DECREF(method);
+    
+    if (!result && PyErr_ExceptionMatches(TyrantError))
+    {
+        healthy = tyrant_ecode_healthy(tcrdbecode(pool->slots[slot].conn->db));
+    }
+    
+    tyrantpool_release(pool, slot, healthy);
+    
+    if (phealthy)
+    {
+        *phealthy = healthy;
+    }
+    
+    return result;
+}
+
+
+static PyObject *
+tyrantpool_forward(TyrantPool *pool, PyObject *name, PyObject *args, PyObject *kwargs)
+{
+    return tyrantpool_call(pool, name, args, kwargs, NULL);
+}
+
+
+static PyObject *
+tyrantpool_forward2(TyrantPool *pool, const char *name, PyObject *args)
+{
+    PyObject *pyname, *result;
+    
+    pyname = PyString_FromString(name);
+    
+    if (!pyname)
+    {
+        return NULL;
+    }
+    
+    result = tyrantpool_forward(pool, pyname, args, NULL);
+    Py_DECREF(pyname);
+    
+    return result;
+}
+
+
+static void
+TyrantPoolMethod_dealloc(TyrantPoolMethod *self)
+{
+    Py_XDECREF(self->pool);
+    Py_XDECREF(self->name);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+TyrantPoolMethod_call(TyrantPoolMethod *self, PyObject *args, PyObject *kwargs)
+{
+    return tyrantpool_forward(self->pool, self->name, args, kwargs);
+}
+
+
+static PyTypeObject TyrantPoolMethodType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantPoolMethod",      /* tp_name */
+  sizeof(TyrantPoolMethod),                    /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantPoolMethod_dealloc,        /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  (ternaryfunc)TyrantPoolMethod_call,          /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Tyrant method bound to a connection pool",  /* tp_doc */
+};
+
+
+static void
+TyrantPool_dealloc(TyrantPool *self)
+{
+    int i;
+    
+    if (self->slots)
+    {
+        for (i=0; i<self->size; i++)
+        {
+            if (self->slots[i].open)
+            {
+                Py_BEGIN_ALLOW_THREADS
+                tcrdbclose(self->slots[i].conn->db);
+                Py_END_ALLOW_THREADS
+            }
+            Py_XDECREF(self->slots[i].conn);
+        }
+        free(self->slots);
+        pthread_mutex_destroy(&self->mutex);
+        pthread_cond_destroy(&self->cond);
+    }
+    free(self->idle);
+    free(self->host);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+TyrantPool_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    TyrantPool *self;
+    PyObject *noargs;
+    const char *host;
+    int i, port, size = 0;
+    double timeout = 0.0;
+    
+    static char *kwlist[] = {"host", "port", "size", "timeout", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|id:TyrantPool", kwlist,
+        &host, &port, &size, &timeout))
+    {
+        return NULL;
+    }
+    
+    if (size <= 0)
+    {
+        size = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (size < 1)
+        {
+            size = 1;
+        }
+    }
+    
+    self = (TyrantPool *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate TyrantPool instance.");
+        return NULL;
+    }
+    
+    self->host = strdup(host);
+    self->port = port;
+    self->timeout = timeout;
+    self->idle = malloc(sizeof(int) * size);
+    self->slots = calloc(size, sizeof(TyrantPoolSlot));
+    
+    if (!self->host || !self->idle || !self->slots)
+    {
+        free(self->slots);
+        self->slots = NULL;
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate connection pool.");
+        return NULL;
+    }
+    
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    self->size = size;
+    
+    noargs = PyTuple_New(0);
+    
+    if (!noargs)
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    
+    /* Handles are allocated up front but only connect on first use. */
+    for (i=0; i<size; i++)
+    {
+        self->slots[i].conn = (Tyrant *) Tyrant_new(&TyrantType, noargs, NULL);
+        
+        if (!self->slots[i].conn)
+        {
+            Py_DECREF(noargs);
+            Py_DECREF(self);
+            return NULL;
+        }
+        
+        self->idle[self->nidle++] = size - i - 1;
+    }
+    
+    Py_DECREF(noargs);
+    
+    return (PyObject *) self;
+}
+
+
+/*
+ * Calls that tie state to one connection, or return an object bound to it,
+ * cannot be spread over a pool or a replica set.
+ */
+static const char *tyrant_unforwardable[] = {
+    "open", "tune", "iterkeys", "tblquery", "pipeline", "load", "dump",
+    "enable_cache", "disable_cache", "cache_stats",
+    "enable_metrics", "disable_metrics", "reset_metrics", "metrics", NULL
+};
+
+
+/*
+ * Check that `name` is a Tyrant method that may be called on any connection
+ * of a pool. Otherwise raise AttributeError for `self` and return false.
+ */
+static bool
+tyrant_forwardable(PyObject *self, PyObject *name)
+{
+    int i;
+    const char *cname = PyString_Check(name) ? PyString_AS_STRING(name) : NULL;
+    
+    if (cname && cname[0] != '_' && PyDict_GetItem(TyrantType.tp_dict, name))
+    {
+        for (i=0; tyrant_unforwardable[i]; i++)
+        {
+            if (!strcmp(cname, tyrant_unforwardable[i]))
+            {
+                break;
+            }
+        }
+        
+        if (!tyrant_unforwardable[i])
+        {
+            return true;
+        }
+    }
+    
+    PyErr_Format(PyExc_AttributeError, "'%.50s' object has no attribute '%.400s'",
+        self->ob_type->tp_name, cname ? cname : "?");
+    return false;
+}
+
+
+static PyObject *
+TyrantPool_getattro(TyrantPool *self, PyObject *name)
+{
+    PyObject *attr;
+    TyrantPoolMethod *method;
+    
+    attr = PyObject_GenericGetAttr((PyObject *) self, name);
+    
+    if (attr || !PyErr_ExceptionMatches(PyExc_AttributeError))
+    {
+        return attr;
+    }
+    
+    PyErr_Clear();
+    
+    if (!tyrant_forwardable((PyObject *) self, name))
+    {
+        return NULL;
+    }
+    
+    method = PyObject_New(TyrantPoolMethod, &TyrantPoolMethodType);
+    
+    if (!method)
+    {
+        return NULL;
+    }
+    
+    Py_INCREF(self);
+    method->pool = self;
+    Py_INCREF(name);
+    method->name = name;
+    
+    return (PyObject *) method;
+}
+
+
+static PyObject *
+TyrantPool_close(TyrantPool *self)
+{
+    int i, slot;
+    
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->mutex);
+    for (i=0; i<self->nidle; i++)
+    {
+        slot = self->idle[i];
+        if (self->slots[slot].open)
+        {
+            tcrdbclose(self->slots[slot].conn->db);
+            self->slots[slot].open = false;
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+    Py_END_ALLOW_THREADS
+    
+    Py_RETURN_NONE;
+}
+
+
+static Py_ssize_t
+TyrantPool_length(TyrantPool *self)
+{
+    PyObject *args, *result;
+    Py_ssize_t n;
+    
+    args = PyTuple_New(0);
+    if (!args)
+    {
+        return -1;
+    }
+    
+    result = tyrantpool_forward2(self, "__len__", args);
+    Py_DECREF(args);
+    
+    if (!result)
+    {
+        return -1;
+    }
+    
+    n = PyInt_AsSsize_t(result);
+    Py_DECREF(result);
+    
+    return n;
+}
+
+
+static PyObject *
+TyrantPool_subscript(TyrantPool *self, PyObject *key)
+{
+    PyObject *args, *result;
+    
+    args = PyTuple_Pack(1, key);
+    if (!args)
+    {
+        return NULL;
+    }
+    
+    result = tyrantpool_forward2(self, "__getitem__", args);
+    Py_DECREF(args);
+    
+    return result;
+}
+
+
+static int
+TyrantPool_ass_subscript(TyrantPool *self, PyObject *key, PyObject *value)
+{
+    PyObject *args, *result;
+    
+    if (!value)
+    {
+        PyErr_SetString(PyExc_TypeError, "Use out() to remove records.");
+        return -1;
+    }
+    
+    args = PyTuple_Pack(2, key, value);
+    if (!args)
+    {
+        return -1;
+    }
+    
+    result = tyrantpool_forward2(self, "__setitem__", args);
+    Py_DECREF(args);
+    
+    if (!result)
+    {
+        return -1;
+    }
+    
+    Py_DECREF(result);
+    return 0;
+}
+
+
+static PyMappingMethods TyrantPool_as_mapping = 
+{
+    (lenfunc) TyrantPool_length,
+    (binaryfunc) TyrantPool_subscript,
+    (objobjargproc) TyrantPool_ass_subscript
+};
+
+
+static int
+TyrantPool_contains(TyrantPool *self, PyObject *value)
+{
+    PyObject *args, *result;
+    int found;
+    
+    args = PyTuple_Pack(1, value);
+    if (!args)
+    {
+        return -1;
+    }
+    
+    result = tyrantpool_forward2(self, "__contains__", args);
+    Py_DECREF(args);
+    
+    if (!result)
+    {
+        return -1;
+    }
+    
+    found = PyObject_IsTrue(result);
+    Py_DECREF(result);
+    
+    return found;
+}
+
+
+static PySequenceMethods TyrantPool_as_sequence = 
+{
+    0,                                 /* sq_length */
+    0,                                 /* sq_concat */
+    0,                                 /* sq_repeat */
+    0,                                 /* sq_item */
+    0,                                 /* sq_slice */
+    0,                                 /* sq_ass_item */
+    0,                                 /* sq_ass_slice */
+    (objobjproc) TyrantPool_contains,  /* sq_contains */
+    0,                                 /* sq_inplace_concat */
+    0                                  /* sq_inplace_repeat */
+};
+
+
+static PyMethodDef TyrantPool_methods[] = 
+{
+    {
+        "close", (PyCFunction) TyrantPool_close,
+        METH_NOARGS,
+        "Close every idle connection in the pool. They reopen on next use."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject TyrantPoolType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantPool",            /* tp_name */
+  sizeof(TyrantPool),                          /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantPool_dealloc,              /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  &TyrantPool_as_sequence,                     /* tp_as_sequence */
+  &TyrantPool_as_mapping,                      /* tp_as_mapping */
+  Tyrant_Hash,                                 /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  (getattrofunc)TyrantPool_getattro,           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
+  "Pool of Tyrant connections with the same methods as Tyrant", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  0,                                           /* tp_iter */
+  0,                                           /* tp_iternext */
+  TyrantPool_methods,                          /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  TyrantPool_new,                              /* tp_new */
+};
+
+
+#define HEDGE_SAMPLES 512
+#define HEDGE_MIN_SAMPLES 16
+#define HEDGE_RECOMPUTE 32
+#define HEDGE_BURST 10.0
+
+
+/*
+ * A client for a master with replicating slaves, as configured by setmst.
+ * Writes go to a pool on the master. Reads go to the healthy replica with
+ * the fewest requests in flight, or to the master if no replica is healthy.
+ * A background thread polls the stat output of each replica and takes it
+ * out of rotation while it is unreachable or its replication delay exceeds
+ * max_delay.
+ */
+typedef struct
+{
+    TyrantPool *pool;
+    TCRDB *probe;
+    bool open;
+    bool healthy;
+    double delay;
+    int outstanding;
+} TyrantReplica;
+
+
+typedef struct
+{
+    PyObject_HEAD
+    TyrantPool *master;
+    TyrantReplica *replicas;
+    int nreplicas;
+    int next;
+    double timeout;
+    double max_delay;
+    double interval;
+    bool probing;
+    bool stopping;
+    pthread_t prober;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool hedging;
+    int hedge_running;
+    pthread_cond_t hedge_cond;
+    double hedge_percentile;
+    double hedge_rate;
+    double hedge_min_delay;
+    double hedge_delay;
+    double hedge_tokens;
+    double hedge_samples[HEDGE_SAMPLES];
+    uint64_t hedge_count;
+    uint64_t hedge_reads;
+    uint64_t hedge_sent;
+    uint64_t hedge_wins;
+} ReplicatedTyrant;
+
+
+typedef struct
+{
+    PyObject_HEAD
+    ReplicatedTyrant *db;
+    PyObject *name;
+    bool read;
+} ReplicatedTyrantMethod;
+
+
+static PyTypeObject ReplicatedTyrantType;
+static PyTypeObject ReplicatedTyrantMethodType;
+
+
+static const char *replicated_reads[] = {
+    "get", "get_into", "mget", "vsiz", "fwmkeys", "rnum", "size", "tblget",
+    "__len__", "__getitem__", "__contains__", NULL
+};
+
+
+static bool
+replicated_is_read(const char *name)
+{
+    int i;
+    
+    for (i=0; replicated_reads[i]; i++)
+    {
+        if (!strcmp(name, replicated_reads[i]))
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+
+/*
+ * Fetch the stat output of one replica and update its health. The delay
+ * line is only present on slaves; a node without it is not lagging. Must
+ * be called without the GIL.
+ */
+static void
+replicated_probe(ReplicatedTyrant *self, TyrantReplica *replica)
+{
+    char *stat, *line;
+    double delay = 0;
+    bool healthy = false;
+    
+    if (!replica->open)
+    {
+        replica->open = tcrdbtune(replica->probe, self->timeout, RDBTRECON) &&
+            tcrdbopen(replica->probe, replica->pool->host, replica->pool->port);
+    }
+    
+    stat = replica->open ? tcrdbstat(replica->probe) : NULL;
+    
+    if (stat)
+    {
+        if (!strncmp(stat, "delay\t", 6))
+        {
+            delay = strtod(stat + 6, NULL);
+        }
+        else if ((line = strstr(stat, "\ndelay\t")) != NULL)
+        {
+            delay = strtod(line + 7, NULL);
+        }
+        healthy = delay <= self->max_delay;
+        free(stat);
+    }
+    else if (replica->open)
+    {
+        tcrdbclose(replica->probe);
+        replica->open = false;
+    }
+    
+    pthread_mutex_lock(&self->mutex);
+    replica->healthy = healthy;
+    replica->delay = delay;
+    pthread_mutex_unlock(&self->mutex);
+}
+
+
+static void *
+replicated_prober(void *arg)
+{
+    ReplicatedTyrant *self = arg;
+    struct timespec deadline;
+    double wake;
+    int i;
+    
+    pthread_mutex_lock(&self->mutex);
+    
+    while (!self->stopping)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        wake = deadline.tv_sec + deadline.tv_nsec / 1e9 + self->interval;
+        deadline.tv_sec = (time_t) wake;
+        deadline.tv_nsec = (long) ((wake - deadline.tv_sec) * 1e9);
+        
+        pthread_cond_timedwait(&self->cond, &self->mutex, &deadline);
+        
+        if (self->stopping)
+        {
+            break;
+        }
+        
+        pthread_mutex_unlock(&self->mutex);
+        for (i=0; i<self->nreplicas; i++)
+        {
+            replicated_probe(self, &self->replicas[i]);
+        }
+        pthread_mutex_lock(&self->mutex);
+    }
+    
+    pthread_mutex_unlock(&self->mutex);
+    
+    return NULL;
+}
+
+
+/*
+ * Pick the healthy replica with the fewest outstanding requests, other than
+ * `exclude`, and count the new one against it. Ties rotate so that idle
+ * replicas share the load. Returns -1 if no replica is healthy.
+ */
+static int
+replicated_pick(ReplicatedTyrant *self, int exclude)
+{
+    int i, j, best = -1;
+    
+    if (self->nreplicas == 0)
+    {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&self->mutex);
+    
+    for (j=0; j<self->nreplicas; j++)
+    {
+        i = (self->next + j) % self->nreplicas;
+        
+        if (i != exclude && self->replicas[i].healthy &&
+            (best < 0 || self->replicas[i].outstanding < self->replicas[best].outstanding))
+        {
+            best = i;
+        }
+    }
+    
+    if (best >= 0)
+    {
+        self->replicas[best].outstanding++;
+        self->next = (best + 1) % self->nreplicas;
+    }
+    
+    pthread_mutex_unlock(&self->mutex);
+    
+    return best;
+}
+
+
+/*
+ * Hedged reads. The read goes to one replica; if it has not answered once
+ * the tracked latency percentile has passed, the same read goes to a second
+ * replica, or to the master if there is no other healthy replica. The
+ * first answer wins; the other attempt is left to finish on its own thread,
+ * which then gives its connection back to the pool. Hedges for slow
+ * reads draw on a token bucket refilled by max_rate per read, so they add
+ * at most that fraction of load; a read that fails outright is always
+ * retried.
+ */
+typedef struct TyrantHedgeRace TyrantHedgeRace;
+
+
+typedef struct
+{
+    ReplicatedTyrant *db;
+    TyrantHedgeRace *race;
+    TyrantPool *pool;
+    int replica;
+    int slot;
+    bool started;
+    bool done;
+    bool cancelled;
+    char *vbuf;
+    int vsiz;
+    int ecode;
+    double latency;
+} TyrantHedgeAttempt;
+
+
+/*
+ * State shared by the attempts of one read, including a copy of the key. A
+ * losing attempt may still be running when the read returns, so this is
+ * freed by whichever of the reader and the attempt threads lets go last.
+ */
+struct TyrantHedgeRace
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int refs;
+    char *kbuf;
+    int ksiz;
+    TyrantHedgeAttempt attempts[2];
+};
+
+
+static int
+hedge_compare(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    
+    return x < y ? -1 : x > y;
+}
+
+
+/*
+ * Add the latency of a completed read and every HEDGE_RECOMPUTE samples
+ * move the hedge delay to the configured percentile of the recent ones.
+ * Must be called with the client mutex held.
+ */
+static void
+hedge_record(ReplicatedTyrant *self, double latency)
+{
+    double sorted[HEDGE_SAMPLES];
+    int n;
+    
+    self->hedge_samples[self->hedge_count++ % HEDGE_SAMPLES] = latency;
+    
+    if (self->hedge_count < HEDGE_MIN_SAMPLES || self->hedge_count % HEDGE_RECOMPUTE)
+    {
+        return;
+    }
+    
+    n = self->hedge_count < HEDGE_SAMPLES ? (int) self->hedge_count : HEDGE_SAMPLES;
+    memcpy(sorted, self->hedge_samples, sizeof(double) * n);
+    qsort(sorted, n, sizeof(double), hedge_compare);
+    
+    self->hedge_delay = sorted[(int) (self->hedge_percentile / 100 * (n - 1))];
+    if (self->hedge_delay < self->hedge_min_delay)
+    {
+        self->hedge_delay = self->hedge_min_delay;
+    }
+}
+
+
+static bool
+hedge_ecode_final(int ecode)
+{
+    return ecode == TTESUCCESS || ecode == TTENOREC;
+}
+
+
+static void
+hedge_race_release(TyrantHedgeRace *race)
+{
+    bool last;
+    
+    pthread_mutex_lock(&race->mutex);
+    last = --race->refs == 0;
+    pthread_mutex_unlock(&race->mutex);
+    
+    if (last)
+    {
+        pthread_cond_destroy(&race->cond);
+        pthread_mutex_destroy(&race->mutex);
+        free(race->kbuf);
+        free(race);
+    }
+}
+
+
+/*
+ * Give back the connection of a finished attempt and account for it. The
+ * reader does this for attempts that finished before a winner was chosen;
+ * a cancelled attempt does it on its own thread once its call returns.
+ */
+static void
+hedge_attempt_finish(TyrantHedgeAttempt *attempt)
+{
+    ReplicatedTyrant *self = attempt->db;
+    bool healthy = tyrant_ecode_healthy(attempt->ecode);
+    
+    if (attempt->started)
+    {
+        tyrantpool_release(attempt->pool, attempt->slot, healthy);
+    }
+    
+    pthread_mutex_lock(&self->mutex);
+    if (attempt->replica >= 0)
+    {
+        self->replicas[attempt->replica].outstanding--;
+        if (!healthy)
+        {
+            self->replicas[attempt->replica].healthy = false;
+        }
+    }
+    if (hedge_ecode_final(attempt->ecode))
+    {
+        hedge_record(self, attempt->latency);
+    }
+    if (attempt->cancelled)
+    {
+        self->hedge_running--;
+        pthread_cond_broadcast(&self->hedge_cond);
+    }
+    pthread_mutex_unlock(&self->mutex);
+}
+
+
+static void
+hedge_attempt_run(TyrantHedgeAttempt *attempt)
+{
+    TyrantHedgeRace *race = attempt->race;
+    TCRDB *db = attempt->pool->slots[attempt->slot].conn->db;
+    double start = metrics_now();
+    char *vbuf;
+    int vsiz = 0, ecode;
+    bool cancelled;
+    
+    vbuf = tcrdbget(db, race->kbuf, race->ksiz, &vsiz);
+    ecode = vbuf ? TTESUCCESS : tcrdbecode(db);
+    
+    pthread_mutex_lock(&race->mutex);
+    attempt->vbuf = vbuf;
+    attempt->vsiz = vsiz;
+    attempt->ecode = ecode;
+    attempt->latency = metrics_now() - start;
+    attempt->done = true;
+    cancelled = attempt->cancelled;
+    pthread_cond_signal(&race->cond);
+    pthread_mutex_unlock(&race->mutex);
+    
+    /* The reader has already returned another answer. */
+    if (cancelled)
+    {
+        hedge_attempt_finish(attempt);
+        free(attempt->vbuf);
+        attempt->vbuf = NULL;
+    }
+}
+
+
+static void *
+hedge_attempt_thread(void *arg)
+{
+    TyrantHedgeAttempt *attempt = arg;
+    
+    hedge_attempt_run(attempt);
+    hedge_race_release(attempt->race);
+    
+    return NULL;
+}
+
+
+static void
+hedge_attempt_start(TyrantHedgeAttempt *attempt)
+{
+    int ecode = TTESUCCESS;
+    pthread_t thread;
+    TyrantHedgeRace *race = attempt->race;
+    
+    attempt->slot = tyrantpool_acquire(attempt->pool, &ecode);
+    
+    if (attempt->slot < 0)
+    {
+        pthread_mutex_lock(&race->mutex);
+        attempt->ecode = ecode;
+        attempt->done = true;
+        pthread_mutex_unlock(&race->mutex);
+        return;
+    }
+    
+    attempt->started = true;
+    
+    pthread_mutex_lock(&race->mutex);
+    race->refs++;
+    pthread_mutex_unlock(&race->mutex);
+    
+    if (pthread_create(&thread, NULL, hedge_attempt_thread, attempt) == 0)
+    {
+        pthread_detach(thread);
+        return;
+    }
+    
+    pthread_mutex_lock(&race->mutex);
+    race->refs--;
+    pthread_mutex_unlock(&race->mutex);
+    
+    hedge_attempt_run(attempt);
+}
+
+
+/*
+ * Decide whether to send the second attempt. A failed first attempt is
+ * always retried; a slow one only if the bucket holds a token. Must be
+ * called without the GIL.
+ */
+static bool
+hedge_admit(ReplicatedTyrant *self, TyrantHedgeAttempt *first, TyrantHedgeAttempt *second,
+    bool failed)
+{
+    bool admit;
+    
+    pthread_mutex_lock(&self->mutex);
+    admit = failed || self->hedge_tokens >= 1;
+    pthread_mutex_unlock(&self->mutex);
+    
+    if (!admit)
+    {
+        return false;
+    }
+    
+    second->replica = replicated_pick(self, first->replica);
+    second->pool = second->replica >= 0 ? self->replicas[second->replica].pool : self->master;
+    
+    /* Hedging to the master is pointless if the master took the first read. */
+    if (second->replica < 0 && first->replica < 0)
+    {
+        return false;
+    }
+    
+    if (!failed)
+    {
+        pthread_mutex_lock(&self->mutex);
+        self->hedge_tokens -= 1;
+        pthread_mutex_unlock(&self->mutex);
+    }
+    
+    return true;
+}
+
+
+/*
+ * Run a hedged get of `kbuf`. Returns the error code of the winning
+ * attempt and on success its value in `vbuf`, which the caller frees.
+ * Must be called without the GIL.
+ */
+static int
+replicated_hedge(ReplicatedTyrant *self, const char *kbuf, int ksiz, char **vbuf, int *vsiz)
+{
+    TyrantHedgeRace *race;
+    TyrantHedgeAttempt *attempts;
+    struct timespec deadline;
+    double delay, wake;
+    bool timedout = false;
+    int i, ecode, winner = -1, nstarted = 1;
+    
+    race = calloc(1, sizeof(TyrantHedgeRace));
+    
+    if (!race || !(race->kbuf = malloc(ksiz > 0 ? ksiz : 1)))
+    {
+        free(race);
+        return TTEMISC;
+    }
+    
+    memcpy(race->kbuf, kbuf, ksiz);
+    race->ksiz = ksiz;
+    race->refs = 1;
+    pthread_mutex_init(&race->mutex, NULL);
+    pthread_cond_init(&race->cond, NULL);
+    attempts = race->attempts;
+    
+    for (i=0; i<2; i++)
+    {
+        attempts[i].db = self;
+        attempts[i].race = race;
+        attempts[i].replica = -1;
+    }
+    
+    attempts[0].replica = replicated_pick(self, -1);
+    attempts[0].pool = attempts[0].replica >= 0 ?
+        self->replicas[attempts[0].replica].pool : self->master;
+    
+    pthread_mutex_lock(&self->mutex);
+    self->hedge_reads++;
+    self->hedge_tokens += self->hedge_rate;
+    if (self->hedge_tokens > HEDGE_BURST)
+    {
+        self->hedge_tokens = HEDGE_BURST;
+    }
+    delay = self->hedge_count >= HEDGE_MIN_SAMPLES ? self->hedge_delay : 0;
+    pthread_mutex_unlock(&self->mutex);
+    
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    wake = deadline.tv_sec + deadline.tv_nsec / 1e9 + delay;
+    deadline.tv_sec = (time_t) wake;
+    deadline.tv_nsec = (long) ((wake - deadline.tv_sec) * 1e9);
+    
+    hedge_attempt_start(&attempts[0]);
+    
+    pthread_mutex_lock(&race->mutex);
+    
+    for (;;)
+    {
+        for (i=0; i<nstarted && winner < 0; i++)
+        {
+            if (attempts[i].done && hedge_ecode_final(attempts[i].ecode))
+            {
+                winner = i;
+            }
+        }
+        
+        if (winner >= 0)
+        {
+            break;
+        }
+        
+        if (nstarted == 2 && attempts[0].done && attempts[1].done)
+        {
+            winner = 0;
+            break;
+        }
+        
+        if (nstarted == 1 && (attempts[0].done || timedout))
+        {
+            pthread_mutex_unlock(&race->mutex);
+            
+            if (hedge_admit(self, &attempts[0], &attempts[1], attempts[0].done))
+            {
+                hedge_attempt_start(&attempts[1]);
+                nstarted = 2;
+            }
+            else
+            {
+                delay = 0;
+            }
+            
+            pthread_mutex_lock(&race->mutex);
+            timedout = false;
+            
+            if (nstarted == 1 && attempts[0].done)
+            {
+                winner = 0;
+                break;
+            }
+            continue;
+        }
+        
+        if (nstarted == 1 && delay > 0)
+        {
+            timedout = pthread_cond_timedwait(&race->cond, &race->mutex, &deadline) == ETIMEDOUT;
+        }
+        else
+        {
+            pthread_cond_wait(&race->cond, &race->mutex);
+        }
+    }
+    
+    /* A loser still on the wire is not interrupted; its thread cleans up
+       after the call returns, and dealloc waits for it. */
+    for (i=0; i<nstarted; i++)
+    {
+        if (attempts[i].started && !attempts[i].done)
+        {
+            pthread_mutex_lock(&self->mutex);
+            self->hedge_running++;
+            pthread_mutex_unlock(&self->mutex);
+            attempts[i].cancelled = true;
+        }
+    }
+    
+    pthread_mutex_unlock(&race->mutex);
+    
+    for (i=0; i<nstarted; i++)
+    {
+        if (!attempts[i].cancelled)
+        {
+            hedge_attempt_finish(&attempts[i]);
+            
+            if (i != winner)
+            {
+                free(attempts[i].vbuf);
+            }
+        }
+    }
+    
+    pthread_mutex_lock(&self->mutex);
+    self->hedge_sent += nstarted - 1;
+    self->hedge_wins += winner == 1;
+    pthread_mutex_unlock(&self->mutex);
+    
+    *vbuf = attempts[winner].vbuf;
+    *vsiz = attempts[winner].vsiz;
+    ecode = attempts[winner].ecode;
+    
+    hedge_race_release(race);
+    
+    return ecode;
+}
+
+
+static PyObject *
+replicated_hedged_read(ReplicatedTyrant *self, const char *name, PyObject *args,
+    PyObject *kwargs)
+{
+    char *kbuf, *vbuf;
+    int ksiz, vsiz, ecode;
+    bool table, item;
+    PyObject *extra = NULL, *value;
+    
+    static char *get_kwlist[] = {"key", "default", NULL};
+    static char *tbl_kwlist[] = {"key", "schema", NULL};
+    
+    table = !strcmp(name, "tblget");
+    item = !strcmp(name, "__getitem__");
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, item ? "s#:__getitem__" : "s#|O:get",
+        table ? tbl_kwlist : get_kwlist, &kbuf, &ksiz, &extra))
+    {
+        return NULL;
+    }
+    
+    if (table && extra && pyschema_check(extra) != 0)
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    ecode = replicated_hedge(self, kbuf, ksiz, &vbuf, &vsiz);
+    Py_END_ALLOW_THREADS
+    
+    if (ecode != TTESUCCESS)
+    {
+        /* Raise what Tyrant_subscript raises on the unhedged path. */
+        if (item)
+        {
+            PyErr_SetString(TyrantError, tcrdberrmsg(ecode));
+            return NULL;
+        }
+        if (!table && extra)
+        {
+            Py_INCREF(extra);
+            return extra;
+        }
+        Py_RETURN_NONE;
+    }
+    
+    if (table)
+    {
+        value = pycols2pydict(vbuf, vsiz, extra != Py_None ? extra : NULL);
+    }
+    else
+    {
+        value = PyString_FromStringAndSize(vbuf, vsiz);
+    }
+    free(vbuf);
+    
+    return value;
+}
+
+
+static PyObject *
+replicated_forward(ReplicatedTyrant *self, PyObject *name, PyObject *args,
+    PyObject *kwargs, bool read)
+{
+    int replica;
+    bool healthy;
+    PyObject *result;
+    
+    if (read && self->hedging && (!strcmp(PyString_AS_STRING(name), "get") ||
+        !strcmp(PyString_AS_STRING(name), "tblget") ||
+        !strcmp(PyString_AS_STRING(name), "__getitem__")))
+    {
+        return replicated_hedged_read(self, PyString_AS_STRING(name), args, kwargs);
+    }
+    
+    replica = read ? replicated_pick(self, -1) : -1;
+    
+    if (replica < 0)
+    {
+        return tyrantpool_forward(self->master, name, args, kwargs);
+    }
+    
+    result = tyrantpool_call(self->replicas[replica].pool, name, args, kwargs, &healthy);
+    
+    pthread_mutex_lock(&self->mutex);
+    self->replicas[replica].outstanding--;
+    if (!healthy)
+    {
+        self->replicas[replica].healthy = false;
+    }
+    pthread_mutex_unlock(&self->mutex);
+    
+    /* A replica that dropped out is skipped until the prober sees it again. */
+    if (!result && !healthy)
+    {
+        PyErr_Clear();
+        return tyrantpool_forward(self->master, name, args, kwargs);
+    }
+    
+    return result;
+}
+
+
+static PyObject *
+replicated_forward2(ReplicatedTyrant *self, const char *name, PyObject *args)
+{
+    PyObject *pyname, *result;
+    
+    pyname = PyString_FromString(name);
+    
+    if (!pyname)
+    {
+        return NULL;
+    }
+    
+    result = replicated_forward(self, pyname, args, NULL, replicated_is_read(name));
+    Py_DECREF(pyname);
+    
+    return result;
+}
+
+
+static void
+ReplicatedTyrantMethod_dealloc(ReplicatedTyrantMethod *self)
+{
+    Py_XDECREF(self->db);
+    Py_XDECREF(self->name);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+ReplicatedTyrantMethod_call(ReplicatedTyrantMethod *self, PyObject *args, PyObject *kwargs)
+{
+    return replicated_forward(self->db, self->name, args, kwargs, self->read);
+}
+
+
+static PyTypeObject ReplicatedTyrantMethodType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.ReplicatedTyrantMethod", /* tp_name */
+  sizeof(ReplicatedTyrantMethod),              /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)ReplicatedTyrantMethod_dealloc,  /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  (ternaryfunc)ReplicatedTyrantMethod_call,    /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Tyrant method routed by a replicated client", /* tp_doc */
+};
+
+
+static void
+ReplicatedTyrant_dealloc(ReplicatedTyrant *self)
+{
+    int i;
+    
+    if (self->probing)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&self->mutex);
+        self->stopping = true;
+        pthread_cond_signal(&self->cond);
+        pthread_mutex_unlock(&self->mutex);
+        pthread_join(self->prober, NULL);
+        Py_END_ALLOW_THREADS
+    }
+    
+    /* Losing hedge attempts still hold pooled connections. */
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->mutex);
+    while (self->hedge_running > 0)
+    {
+        pthread_cond_wait(&self->hedge_cond, &self->mutex);
+    }
+    pthread_mutex_unlock(&self->mutex);
+    Py_END_ALLOW_THREADS
+    
+    if (self->replicas)
+    {
+        for (i=0; i<self->nreplicas; i++)
+        {
+            if (self->replicas[i].probe)
+            {
+                Py_BEGIN_ALLOW_THREADS
+                tcrdbdel(self->replicas[i].probe);
+                Py_END_ALLOW_THREADS
+            }
+            Py_XDECREF(self->replicas[i].pool);
+        }
+        free(self->replicas);
+    }
+    
+    pthread_mutex_destroy(&self->mutex);
+    pthread_cond_destroy(&self->cond);
+    pthread_cond_destroy(&self->hedge_cond);
+    Py_XDECREF(self->master);
+    self->ob_type->tp_free(self);
+}
+
+
+static TyrantPool *
+replicated_pool(PyObject *node, int size, double timeout)
+{
+    const char *host;
+    int port;
+    
+    if (!PyArg_ParseTuple(node, "si;Expected (host, port) pairs.", &host, &port))
+    {
+        return NULL;
+    }
+    
+    return (TyrantPool *) PyObject_CallFunction((PyObject *) &TyrantPoolType,
+        "siid", host, port, size, timeout);
+}
+
+
+static PyObject *
+ReplicatedTyrant_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    ReplicatedTyrant *self;
+    PyObject *pymaster, *pyreplicas = NULL, *seq;
+    int i, size = 0;
+    double timeout = 0.0, max_delay = 5.0, interval = 1.0;
+    
+    static char *kwlist[] = {"master", "replicas", "size", "timeout", "max_delay",
+        "interval", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Oiddd:ReplicatedTyrant", kwlist,
+        &pymaster, &pyreplicas, &size, &timeout, &max_delay, &interval))
+    {
+        return NULL;
+    }
+    
+    if (interval <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "interval must be positive.");
+        return NULL;
+    }
+    
+    self = (ReplicatedTyrant *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate ReplicatedTyrant instance.");
+        return NULL;
+    }
+    
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    pthread_cond_init(&self->hedge_cond, NULL);
+    self->timeout = timeout;
+    self->max_delay = max_delay;
+    self->interval = interval;
+    self->master = replicated_pool(pymaster, size, timeout);
+    
+    if (!self->master)
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    
+    if (!pyreplicas)
+    {
+        return (PyObject *) self;
+    }
+    
+    seq = PySequence_Fast(pyreplicas, "replicas must be a sequence of (host, port) pairs.");
+    
+    if (!seq)
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    
+    self->replicas = calloc(PySequence_Fast_GET_SIZE(seq) + 1, sizeof(TyrantReplica));
+    
+    if (!self->replicas)
+    {
+        Py_DECREF(seq);
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate replica list.");
+        return NULL;
+    }
+    
+    for (i=0; i<PySequence_Fast_GET_SIZE(seq); i++)
+    {
+        self->replicas[i].pool = replicated_pool(PySequence_Fast_GET_ITEM(seq, i), size, timeout);
+        
+        if (!self->replicas[i].pool)
+        {
+            break;
+        }
+        
+        /* Counted first so that dealloc releases the pool on failure. */
+        self->nreplicas++;
+        self->replicas[i].probe = tcrdbnew();
+        
+        if (!self->replicas[i].probe)
+        {
+            PyErr_SetString(PyExc_MemoryError, "Cannot allocate replica probe.");
+            break;
+        }
+    }
+    
+    Py_DECREF(seq);
+    
+    if (PyErr_Occurred())
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    
+    if (self->nreplicas == 0)
+    {
+        return (PyObject *) self;
+    }
+    
+    /* Probe once up front so that reads are spread from the first call. */
+    Py_BEGIN_ALLOW_THREADS
+    for (i=0; i<self->nreplicas; i++)
+    {
+        replicated_probe(self, &self->replicas[i]);
+    }
+    self->probing = pthread_create(&self->prober, NULL, replicated_prober, self) == 0;
+    Py_END_ALLOW_THREADS
+    
+    if (!self->probing)
+    {
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_RuntimeError, "Cannot start replica prober thread.");
+        return NULL;
+    }
+    
+    return (PyObject *) self;
+}
+
+
+static PyObject *
+ReplicatedTyrant_getattro(ReplicatedTyrant *self, PyObject *name)
+{
+    PyObject *attr;
+    ReplicatedTyrantMethod *method;
+    
+    attr = PyObject_GenericGetAttr((PyObject *) self, name);
+    
+    if (attr || !PyErr_ExceptionMatches(PyExc_AttributeError))
+    {
+        return attr;
+    }
+    
+    PyErr_Clear();
+    
+    if (!tyrant_forwardable((PyObject *) self, name))
+    {
+        return NULL;
+    }
+    
+    method = PyObject_New(ReplicatedTyrantMethod, &ReplicatedTyrantMethodType);
+    
+    if (!method)
+    {
+        return NULL;
+    }
+    
+    Py_INCREF(self);
+    method->db = self;
+    Py_INCREF(name);
+    method->name = name;
+    method->read = replicated_is_read(PyString_AS_STRING(name));
+    
+    return (PyObject *) method;
+}
+
+
+static PyObject *
+ReplicatedTyrant_close(ReplicatedTyrant *self)
+{
+    int i;
+    PyObject *result;
+    
+    for (i=0; i<self->nreplicas; i++)
+    {
+        result = TyrantPool_close(self->replicas[i].pool);
+        Py_XDECREF(result);
+    }
+    
+    return TyrantPool_close(self->master);
+}
+
+
+static PyObject *
+ReplicatedTyrant_replicas(ReplicatedTyrant *self)
+{
+    int i;
+    PyObject *pyreplicas, *pyreplica;
+    TyrantReplica *replica;
+    
+    pyreplicas = PyList_New(self->nreplicas);
+    
+    if (!pyreplicas)
+    {
+        return NULL;
+    }
+    
+    for (i=0; i<self->nreplicas; i++)
+    {
+        replica = &self->replicas[i];
+        
+        pthread_mutex_lock(&self->mutex);
+        pyreplica = Py_BuildValue("{s:s,s:i,s:O,s:d,s:i}",
+            "host", replica->pool->host,
+            "port", replica->pool->port,
+            "healthy", replica->healthy ? Py_True : Py_False,
+            "delay", replica->delay,
+            "outstanding", replica->outstanding);
+        pthread_mutex_unlock(&self->mutex);
+        
+        if (!pyreplica)
+        {
+            Py_DECREF(pyreplicas);
+            return NULL;
+        }
+        
+        PyList_SET_ITEM(pyreplicas, i, pyreplica);
+    }
+    
+    return pyreplicas;
+}
+
+
+static PyObject *
+ReplicatedTyrant_enable_hedging(ReplicatedTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    double percentile = 95.0, max_rate = 0.05, min_delay = 0.0;
+    
+    static char *kwlist[] = {"percentile", "max_rate", "min_delay", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|ddd:enable_hedging", kwlist,
+        &percentile, &max_rate, &min_delay))
+    {
+        return NULL;
+    }
+    
+    if (percentile <= 0 || percentile > 100 || max_rate < 0 || min_delay < 0)
+    {
+        PyErr_SetString(PyExc_ValueError,
+            "percentile must be in (0, 100] and max_rate and min_delay must not be negative.");
+        return NULL;
+    }
+    
+    if (self->nreplicas == 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Hedged reads need at least one replica.");
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&self->mutex);
+    self->hedge_percentile = percentile;
+    self->hedge_rate = max_rate;
+    self->hedge_min_delay = min_delay;
+    self->hedge_delay = min_delay;
+    self->hedge_tokens = 0;
+    self->hedge_count = 0;
+    self->hedging = true;
+    pthread_mutex_unlock(&self->mutex);
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ReplicatedTyrant_disable_hedging(ReplicatedTyrant *self)
+{
+    self->hedging = false;
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ReplicatedTyrant_hedge_stats(ReplicatedTyrant *self)
+{
+    PyObject *stats;
+    
+    pthread_mutex_lock(&self->mutex);
+    stats = Py_BuildValue("{s:K,s:K,s:K,s:d}",
+        "reads", (unsigned PY_LONG_LONG) self->hedge_reads,
+        "hedged", (unsigned PY_LONG_LONG) self->hedge_sent,
+        "hedge_wins", (unsigned PY_LONG_LONG) self->hedge_wins,
+        "delay", self->hedge_delay);
+    pthread_mutex_unlock(&self->mutex);
+    
+    return stats;
+}
+
+
+static Py_ssize_t
+ReplicatedTyrant_length(ReplicatedTyrant *self)
+{
+    PyObject *args, *result;
+    Py_ssize_t n;
+    
+    args = PyTuple_New(0);
+    if (!args)
+    {
+        return -1;
+    }
+    
+    result = replicated_forward2(self, "__len__", args);
+    Py_DECREF(args);
+    
+    if (!result)
+    {
+        return -1;
+    }
+    
+    n = PyInt_AsSsize_t(result);
+    Py_DECREF(result);
+    
+    return n;
+}
+
+
+static PyObject *
+ReplicatedTyrant_subscript(ReplicatedTyrant *self, PyObject *key)
+{
+    PyObject *args, *result;
+    
+    args = PyTuple_Pack(1, key);
+    if (!args)
+    {
+        return NULL;
+    }
+    
+    result = replicated_forward2(self, "__getitem__", args);
+    Py_DECREF(args);
+    
+    return result;
+}
+
+
+static int
+ReplicatedTyrant_ass_subscript(ReplicatedTyrant *self, PyObject *key, PyObject *value)
+{
+    PyObject *args, *result;
+    
+    if (!value)
+    {
+        PyErr_SetString(PyExc_TypeError, "Use out() to remove records.");
+        return -1;
+    }
+    
+    args = PyTuple_Pack(2, key, value);
+    if (!args)
+    {
+        return -1;
+    }
+    
+    result = replicated_forward2(self, "__setitem__", args);
+    Py_DECREF(args);
+    
+    if (!result)
+    {
+        return -1;
+    }
+    
+    Py_DECREF(result);
+    return 0;
+}
+
+
+static PyMappingMethods ReplicatedTyrant_as_mapping = 
+{
+    (lenfunc) ReplicatedTyrant_length,
+    (binaryfunc) ReplicatedTyrant_subscript,
+    (objobjargproc) ReplicatedTyrant_ass_subscript
+};
+
+
+static int
+ReplicatedTyrant_contains(ReplicatedTyrant *self, PyObject *value)
+{
+    PyObject *args, *result;
+    int found;
+    
+    args = PyTuple_Pack(1, value);
+    if (!args)
+    {
+        return -1;
+    }
+    
+    result = replicated_forward2(self, "__contains__", args);
+    Py_DECREF(args);
+    
+    if (!result)
+    {
+        return -1;
+    }
+    
+    found = PyObject_IsTrue(result);
+    Py_DECREF(result);
+    
+    return found;
+}
+
+
+static PySequenceMethods ReplicatedTyrant_as_sequence = 
+{
+    0,                                       /* sq_length */
+    0,                                       /* sq_concat */
+    0,                                       /* sq_repeat */
+    0,                                       /* sq_item */
+    0,                                       /* sq_slice */
+    0,                                       /* sq_ass_item */
+    0,                                       /* sq_ass_slice */
+    (objobjproc) ReplicatedTyrant_contains,  /* sq_contains */
+    0,                                       /* sq_inplace_concat */
+    0                                        /* sq_inplace_repeat */
+};
+
+
+static PyMethodDef ReplicatedTyrant_methods[] = 
+{
+    {
+        "close", (PyCFunction) ReplicatedTyrant_close,
+        METH_NOARGS,
+        "Close every idle connection to the master and the replicas. They reopen on next use."
+    },
+    
+    {
+        "replicas", (PyCFunction) ReplicatedTyrant_replicas,
+        METH_NOARGS,
+        "Get the host, port, health, replication delay and outstanding request count of each replica."
+    },
+    
+    {
+        "enable_hedging", (PyCFunction) ReplicatedTyrant_enable_hedging,
+        METH_VARARGS | METH_KEYWORDS,
+        "Resend get and tblget to a second node when the first has not answered within the given latency percentile, for at most max_rate of reads."
+    },
+    
+    {
+        "disable_hedging", (PyCFunction) ReplicatedTyrant_disable_hedging,
+        METH_NOARGS,
+        "Send each read to a single node again."
+    },
+    
+    {
+        "hedge_stats", (PyCFunction) ReplicatedTyrant_hedge_stats,
+        METH_NOARGS,
+        "Get the number of hedgeable reads, of hedges sent and won, and the current hedge delay."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject ReplicatedTyrantType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.ReplicatedTyrant",      /* tp_name */
+  sizeof(ReplicatedTyrant),                    /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)ReplicatedTyrant_dealloc,        /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  &ReplicatedTyrant_as_sequence,               /* tp_as_sequence */
+  &ReplicatedTyrant_as_mapping,                /* tp_as_mapping */
+  Tyrant_Hash,                                 /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  (getattrofunc)ReplicatedTyrant_getattro,     /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
+  "Tyrant master with replicas that serve reads", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  0,                                           /* tp_iter */
+  0,                                           /* tp_iternext */
+  ReplicatedTyrant_methods,                    /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  ReplicatedTyrant_new,                        /* tp_new */
+};
+
+
+/*
+ * An in-process database opened through the abstract database API of Tokyo
+ * Cabinet, the same layer ttserver serves from. The path takes the suffix
+ * and tuning parameters ttserver accepts, e.g. "casket.tct#idx=name:lex", so
+ * hash, B+ tree and table files are all supported. Table records go through
+ * the misc functions ttserver uses for them, and PreparedQuery runs its
+ * searches here unchanged.
+ */
+typedef struct
+{
+    PyObject_HEAD
+    TCADB *db;
+    bool open;
+    bool iterating;
+} LocalTyrant;
+
+
+static PyTypeObject LocalTyrantType;
+
+
+static bool
+local_ready(LocalTyrant *self)
+{
+    if (!self->open)
+    {
+        PyErr_SetString(TyrantError, "The database is not open.");
+        return false;
+    }
+    
+    return true;
+}
+
+
+/*
+ * Call a misc function of the database. The abstract API reports no error
+ * codes, so a failed call is raised with `ecode`.
+ */
+static TCLIST *
+local_misc(LocalTyrant *self, const char *name, const TCLIST *args, int ecode)
+{
+    TCLIST *results;
+    
+    Py_BEGIN_ALLOW_THREADS
+    results = tcadbmisc(self->db, name, args);
+    Py_END_ALLOW_THREADS
+    
+    if (!results)
+    {
+        raise_tyrant_code(ecode);
+    }
+    
+    return results;
+}
+
+
+static void
+LocalTyrant_dealloc(LocalTyrant *self)
+{
+    if (self->db)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        tcadbdel(self->db);
+        Py_END_ALLOW_THREADS
+    }
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+LocalTyrant_open(LocalTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    bool success;
+    const char *path;
+    
+    static char *kwlist[] = {"path", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s:open", kwlist, &path))
+    {
+        return NULL;
+    }
+    
+    if (self->open)
+    {
+        PyErr_SetString(TyrantError, "The database is already open.");
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbopen(self->db, path);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        PyErr_Format(TyrantError, "Cannot open database %s.", path);
+        return NULL;
+    }
+    
+    self->open = true;
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    LocalTyrant *self;
+    PyObject *result;
+    
+    self = (LocalTyrant *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate LocalTyrant instance.");
+        return NULL;
+    }
+    
+    self->db = tcadbnew();
+    
+    if (PyTuple_GET_SIZE(args) || (kwargs && PyDict_Size(kwargs)))
+    {
+        result = LocalTyrant_open(self, args, kwargs);
+        
+        if (!result)
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
+        
+        Py_DECREF(result);
+    }
+    
+    return (PyObject *) self;
+}
+
+
+static PyObject *
+LocalTyrant_close(LocalTyrant *self)
+{
+    bool success;
+    
+    if (!local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbclose(self->db);
+    Py_END_ALLOW_THREADS
+    
+    self->open = false;
+    
+    if (!success)
+    {
+        raise_tyrant_code(TTEMISC);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+typedef bool (*local_put_func)(TCADB *, const void *, int, const void *, int);
+
+
+static PyObject *
+local_put(LocalTyrant *self, PyObject *args, const char *format, local_put_func func,
+    int ecode)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    Py_buffer value;
+    
+    if (!PyArg_ParseTuple(args, format, &kbuf, &ksiz, &value))
+    {
+        return NULL;
+    }
+    
+    if (!local_ready(self))
+    {
+        PyBuffer_Release(&value);
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = func(self->db, kbuf, ksiz, value.buf, (int) value.len);
+    Py_END_ALLOW_THREADS
+    
+    PyBuffer_Release(&value);
+    
+    if (!success)
+    {
+        raise_tyrant_code(ecode);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_put(LocalTyrant *self, PyObject *args)
+{
+    return local_put(self, args, "s#s*:put", tcadbput, TTEMISC);
+}
+
+
+static PyObject *
+LocalTyrant_putkeep(LocalTyrant *self, PyObject *args)
+{
+    return local_put(self, args, "s#s*:putkeep", tcadbputkeep, TTEKEEP);
+}
+
+
+static PyObject *
+LocalTyrant_putcat(LocalTyrant *self, PyObject *args)
+{
+    return local_put(self, args, "s#s*:putcat", tcadbputcat, TTEMISC);
+}
+
+
+static PyObject *
+LocalTyrant_out(LocalTyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    
+    if (!PyArg_ParseTuple(args, "s#:out", &kbuf, &ksiz) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbout(self->db, kbuf, ksiz);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        raise_tyrant_code(TTENOREC);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_putlist(LocalTyrant *self, PyObject *args)
+{
+    TCLIST *list, *results;
+    PyObject *items;
+    
+    if (!PyArg_ParseTuple(args, "O:putlist", &items) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    list = pyitems2tclist(items);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    results = local_misc(self, "putlist", list, TTEMISC);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    tclistdel(results);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_outlist(LocalTyrant *self, PyObject *args)
+{
+    TCLIST *list, *results;
+    PyObject *keys;
+    
+    if (!PyArg_ParseTuple(args, "O:outlist", &keys) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    list = pystrings2tclist(keys);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    results = local_misc(self, "outlist", list, TTEMISC);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    tclistdel(results);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_get(LocalTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    char *kbuf, *vbuf;
+    int ksiz, vsiz;
+    PyObject *default_value = NULL, *value;
+    
+    static char *kwlist[] = {"key", "default", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|O:get", kwlist, &kbuf, &ksiz,
+        &default_value) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    vbuf = tcadbget(self->db, kbuf, ksiz, &vsiz);
+    Py_END_ALLOW_THREADS
+    
+    if (!vbuf)
+    {
+        if (default_value)
+        {
+            Py_INCREF(default_value);
+            return default_value;
+        }
+        Py_RETURN_NONE;
+    }
+    
+    value = PyString_FromStringAndSize(vbuf, vsiz);
+    free(vbuf);
+    
+    return value;
+}
+
+
+static PyObject *
+LocalTyrant_mget(LocalTyrant *self, PyObject *args)
+{
+    int i, ksiz, vsiz;
+    const char *kbuf, *vbuf;
+    TCLIST *list, *results;
+    PyObject *keys, *dict, *key, *value;
+    
+    if (!PyArg_ParseTuple(args, "O:mget", &keys) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    list = pystrings2tclist(keys);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    results = local_misc(self, "getlist", list, TTEMISC);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    dict = _PyDict_NewPresized(tclistnum(results) / 2);
+    
+    for (i=0; dict && i+1<tclistnum(results); i+=2)
+    {
+        kbuf = tclistval(results, i, &ksiz);
+        vbuf = tclistval(results, i + 1, &vsiz);
+        key = PyString_FromStringAndSize(kbuf, ksiz);
+        value = PyString_FromStringAndSize(vbuf, vsiz);
+        
+        if (!key || !value || PyDict_SetItem(dict, key, value) != 0)
+        {
+            Py_CLEAR(dict);
+        }
+        
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+    }
+    
+    tclistdel(results);
+    
+    return dict;
+}
+
+
+static PyObject *
+LocalTyrant_vsiz(LocalTyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz, vsiz;
+    
+    if (!PyArg_ParseTuple(args, "s#:vsiz", &kbuf, &ksiz) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    vsiz = tcadbvsiz(self->db, kbuf, ksiz);
+    Py_END_ALLOW_THREADS
+    
+    return Py_BuildValue("i", vsiz);
+}
+
+
+static PyObject *
+LocalTyrant_fwmkeys(LocalTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    char *pbuf;
+    int psiz, max = -1;
+    TCLIST *list;
+    PyObject *pylist;
+    
+    static char *kwlist[] = {"prefix", "max", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|i:fwmkeys", kwlist,
+        &pbuf, &psiz, &max) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    list = tcadbfwmkeys(self->db, pbuf, psiz, max);
+    Py_END_ALLOW_THREADS
+    
+    pylist = tclist2pylist(list);
+    tclistdel(list);
+    
+    return pylist;
+}
+
+
+/*
+ * Keys are walked with the iterator of the database, which like a server
+ * connection has only one, so a second concurrent iterator is refused.
+ */
+typedef struct
+{
+    PyObject_HEAD
+    LocalTyrant *db;
+    bool active;
+} LocalTyrantIter;
+
+
+static PyTypeObject LocalTyrantIterType;
+
+
+static void
+LocalTyrantIter_finish(LocalTyrantIter *self)
+{
+    if (self->active)
+    {
+        self->active = false;
+        self->db->iterating = false;
+    }
+}
+
+
+static void
+LocalTyrantIter_dealloc(LocalTyrantIter *self)
+{
+    if (self->db)
+    {
+        LocalTyrantIter_finish(self);
+    }
+    Py_XDECREF(self->db);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+LocalTyrantIter_iternext(LocalTyrantIter *self)
+{
+    char *kbuf;
+    int ksiz;
+    PyObject *key;
+    
+    if (!self->active)
+    {
+        return NULL;
+    }
+    
+    if (!local_ready(self->db))
+    {
+        LocalTyrantIter_finish(self);
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    kbuf = tcadbiternext(self->db->db, &ksiz);
+    Py_END_ALLOW_THREADS
+    
+    if (!kbuf)
+    {
+        LocalTyrantIter_finish(self);
+        return NULL;
+    }
+    
+    key = PyString_FromStringAndSize(kbuf, ksiz);
+    free(kbuf);
+    
+    return key;
+}
+
+
+static PyTypeObject LocalTyrantIterType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.LocalTyrantIter",       /* tp_name */
+  sizeof(LocalTyrantIter),                     /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)LocalTyrantIter_dealloc,         /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Local database key iterator",               /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  PyObject_SelfIter,                           /* tp_iter */
+  (iternextfunc)LocalTyrantIter_iternext,      /* tp_iternext */
+  0,                                           /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  0,                                           /* tp_new */
+};
+
+
+static PyObject *
+LocalTyrant_iter(LocalTyrant *self)
+{
+    bool success;
+    LocalTyrantIter *iter;
+    
+    if (!local_ready(self))
+    {
+        return NULL;
+    }
+    
+    if (self->iterating)
+    {
+        PyErr_SetString(TyrantError,
+            "The key iterator of this database is already in use.");
+        return NULL;
+    }
+    
+    iter = PyObject_New(LocalTyrantIter, &LocalTyrantIterType);
+    
+    if (!iter)
+    {
+        return NULL;
+    }
+    
+    Py_INCREF(self);
+    iter->db = self;
+    iter->active = true;
+    self->iterating = true;
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbiterinit(self->db);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        Py_DECREF(iter);
+        raise_tyrant_code(TTEMISC);
+        return NULL;
+    }
+    
+    return (PyObject *) iter;
+}
+
+
+/*
+ * Records are read one at a time in process, so `batch` is accepted for
+ * compatibility with Tyrant.iterkeys and ignored.
+ */
+static PyObject *
+LocalTyrant_iterkeys(LocalTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    int batch = 0;
+    
+    static char *kwlist[] = {"batch", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i:iterkeys", kwlist, &batch))
+    {
+        return NULL;
+    }
+    
+    return LocalTyrant_iter(self);
+}
+
+
+static PyObject *
+LocalTyrant_addint(LocalTyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz, num, result;
+    
+    if (!PyArg_ParseTuple(args, "s#i:addint", &kbuf, &ksiz, &num) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    result = tcadbaddint(self->db, kbuf, ksiz, num);
+    Py_END_ALLOW_THREADS
+    
+    return PyInt_FromLong((long) result);
+}
+
+
+static PyObject *
+LocalTyrant_adddouble(LocalTyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz;
+    double num, result;
+    
+    if (!PyArg_ParseTuple(args, "s#d:adddouble", &kbuf, &ksiz, &num) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    result = tcadbadddouble(self->db, kbuf, ksiz, num);
+    Py_END_ALLOW_THREADS
+    
+    return PyFloat_FromDouble(result);
+}
+
+
+static PyObject *
+LocalTyrant_sync(LocalTyrant *self)
+{
+    bool success;
+    
+    if (!local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbsync(self->db);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        raise_tyrant_code(TTEMISC);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_optimize(LocalTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    bool success;
+    char *params = NULL;
+    
+    static char *kwlist[] = {"params", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|z:optimize", kwlist, &params) ||
+        !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadboptimize(self->db, params);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        raise_tyrant_code(TTEMISC);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_vanish(LocalTyrant *self)
+{
+    bool success;
+    
+    if (!local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbvanish(self->db);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        raise_tyrant_code(TTEMISC);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_copy(LocalTyrant *self, PyObject *args)
+{
+    bool success;
+    char *path;
+    
+    if (!PyArg_ParseTuple(args, "s:copy", &path) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbcopy(self->db, path);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        raise_tyrant_code(TTEMISC);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_rnum(LocalTyrant *self)
+{
+    uint64_t rnum;
+    
+    if (!local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    rnum = tcadbrnum(self->db);
+    Py_END_ALLOW_THREADS
+    
+    return PyLong_FromUnsignedLongLong(rnum);
+}
+
+
+static PyObject *
+LocalTyrant_size(LocalTyrant *self)
+{
+    uint64_t size;
+    
+    if (!local_ready(self))
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    size = tcadbsize(self->db);
+    Py_END_ALLOW_THREADS
+    
+    return PyLong_FromUnsignedLongLong(size);
+}
+
+
+static PyObject *
+LocalTyrant_misc(LocalTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    const char *name;
+    int opts = 0;
+    TCLIST *list, *results;
+    PyObject *pyargs = NULL, *pyresults;
+    
+    static char *kwlist[] = {"name", "args", "opts", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|Oi:misc", kwlist,
+        &name, &pyargs, &opts) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    /* RDBMONOULOG is the only option and there is no update log to skip. */
+    if (opts & ~RDBMONOULOG)
+    {
+        PyErr_SetString(PyExc_ValueError, "Unknown misc options.");
+        return NULL;
+    }
+    
+    list = pyargs ? pystrings2tclist(pyargs) : tclistnew2(1);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    results = local_misc(self, name, list, TTEMISC);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    pyresults = tclist2pylist(results);
+    tclistdel(results);
+    
+    return pyresults;
+}
+
+
+static PyObject *
+local_tblput(LocalTyrant *self, PyObject *args, const char *format, const char *name,
+    int ecode)
+{
+    char *kbuf;
+    const char *cbuf;
+    int ksiz, csiz;
+    TCMAP *cols;
+    TCLIST *list, *results;
+    PyObject *dict;
+    
+    if (!PyArg_ParseTuple(args, format, &kbuf, &ksiz, &dict) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    cols = pydict2tcmap(dict);
+    
+    if (!cols)
+    {
+        return NULL;
+    }
+    
+    list = tclistnew2(tcmaprnum(cols) * 2 + 1);
+    tclistpush(list, kbuf, ksiz);
+    
+    tcmapiterinit(cols);
+    while ((cbuf = tcmapiternext(cols, &csiz)) != NULL)
+    {
+        tclistpush(list, cbuf, csiz);
+        cbuf = tcmapiterval(cbuf, &csiz);
+        tclistpush(list, cbuf, csiz);
+    }
+    
+    tcmapdel(cols);
+    
+    results = local_misc(self, name, list, ecode);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    tclistdel(results);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_tblput(LocalTyrant *self, PyObject *args)
+{
+    return local_tblput(self, args, "s#O:tblput", "put", TTEMISC);
+}
+
+
+static PyObject *
+LocalTyrant_tblputkeep(LocalTyrant *self, PyObject *args)
+{
+    return local_tblput(self, args, "s#O:tblputkeep", "putkeep", TTEKEEP);
+}
+
+
+static PyObject *
+LocalTyrant_tblputcat(LocalTyrant *self, PyObject *args)
+{
+    return local_tblput(self, args, "s#O:tblputcat", "putcat", TTEMISC);
+}
+
+
+static PyObject *
+LocalTyrant_tblout(LocalTyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz;
+    TCLIST *list, *results;
+    
+    if (!PyArg_ParseTuple(args, "s#:tblout", &kbuf, &ksiz) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    list = tclistnew2(1);
+    tclistpush(list, kbuf, ksiz);
+    
+    results = local_misc(self, "out", list, TTENOREC);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    tclistdel(results);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_tblget(LocalTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    char *kbuf;
+    const char *nbuf, *vbuf;
+    int i, ksiz, nsiz, vsiz;
+    TCLIST *list, *results;
+    PyObject *value, *schema = Py_None;
+    
+    static char *kwlist[] = {"key", "schema", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|O:tblget", kwlist,
+        &kbuf, &ksiz, &schema) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    if (pyschema_check(schema) != 0)
+    {
+        return NULL;
+    }
+    
+    list = tclistnew2(1);
+    tclistpush(list, kbuf, ksiz);
+    
+    Py_BEGIN_ALLOW_THREADS
+    results = tcadbmisc(self->db, "get", list);
+    Py_END_ALLOW_THREADS
+    
+    tclistdel(list);
+    
+    if (!results)
+    {
+        Py_RETURN_NONE;
+    }
+    
+    value = _PyDict_NewPresized(tclistnum(results) / 2);
+    
+    for (i=0; value && i+1<tclistnum(results); i+=2)
+    {
+        nbuf = tclistval(results, i, &nsiz);
+        vbuf = tclistval(results, i + 1, &vsiz);
+        
+        if (pydictsetcol(value, nbuf, nsiz, vbuf, vsiz,
+            schema != Py_None ? schema : NULL) != 0)
+        {
+            Py_CLEAR(value);
+        }
+    }
+    
+    tclistdel(results);
+    
+    return value;
+}
+
+
+static PyObject *
+LocalTyrant_tblsetindex(LocalTyrant *self, PyObject *args)
+{
+    const char *name;
+    char type[16];
+    int opts;
+    TCLIST *list, *results;
+    
+    if (!PyArg_ParseTuple(args, "si:tblsetindex", &name, &opts) || !local_ready(self))
+    {
+        return NULL;
+    }
+    
+    sprintf(type, "%d", opts);
+    
+    list = tclistnew2(2);
+    tclistpush2(list, name);
+    tclistpush2(list, type);
+    
+    results = local_misc(self, "setindex", list, TTEMISC);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    tclistdel(results);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+LocalTyrant_tblgenuid(LocalTyrant *self)
+{
+    int64_t id = -1;
+    TCLIST *list, *results;
+    
+    if (!local_ready(self))
+    {
+        return NULL;
+    }
+    
+    list = tclistnew2(1);
+    results = local_misc(self, "genuid", list, TTEMISC);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    if (tclistnum(results) > 0)
+    {
+        id = strtoll(tclistval2(results, 0), NULL, 10);
+    }
+    
+    tclistdel(results);
+    
+    if (id < 0)
+    {
+        raise_tyrant_code(TTEMISC);
+        return NULL;
+    }
+    
+    return Py_BuildValue("L", id);
+}
+
+
+static Py_ssize_t
+LocalTyrant_length(LocalTyrant *self)
+{
+    uint64_t rnum;
+    
+    if (!local_ready(self))
+    {
+        return -1;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    rnum = tcadbrnum(self->db);
+    Py_END_ALLOW_THREADS
+    
+    return (Py_ssize_t) rnum;
+}
+
+
+static PyObject *
+LocalTyrant_subscript(LocalTyrant *self, PyObject *key)
+{
+    char *kbuf, *vbuf;
+    Py_ssize_t ksiz;
+    int vsiz;
+    PyObject *value;
+    
+    if (!PyString_Check(key))
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected key to be a string.");
+        return NULL;
+    }
+    
+    if (!local_ready(self))
+    {
+        return NULL;
+    }
+    
+    PyString_AsStringAndSize(key, &kbuf, &ksiz);
+    
+    Py_BEGIN_ALLOW_THREADS
+    vbuf = tcadbget(self->db, kbuf, (int) ksiz, &vsiz);
+    Py_END_ALLOW_THREADS
+    
+    if (!vbuf)
+    {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    
+    value = PyString_FromStringAndSize(vbuf, vsiz);
+    free(vbuf);
+    
+    return value;
+}
+
+
+static int
+LocalTyrant_ass_subscript(LocalTyrant *self, PyObject *key, PyObject *value)
+{
+    bool success;
+    char *kbuf;
+    Py_ssize_t ksiz;
+    Py_buffer view;
+    
+    if (!PyString_Check(key))
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected key to be a string.");
+        return -1;
+    }
+    
+    if (!value || pybuffer_get(value, &view, false) != 0)
+    {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_ValueError, "Expected value to be a string or buffer.");
+        return -1;
+    }
+    
+    if (!local_ready(self))
+    {
+        PyBuffer_Release(&view);
+        return -1;
+    }
+    
+    PyString_AsStringAndSize(key, &kbuf, &ksiz);
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbput(self->db, kbuf, (int) ksiz, view.buf, (int) view.len);
+    Py_END_ALLOW_THREADS
+    
+    PyBuffer_Release(&view);
+    
+    if (!success)
+    {
+        raise_tyrant_code(TTEMISC);
+        return -1;
+    }
+    
+    return 0;
+}
+
+
+static PyMappingMethods LocalTyrant_as_mapping = 
+{
+    (lenfunc) LocalTyrant_length,
+    (binaryfunc) LocalTyrant_subscript,
+    (objobjargproc) LocalTyrant_ass_subscript
+};
+
+
+static int
+LocalTyrant_contains(LocalTyrant *self, PyObject *value)
+{
+    char *kbuf;
+    Py_ssize_t ksiz;
+    int vsiz;
+    
+    if (!PyString_Check(value))
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected value to be a string");
+        return -1;
+    }
+    
+    if (!local_ready(self))
+    {
+        return -1;
+    }
+    
+    PyString_AsStringAndSize(value, &kbuf, &ksiz);
+    
+    Py_BEGIN_ALLOW_THREADS
+    vsiz = tcadbvsiz(self->db, kbuf, (int) ksiz);
+    Py_END_ALLOW_THREADS
+    
+    return vsiz != -1;
+}
+
+
+static PySequenceMethods LocalTyrant_as_sequence = 
+{
+    0,                                  /* sq_length */
+    0,                                  /* sq_concat */
+    0,                                  /* sq_repeat */
+    0,                                  /* sq_item */
+    0,                                  /* sq_slice */
+    0,                                  /* sq_ass_item */
+    0,                                  /* sq_ass_slice */
+    (objobjproc) LocalTyrant_contains,  /* sq_contains */
+    0,                                  /* sq_inplace_concat */
+    0                                   /* sq_inplace_repeat */
+};
+
+
+static PyMethodDef LocalTyrant_methods[] = 
+{
+    {
+        "open", (PyCFunction) LocalTyrant_open,
+        METH_VARARGS | METH_KEYWORDS,
+        "Open a database file. The suffix selects the type and tuning parameters follow a #."
+    },
+    
+    {
+        "close", (PyCFunction) LocalTyrant_close,
+        METH_NOARGS,
+        "Close the database file."
+    },
+    
+    {
+        "put", (PyCFunction) LocalTyrant_put,
+        METH_VARARGS,
+        "Store a record. Overwrite existing record."
+    },
+    
+    {
+        "putkeep", (PyCFunction) LocalTyrant_putkeep,
+        METH_VARARGS,
+        "Store a record. Don't overwrite an existing record."
+    },
+    
+    {
+        "putcat", (PyCFunction) LocalTyrant_putcat,
+        METH_VARARGS,
+        "Concatenate value on the end of a record. Creates the record if it doesn't exist."
+    },
+    
+    {
+        "putnr", (PyCFunction) LocalTyrant_put,
+        METH_VARARGS,
+        "Alias for put. Without a server there is no reply to skip."
+    },
+    
+    {
+        "out", (PyCFunction) LocalTyrant_out,
+        METH_VARARGS,
+        "Remove a record. If there are duplicates only the first is removed."
+    },
+    
+    {
+        "putlist", (PyCFunction) LocalTyrant_putlist,
+        METH_VARARGS,
+        "Store multiple records. Takes a mapping or (key, value) pairs."
+    },
+    
+    {
+        "outlist", (PyCFunction) LocalTyrant_outlist,
+        METH_VARARGS,
+        "Remove multiple records."
+    },
+    
+    {
+        "get", (PyCFunction) LocalTyrant_get,
+        METH_VARARGS | METH_KEYWORDS,
+        "Retrieve a record. If none is found None or the supplied default value is returned."
+    },
+    
+    {
+        "mget", (PyCFunction) LocalTyrant_mget,
+        METH_VARARGS,
+        "Retrieve multiple records. Returns a dict of the keys that were found."
+    },
+    
+    {
+        "vsiz", (PyCFunction) LocalTyrant_vsiz,
+        METH_VARARGS,
+        "Get the size of the of the record for key. If duplicates are found, the first record is used."
+    },
+    
+    {
+        "fwmkeys", (PyCFunction) LocalTyrant_fwmkeys,
+        METH_VARARGS | METH_KEYWORDS,
+        "Get a list of of keys that match the given prefix."
+    },
+    
+    {
+        "iterkeys", (PyCFunction) LocalTyrant_iterkeys,
+        METH_VARARGS | METH_KEYWORDS,
+        "Iterate over every key in the database. Only one iterator can be active at a time. batch is accepted and ignored."
+    },
+    
+    {
+        "addint", (PyCFunction) LocalTyrant_addint,
+        METH_VARARGS,
+        "Add an integer to the selected record."
+    },
+    
+    {
+        "adddouble", (PyCFunction) LocalTyrant_adddouble,
+        METH_VARARGS,
+        "Add a double to the selected record."
+    },
+    
+    {
+        "sync", (PyCFunction) LocalTyrant_sync,
+        METH_NOARGS,
+        "Sync data with the disk device."
+    },
+    
+    {
+        "optimize", (PyCFunction) LocalTyrant_optimize,
+        METH_VARARGS | METH_KEYWORDS,
+        "Optimize a fragmented database."
+    },
+    
+    {
+        "vanish", (PyCFunction) LocalTyrant_vanish,
+        METH_NOARGS,
+        "Remove all records from the database."
+    },
+    
+    {
+        "copy", (PyCFunction) LocalTyrant_copy,
+        METH_VARARGS,
+        "Copy the database to a new file."
+    },
+    
+    {
+        "rnum", (PyCFunction) LocalTyrant_rnum,
+        METH_NOARGS,
+        "Get the number of records in the database."
+    },
+    
+    {
+        "size", (PyCFunction) LocalTyrant_size,
+        METH_NOARGS,
+        "Get the size of the database in bytes."
+    },
+    
+    {
+        "misc", (PyCFunction) LocalTyrant_misc,
+        METH_VARARGS | METH_KEYWORDS,
+        "Call a database function by name with a list of string arguments. Returns a list. opts may only be RDBMONOULOG, which has no effect without an update log."
+    },
+    
+    {
+        "tblput", (PyCFunction) LocalTyrant_tblput,
+        METH_VARARGS,
+        "Store a record. Overwrite existing record."
+    },
+    
+    {
+        "tblputkeep", (PyCFunction) LocalTyrant_tblputkeep,
+        METH_VARARGS,
+        "Store a record. Don't overwrite an existing record."
+    },
+    
+    {
+        "tblputcat", (PyCFunction) LocalTyrant_tblputcat,
+        METH_VARARGS,
+        "Concatenate value on the end of a record. Creates the record if it doesn't exist."
+    },
+    
+    {
+        "tblout", (PyCFunction) LocalTyrant_tblout,
+        METH_VARARGS,
+        "Remove a record."
+    },
+    
+    {
+        "tblget", (PyCFunction) LocalTyrant_tblget,
+        METH_VARARGS | METH_KEYWORDS,
+        "Retrieve a record. If none is found None is returned. Columns named in the optional schema are converted."
+    },
+    
+    {
+        "tblsetindex", (PyCFunction) LocalTyrant_tblsetindex,
+        METH_VARARGS,
+        "Set an index on a column."
+    },
+    
+    {
+        "tblgenuid", (PyCFunction) LocalTyrant_tblgenuid,
+        METH_NOARGS,
+        "Generate a unique record id."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject LocalTyrantType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.LocalTyrant",           /* tp_name */
+  sizeof(LocalTyrant),                         /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)LocalTyrant_dealloc,             /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  &LocalTyrant_as_sequence,                    /* tp_as_sequence */
+  &LocalTyrant_as_mapping,                     /* tp_as_mapping */
+  Tyrant_Hash,                                 /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
+  "Tokyo Cabinet database opened in-process with the Tyrant interface", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  (getiterfunc)LocalTyrant_iter,               /* tp_iter */
+  0,                                           /* tp_iternext */
+  LocalTyrant_methods,                         /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  LocalTyrant_new,                             /* tp_new */
+};
+
+
+/*
+ * A table query that is built once and run many times, on any Tyrant or
+ * TyrantPool. The arguments of the search misc function are encoded when
+ * the query is built. A condition whose operand is a "$name" placeholder
+ * keeps only its encoded prefix, and the operand is appended from the
+ * parameters of each run.
+ */
+typedef struct
+{
+    PyObject_HEAD
+    TCLIST *args;
+    TCLIST *params;
+    PyObject *schema;
+} PreparedQuery;
+
+
+enum
+{
+    PREPAREDSEARCH,
+    PREPAREDGET,
+    PREPAREDCOUNT,
+    PREPAREDOUT
+};
+
+
+static void
+PreparedQuery_dealloc(PreparedQuery *self)
+{
+    if (self->args)
+    {
+        tclistdel(self->args);
+    }
+    if (self->params)
+    {
+        tclistdel(self->params);
+    }
+    Py_XDECREF(self->schema);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+PreparedQuery_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    PreparedQuery *self;
+    
+    self = (PreparedQuery *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate PreparedQuery instance.");
+        return NULL;
+    }
+    
+    self->args = tclistnew();
+    self->params = tclistnew();
+    
+    return (PyObject *) self;
+}
+
+
+static PyObject *
+PreparedQuery_addcond(PreparedQuery *self, PyObject *args, PyObject *kwargs)
+{
+    const char *name, *expr, *param = "";
+    int op = 0;
+    TCXSTR *arg;
+    
+    name = expr = NULL;
+    
+    static char *kwlist[] = {"name", "op", "expr", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|s:addcond", kwlist,
+        &name, &op, &expr))
+    {
+        return NULL;
+    }
+    
+    expr = expr ? expr : "";
+    
+    /* "$name" is a placeholder and "$$" escapes a literal leading dollar. */
+    if (expr[0] == '$')
+    {
+        if (expr[1] == '$')
+        {
+            expr++;
+        }
+        else
+        {
+            param = expr + 1;
+            expr = "";
+        }
+    }
+    
+    arg = tcxstrnew();
+    tcxstrcat(arg, "addcond", 8);
+    tcxstrcat(arg, name, strlen(name) + 1);
+    tcxstrprintf(arg, "%d", op);
+    tcxstrcat(arg, "", 1);
+    tcxstrcat2(arg, expr);
+    tclistpush(self->args, tcxstrptr(arg), tcxstrsize(arg));
+    tclistpush2(self->params, param);
+    tcxstrdel(arg);
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+PreparedQuery_setorder(PreparedQuery *self, PyObject *args)
+{
+    const char *name;
+    int type;
+    TCXSTR *arg;
+    
+    if (!PyArg_ParseTuple(args, "si:setorder", &name, &type))
+    {
+        return NULL;
+    }
+    
+    arg = tcxstrnew();
+    tcxstrcat(arg, "setorder", 9);
+    tcxstrcat(arg, name, strlen(name) + 1);
+    tcxstrprintf(arg, "%d", type);
+    tclistpush(self->args, tcxstrptr(arg), tcxstrsize(arg));
+    tclistpush2(self->params, "");
+    tcxstrdel(arg);
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+PreparedQuery_setlimit(PreparedQuery *self, PyObject *args)
+{
+    int max, skip = 0;
+    TCXSTR *arg;
+    
+    if (!PyArg_ParseTuple(args, "i|i:setlimit", &max, &skip))
+    {
+        return NULL;
+    }
+    
+    arg = tcxstrnew();
+    tcxstrcat(arg, "setlimit", 9);
+    tcxstrprintf(arg, "%d", max);
+    tcxstrcat(arg, "", 1);
+    tcxstrprintf(arg, "%d", skip);
+    tclistpush(self->args, tcxstrptr(arg), tcxstrsize(arg));
+    tclistpush2(self->params, "");
+    tcxstrdel(arg);
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+PreparedQuery_setschema(PreparedQuery *self, PyObject *args)
+{
+    PyObject *schema;
+    
+    if (!PyArg_ParseTuple(args, "O:setschema", &schema))
+    {
+        return NULL;
+    }
+    
+    if (pyschema_check(schema) != 0)
+    {
+        return NULL;
+    }
+    
+    Py_CLEAR(self->schema);
+    
+    if (schema != Py_None)
+    {
+        Py_INCREF(schema);
+        self->schema = schema;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+/*
+ * Complete the encoded arguments with the operands from `params` and the
+ * clause selecting what the search returns.
+ */
+static TCLIST *
+prepared_bind(PreparedQuery *self, PyObject *params, int mode)
+{
+    int i, asiz;
+    const char *abuf, *name;
+    PyObject *value, *str;
+    TCLIST *list;
+    TCXSTR *arg;
+    
+    list = tclistnew2(tclistnum(self->args) + 1);
+    
+    for (i=0; i<tclistnum(self->args); i++)
+    {
+        abuf = tclistval(self->args, i, &asiz);
+        name = tclistval2(self->params, i);
+        
+        if (name[0] == '\0')
+        {
+            tclistpush(list, abuf, asiz);
+            continue;
+        }
+        
+        value = params ? PyMapping_GetItemString(params, (char *) name) : NULL;
+        
+        if (!value)
+        {
+            if (!PyErr_Occurred() || PyErr_ExceptionMatches(PyExc_KeyError))
+            {
+                PyErr_Clear();
+                PyErr_Format(PyExc_KeyError, "Missing query parameter '%s'.", name);
+            }
+            tclistdel(list);
+            return NULL;
+        }
+        
+        str = pyscalar2pystring(value);
+        Py_DECREF(value);
+        
+        if (!str)
+        {
+            if (!PyErr_Occurred())
+            {
+                PyErr_Format(PyExc_TypeError,
+                    "Query parameter '%s' must be a string or a number.", name);
+            }
+            tclistdel(list);
+            return NULL;
+        }
+        
+        arg = tcxstrnew();
+        tcxstrcat(arg, abuf, asiz);
+        tcxstrcat(arg, PyString_AS_STRING(str), (int) PyString_GET_SIZE(str));
+        tclistpush(list, tcxstrptr(arg), tcxstrsize(arg));
+        tcxstrdel(arg);
+        Py_DECREF(str);
+    }
+    
+    switch (mode)
+    {
+        case PREPAREDGET:
+            tclistpush2(list, "get");
+            break;
+        case PREPAREDCOUNT:
+            tclistpush2(list, "count");
+            break;
+        case PREPAREDOUT:
+            tclistpush2(list, "out");
+            break;
+    }
+    
+    return list;
+}
+
+
+/*
+ * Call the search misc function on a Tyrant, or on a connection borrowed
+ * from a TyrantPool for the duration of the call.
+ */
+static TCLIST *
+prepared_run(PyObject *db, const TCLIST *args, int opts)
+{
+    int slot, ecode = TTESUCCESS;
+    TCRDB *rdb;
+    TCLIST *results = NULL;
+    TyrantPool *pool;
+    
+    if (PyObject_TypeCheck(db, &TyrantType))
+    {
+        rdb = ((Tyrant *) db)->db;
+        
+        Py_BEGIN_ALLOW_THREADS
+        results = tcrdbmisc(rdb, "search", opts, args);
+        Py_END_ALLOW_THREADS
+        
+        /* Without RDBMONOULOG the search removes what it matched. */
+        if (!(opts & RDBMONOULOG))
+        {
+            tyrant_cache_clear((Tyrant *) db);
+        }
+        
+        if (!results)
+        {
+            raise_tyrant_error(rdb);
+        }
+        return results;
+    }
+    
+    if (PyObject_TypeCheck(db, &LocalTyrantType))
+    {
+        if (!local_ready((LocalTyrant *) db))
+        {
+            return NULL;
+        }
+        return local_misc((LocalTyrant *) db, "search", args, TTEMISC);
+    }
+    
+    if (!PyObject_TypeCheck(db, &TyrantPoolType))
+    {
+        PyErr_SetString(PyExc_TypeError, "Expected a Tyrant, TyrantPool or LocalTyrant.");
+        return NULL;
+    }
+    
+    pool = (TyrantPool *) db;
+    
+    Py_BEGIN_ALLOW_THREADS
+    slot = tyrantpool_acquire(pool, &ecode);
+    if (slot >= 0)
+    {
+        rdb = pool->slots[slot].conn->db;
+        results = tcrdbmisc(rdb, "search", opts, args);
+        ecode = results ? TTESUCCESS : tcrdbecode(rdb);
+        tyrantpool_release(pool, slot, tyrant_ecode_healthy(ecode));
+    }
+    Py_END_ALLOW_THREADS
+    
+    if (!results)
+    {
+        raise_tyrant_code(ecode);
+    }
+    
+    return results;
+}
+
+
+static PyObject *
+prepared_search(PreparedQuery *self, PyObject *args, const char *format, int mode)
+{
+    int i, n, csiz;
+    const char *cbuf;
+    PyObject *db, *params = NULL, *pyresults, *row;
+    TCLIST *list, *results;
+    
+    if (!PyArg_ParseTuple(args, format, &db, &params))
+    {
+        return NULL;
+    }
+    
+    list = prepared_bind(self, params != Py_None ? params : NULL, mode);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    results = prepared_run(db, list, mode == PREPAREDOUT ? 0 : RDBMONOULOG);
+    tclistdel(list);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    switch (mode)
+    {
+        case PREPAREDGET:
+            n = tclistnum(results);
+            pyresults = PyList_New(n);
+            for (i=0; pyresults && i<n; i++)
+            {
+                cbuf = tclistval(results, i, &csiz);
+                row = pycols2pydict(cbuf, csiz, self->schema);
+                if (!row)
+                {
+                    Py_CLEAR(pyresults);
+                    break;
+                }
+                PyList_SET_ITEM(pyresults, i, row);
+            }
+            break;
+        case PREPAREDCOUNT:
+            pyresults = PyInt_FromLong(tclistnum(results) > 0 ?
+                strtol(tclistval2(results, 0), NULL, 10) : 0);
+            break;
+        case PREPAREDOUT:
+            Py_INCREF(Py_None);
+            pyresults = Py_None;
+            break;
+        default:
+            pyresults = tclist2pylist(results);
+            break;
+    }
+    
+    tclistdel(results);
+    
+    return pyresults;
+}
+
+
+static PyObject *
+PreparedQuery_search(PreparedQuery *self, PyObject *args)
+{
+    return prepared_search(self, args, "O|O:search", PREPAREDSEARCH);
+}
+
+
+static PyObject *
+PreparedQuery_searchget(PreparedQuery *self, PyObject *args)
+{
+    return prepared_search(self, args, "O|O:searchget", PREPAREDGET);
+}
+
+
+static PyObject *
+PreparedQuery_searchcount(PreparedQuery *self, PyObject *args)
+{
+    return prepared_search(self, args, "O|O:searchcount", PREPAREDCOUNT);
+}
+
+
+static PyObject *
+PreparedQuery_searchout(PreparedQuery *self, PyObject *args)
+{
+    return prepared_search(self, args, "O|O:searchout", PREPAREDOUT);
+}
+
+
+static PyMethodDef PreparedQuery_methods[] = 
+{
+    {
+        "addcond", (PyCFunction) PreparedQuery_addcond,
+        METH_VARARGS | METH_KEYWORDS,
+        "Add a condition. An expression of the form $name is filled in from the parameters of each run."
+    },
+    
+    {
+        "setorder", (PyCFunction) PreparedQuery_setorder,
+        METH_VARARGS,
+        "Set the column and direction to order by."
+    },
+    
+    {
+        "setlimit", (PyCFunction) PreparedQuery_setlimit,
+        METH_VARARGS,
+        "Set the limit and offset of the results."
+    },
+    
+    {
+        "setschema", (PyCFunction) PreparedQuery_setschema,
+        METH_VARARGS,
+        "Set a dict of column names to int or float. Matching columns of fetched records are converted."
+    },
+    
+    {
+        "search", (PyCFunction) PreparedQuery_search,
+        METH_VARARGS,
+        "Run the query on a Tyrant or TyrantPool with a dict of parameters. Returns the keys of matching records."
+    },
+    
+    {
+        "searchget", (PyCFunction) PreparedQuery_searchget,
+        METH_VARARGS,
+        "Run the query on a Tyrant or TyrantPool with a dict of parameters. Returns the matching records."
+    },
+    
+    {
+        "searchcount", (PyCFunction) PreparedQuery_searchcount,
+        METH_VARARGS,
+        "Run the query on a Tyrant or TyrantPool with a dict of parameters. Returns the number of matching records."
+    },
+    
+    {
+        "searchout", (PyCFunction) PreparedQuery_searchout,
+        METH_VARARGS,
+        "Run the query on a Tyrant or TyrantPool with a dict of parameters and remove the matching records."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject PreparedQueryType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.PreparedQuery",         /* tp_name */
+  sizeof(PreparedQuery),                       /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)PreparedQuery_dealloc,           /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  TyrantQuery_Hash,                            /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
+  "Reusable table query with placeholder operands", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  0,                                           /* tp_iter */
+  0,                                           /* tp_iternext */
+  PreparedQuery_methods,                       /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  PreparedQuery_new,                           /* tp_new */
+};
+
+
+/*
+ * Run `num` tasks of `size` bytes each from `tasks` concurrently, one per
+ * thread, and wait for all of them. The first task runs on the calling
+ * thread. Must be called without the GIL.
+ */
+static void
+run_parallel(void *(*func)(void *), void *tasks, size_t size, int num)
+{
+    int i;
+    pthread_t *threads;
+    bool *started;
+    
+    if (num < 1)
+    {
+        return;
+    }
+    
+    threads = malloc(sizeof(pthread_t) * num);
+    started = calloc(num, sizeof(bool));
+    
+    for (i=1; i<num; i++)
+    {
+        if (threads && started &&
+            pthread_create(&threads[i], NULL, func, (char *) tasks + size * i) == 0)
+        {
+            started[i] = true;
+        }
+        else
+        {
+            func((char *) tasks + size * i);
+        }
+    }
+    
+    func(tasks);
+    
+    for (i=1; i<num; i++)
+    {
+        if (started && started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    
+    free(threads);
+    free(started);
+}
+
+
+#define SHARD_POINTS_PER_NODE 160
+
+
+typedef struct
+{
+    char *host;
+    int port;
+    TCRDB *db;
+} TyrantNode;
+
+
+typedef struct
+{
+    uint32_t point;
+    int node;
+} TyrantRingPoint;
+
+
+typedef struct
+{
+    PyObject_HEAD
+    TyrantNode *nodes;
+    int nnodes;
+    TyrantRingPoint *ring;
+    int npoints;
+    double timeout;
+} ShardedTyrant;
+
+
+typedef struct
+{
+    TCRDB *db;
+    TCMAP *recs;
+    TCLIST *list;
+    const char *name;
+    int ecode;
+} ShardTask;
+
+
+static PyTypeObject ShardedTyrantType;
+
+
+static void
+shard_md5(const void *buf, int siz, unsigned char *digest)
+{
+    char hex[33];
+    int i;
+    
+    tcmd5hash(buf, siz, hex);
+    
+    for (i=0; i<16; i++)
+    {
+        digest[i] = (unsigned char) (
+            ((hex[i*2] <= '9' ? hex[i*2] - '0' : hex[i*2] - 'a' + 10) << 4) |
+            (hex[i*2+1] <= '9' ? hex[i*2+1] - '0' : hex[i*2+1] - 'a' + 10));
+    }
+}
+
+
+static uint32_t
+shard_hash(const void *kbuf, int ksiz)
+{
+    unsigned char digest[16];
+    
+    shard_md5(kbuf, ksiz, digest);
+    
+    return ((uint32_t) digest[3] << 24) | ((uint32_t) digest[2] << 16) |
+        ((uint32_t) digest[1] << 8) | (uint32_t) digest[0];
+}
+
+
+static int
+shard_point_compare(const void *a, const void *b)
+{
+    uint32_t pa = ((const TyrantRingPoint *) a)->point;
+    uint32_t pb = ((const TyrantRingPoint *) b)->point;
+    
+    return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+
+/*
+ * Build the ketama continuum: every node gets SHARD_POINTS_PER_NODE points
+ * taken four at a time from the MD5 digest of "host:port-n", so adding a
+ * node only takes over the arcs its own points land on.
+ */
+static bool
+shard_build_ring(ShardedTyrant *self)
+{
+    int i, j, k, len;
+    char label[512];
+    unsigned char digest[16];
+    TyrantRingPoint *ring;
+    
+    ring = malloc(sizeof(TyrantRingPoint) * SHARD_POINTS_PER_NODE * self->nnodes);
+    
+    if (!ring)
+    {
+        return false;
+    }
+    
+    for (i=0; i<self->nnodes; i++)
+    {
+        for (j=0; j<SHARD_POINTS_PER_NODE / 4; j++)
+        {
+            len = snprintf(label, sizeof(label), "%s:%d-%d",
+                self->nodes[i].host, self->nodes[i].port, j);
+            shard_md5(label, len, digest);
+            
+            for (k=0; k<4; k++)
+            {
+                TyrantRingPoint *p = &ring[i * SHARD_POINTS_PER_NODE + j * 4 + k];
+                p->point = ((uint32_t) digest[3+k*4] << 24) |
+                    ((uint32_t) digest[2+k*4] << 16) |
+                    ((uint32_t) digest[1+k*4] << 8) | (uint32_t) digest[k*4];
+                p->node = i;
+            }
+        }
+    }
+    
+    qsort(ring, SHARD_POINTS_PER_NODE * self->nnodes, sizeof(TyrantRingPoint),
+        shard_point_compare);
+    
+    free(self->ring);
+    self->ring = ring;
+    self->npoints = SHARD_POINTS_PER_NODE * self->nnodes;
+    
+    return true;
+}
+
+
+static int
+shard_locate(ShardedTyrant *self, const void *kbuf, int ksiz)
+{
+    uint32_t hash;
+    int lo, hi, mid;
+    
+    hash = shard_hash(kbuf, ksiz);
+    lo = 0;
+    hi = self->npoints;
+    
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (self->ring[mid].point < hash)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    
+    if (lo == self->npoints)
+    {
+        lo = 0;
+    }
+    
+    return self->ring[lo].node;
+}
+
+
+static TCRDB *
+shard_route(ShardedTyrant *self, const void *kbuf, int ksiz)
+{
+    if (self->nnodes == 0)
+    {
+        PyErr_SetString(TyrantError, "No nodes configured.");
+        return NULL;
+    }
+    
+    return self->nodes[shard_locate(self, kbuf, ksiz)].db;
+}
+
+
+static bool
+shard_add_node(ShardedTyrant *self, const char *host, int port)
+{
+    bool success;
+    TCRDB *db;
+    TyrantNode *nodes;
+    
+    db = tcrdbnew();
+    
+    if (!db)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate TCRDB instance.");
+        return false;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcrdbtune(db, self->timeout, RDBTRECON) && tcrdbopen(db, host, port);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        raise_tyrant_error(db);
+        tcrdbdel(db);
+        return false;
+    }
+    
+    nodes = realloc(self->nodes, sizeof(TyrantNode) * (self->nnodes + 1));
+    
+    if (!nodes)
+    {
+        tcrdbdel(db);
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate node list.");
+        return false;
+    }
+    
+    self->nodes = nodes;
+    nodes[self->nnodes].host = strdup(host);
+    nodes[self->nnodes].port = port;
+    nodes[self->nnodes].db = db;
+    self->nnodes++;
+    
+    /* The old ring is kept if the new one cannot be built, so undo the add. */
+    if (!nodes[self->nnodes-1].host || !shard_build_ring(self))
+    {
+        self->nnodes--;
+        free(nodes[self->nnodes].host);
+        tcrdbdel(db);
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate hash ring.");
+        return false;
+    }
+    
+    return true;
+}
+
+
+static void
+ShardedTyrant_dealloc(ShardedTyrant *self)
+{
+    int i;
+    
+    for (i=0; i<self->nnodes; i++)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        tcrdbdel(self->nodes[i].db);
+        Py_END_ALLOW_THREADS
+        free(self->nodes[i].host);
+    }
+    free(self->nodes);
+    free(self->ring);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+ShardedTyrant_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    ShardedTyrant *self;
+    PyObject *pynodes, *iter, *item;
+    const char *host;
+    int port;
+    double timeout = 0.0;
+    
+    static char *kwlist[] = {"nodes", "timeout", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|d:ShardedTyrant", kwlist,
+        &pynodes, &timeout))
+    {
+        return NULL;
+    }
+    
+    self = (ShardedTyrant *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate ShardedTyrant instance.");
+        return NULL;
+    }
+    
+    self->timeout = timeout;
+    
+    iter = PyObject_GetIter(pynodes);
+    
+    if (!iter)
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    
+    while ((item = PyIter_Next(iter)) != NULL)
+    {
+        if (!PyArg_ParseTuple(item, "si;Expected (host, port) pairs.", &host, &port) ||
+            !shard_add_node(self, host, port))
+        {
+            Py_DECREF(item);
+            break;
+        }
+        
+        Py_DECREF(item);
+    }
+    
+    Py_DECREF(iter);
+    
+    if (PyErr_Occurred())
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    
+    return (PyObject *) self;
+}
+
+
+static PyObject *
+ShardedTyrant_add_node(ShardedTyrant *self, PyObject *args)
+{
+    const char *host;
+    int port;
+    
+    if (!PyArg_ParseTuple(args, "si:add_node", &host, &port))
+    {
+        return NULL;
+    }
+    
+    if (!shard_add_node(self, host, port))
+    {
+        return NULL;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ShardedTyrant_locate(ShardedTyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz, node;
+    
+    if (!PyArg_ParseTuple(args, "s#:locate", &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    if (!shard_route(self, kbuf, ksiz))
+    {
+        return NULL;
+    }
+    
+    node = shard_locate(self, kbuf, ksiz);
+    
+    return Py_BuildValue("(si)", self->nodes[node].host, self->nodes[node].port);
+}
+
+
+typedef bool (*shard_put_func)(TCRDB *, const void *, int, const void *, int);
+
+
+static PyObject *
+shard_put(ShardedTyrant *self, PyObject *args, const char *format, shard_put_func func)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    Py_buffer value;
+    TCRDB *db;
+    
+    if (!PyArg_ParseTuple(args, format, &kbuf, &ksiz, &value))
+    {
+        return NULL;
+    }
+    
+    db = shard_route(self, kbuf, ksiz);
+    
+    if (!db)
+    {
+        PyBuffer_Release(&value);
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = func(db, kbuf, ksiz, value.buf, (int) value.len);
+    Py_END_ALLOW_THREADS
+    
+    PyBuffer_Release(&value);
+    
+    if (!success)
+    {
+        raise_tyrant_error(db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ShardedTyrant_put(ShardedTyrant *self, PyObject *args)
+{
+    return shard_put(self, args, "s#s*:put", tcrdbput);
+}
+
+
+static PyObject *
+ShardedTyrant_putkeep(ShardedTyrant *self, PyObject *args)
+{
+    return shard_put(self, args, "s#s*:putkeep", tcrdbputkeep);
+}
+
+
+static PyObject *
+ShardedTyrant_putcat(ShardedTyrant *self, PyObject *args)
+{
+    return shard_put(self, args, "s#s*:putcat", tcrdbputcat);
+}
+
+
+static PyObject *
+ShardedTyrant_out(ShardedTyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    TCRDB *db;
+    
+    if (!PyArg_ParseTuple(args, "s#:out", &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    db = shard_route(self, kbuf, ksiz);
+    
+    if (!db)
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcrdbout(db, kbuf, ksiz);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        raise_tyrant_error(db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ShardedTyrant_get(ShardedTyrant *self, PyObject *args, PyObject *kwargs)
+{
+    char *kbuf, *vbuf;
+    int ksiz, vsiz;
+    TCRDB *db;
+    PyObject *default_value = NULL;
+    PyObject *value;
+    
+    static char *kwlist[] = {"key", "default", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|O:get", kwlist, &kbuf, &ksiz, &default_value))
+    {
+        return NULL;
+    }
+    
+    db = shard_route(self, kbuf, ksiz);
+    
+    if (!db)
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    vbuf = tcrdbget(db, kbuf, ksiz, &vsiz);
+    Py_END_ALLOW_THREADS
+    
+    if (!vbuf)
+    {
+        if (default_value)
+        {
+            Py_INCREF(default_value);
+            return default_value;
+        }
+        Py_RETURN_NONE;
+    }
+    
+    value = PyString_FromStringAndSize(vbuf, vsiz);
+    free(vbuf);
+    
+    return value;
+}
+
+
+static PyObject *
+ShardedTyrant_addint(ShardedTyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz, num, result;
+    TCRDB *db;
+    
+    if (!PyArg_ParseTuple(args, "s#i:addint", &kbuf, &ksiz, &num))
+    {
+        return NULL;
+    }
+    
+    db = shard_route(self, kbuf, ksiz);
+    
+    if (!db)
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    result = tcrdbaddint(db, kbuf, ksiz, num);
+    Py_END_ALLOW_THREADS
+    
+    return PyInt_FromLong((long) result);
+}
+
+
+static PyObject *
+ShardedTyrant_adddouble(ShardedTyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz;
+    double num, result;
+    TCRDB *db;
+    
+    if (!PyArg_ParseTuple(args, "s#d:adddouble", &kbuf, &ksiz, &num))
+    {
+        return NULL;
+    }
+    
+    db = shard_route(self, kbuf, ksiz);
+    
+    if (!db)
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    result = tcrdbadddouble(db, kbuf, ksiz, num);
+    Py_END_ALLOW_THREADS
+    
+    return PyFloat_FromDouble(result);
+}
+
+
+static PyObject *
+ShardedTyrant_tblput(ShardedTyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    TCMAP *cols;
+    TCRDB *db;
+    PyObject *dict;
+    
+    if (!PyArg_ParseTuple(args, "s#O:tblput", &kbuf, &ksiz, &dict))
+    {
+        return NULL;
+    }
+    
+    db = shard_route(self, kbuf, ksiz);
+    
+    if (!db)
+    {
+        return NULL;
+    }
+    
+    cols = pydict2tcmap(dict);
+    
+    if (!cols)
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcrdbtblput(db, kbuf, ksiz, cols);
+    Py_END_ALLOW_THREADS
+    
+    tcmapdel(cols);
+    
+    if (!success)
+    {
+        raise_tyrant_error(db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ShardedTyrant_tblout(ShardedTyrant *self, PyObject *args)
+{
+    bool success;
+    char *kbuf;
+    int ksiz;
+    TCRDB *db;
+    
+    if (!PyArg_ParseTuple(args, "s#:tblout", &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    db = shard_route(self, kbuf, ksiz);
+    
+    if (!db)
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcrdbtblout(db, kbuf, ksiz);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        raise_tyrant_error(db);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ShardedTyrant_tblget(ShardedTyrant *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz;
+    TCMAP *cols;
+    TCRDB *db;
+    PyObject *value;
+    
+    if (!PyArg_ParseTuple(args, "s#:tblget", &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    db = shard_route(self, kbuf, ksiz);
+    
+    if (!db)
+    {
+        return NULL;
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    cols = tcrdbtblget(db, kbuf, ksiz);
+    Py_END_ALLOW_THREADS
+    
+    if (!cols)
+    {
+        Py_RETURN_NONE;
+    }
+    
+    value = tcmap2pydict(cols, NULL);
+    tcmapdel(cols);
+    
+    return value;
+}
+
+
+static void *
+shard_task_get(void *arg)
+{
+    ShardTask *task = arg;
+    
+    if (!tcrdbget3(task->db, task->recs))
+    {
+        task->ecode = tcrdbecode(task->db);
+    }
+    
+    return NULL;
+}
+
+
+static void *
+shard_task_misc(void *arg)
+{
+    ShardTask *task = arg;
+    TCLIST *results;
+    
+    results = tcrdbmisc(task->db, task->name, 0, task->list);
+    
+    if (results)
+    {
+        tclistdel(results);
+    }
+    else
+    {
+        task->ecode = tcrdbecode(task->db);
+    }
+    
+    return NULL;
+}
+
+
+/*
+ * Allocate one task per node and store their number in `num`. Nodes can be
+ * added while the tasks run without the GIL, so callers must use `num`
+ * rather than the live node count from then on.
+ */
+static ShardTask *
+shard_tasks_new(ShardedTyrant *self, int *num)
+{
+    int i;
+    ShardTask *tasks;
+    
+    tasks = calloc(self->nnodes, sizeof(ShardTask));
+    
+    if (!tasks)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate shard tasks.");
+        return NULL;
+    }
+    
+    for (i=0; i<self->nnodes; i++)
+    {
+        tasks[i].db = self->nodes[i].db;
+    }
+    
+    *num = self->nnodes;
+    return tasks;
+}
+
+
+static void
+shard_tasks_del(ShardTask *tasks, int num)
+{
+    int i;
+    
+    for (i=0; i<num; i++)
+    {
+        if (tasks[i].recs)
+        {
+            tcmapdel(tasks[i].recs);
+        }
+        if (tasks[i].list)
+        {
+            tclistdel(tasks[i].list);
+        }
+    }
+    
+    free(tasks);
+}
+
+
+/*
+ * Drop tasks that were given no work and run the rest on their own threads.
+ * Returns the first error code reported by any node.
+ */
+static int
+shard_tasks_run(ShardTask *tasks, int num, void *(*func)(void *))
+{
+    int i, n = 0, ecode = TTESUCCESS;
+    ShardTask swap;
+    
+    for (i=0; i<num; i++)
+    {
+        if (tasks[i].recs || tasks[i].list)
+        {
+            swap = tasks[n];
+            tasks[n++] = tasks[i];
+            tasks[i] = swap;
+        }
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    run_parallel(func, tasks, sizeof(ShardTask), n);
+    Py_END_ALLOW_THREADS
+    
+    for (i=0; i<n; i++)
+    {
+        if (tasks[i].ecode != TTESUCCESS)
+        {
+            ecode = tasks[i].ecode;
+            break;
+        }
+    }
+    
+    return ecode;
+}
+
+
+static PyObject *
+ShardedTyrant_mget(ShardedTyrant *self, PyObject *args)
+{
+    int i, node, ecode, ksiz, vsiz, ntasks;
+    const char *kbuf, *vbuf;
+    PyObject *keys, *dict, *key, *value;
+    TCLIST *list;
+    ShardTask *tasks;
+    
+    if (!PyArg_ParseTuple(args, "O:mget", &keys))
+    {
+        return NULL;
+    }
+    
+    if (self->nnodes == 0)
+    {
+        PyErr_SetString(TyrantError, "No nodes configured.");
+        return NULL;
+    }
+    
+    list = pystrings2tclist(keys);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    tasks = shard_tasks_new(self, &ntasks);
+    
+    if (!tasks)
+    {
+        tclistdel(list);
+        return NULL;
+    }
+    
+    for (i=0; i<tclistnum(list); i++)
+    {
+        kbuf = tclistval(list, i, &ksiz);
+        node = shard_locate(self, kbuf, ksiz);
+        
+        if (!tasks[node].recs)
+        {
+            tasks[node].recs = tcmapnew();
+        }
+        tcmapput(tasks[node].recs, kbuf, ksiz, "", 0);
+    }
+    
+    tclistdel(list);
+    
+    ecode = shard_tasks_run(tasks, ntasks, shard_task_get);
+    
+    if (ecode != TTESUCCESS)
+    {
+        shard_tasks_del(tasks, ntasks);
+        raise_tyrant_code(ecode);
+        return NULL;
+    }
+    
+    dict = PyDict_New();
+    
+    for (i=0; dict && i<ntasks; i++)
+    {
+        if (!tasks[i].recs)
+        {
+            continue;
+        }
+        
+        tcmapiterinit(tasks[i].recs);
+        
+        while ((kbuf = tcmapiternext(tasks[i].recs, &ksiz)) != NULL)
+        {
+            vbuf = tcmapiterval(kbuf, &vsiz);
+            key = PyString_FromStringAndSize(kbuf, ksiz);
+            value = PyString_FromStringAndSize(vbuf, vsiz);
+            
+            if (!key || !value || PyDict_SetItem(dict, key, value) != 0)
+            {
+                Py_XDECREF(key);
+                Py_XDECREF(value);
+                Py_CLEAR(dict);
+                break;
+            }
+            
+            Py_DECREF(key);
+            Py_DECREF(value);
+        }
+    }
+    
+    shard_tasks_del(tasks, ntasks);
+    
+    return dict;
+}
+
+
+static PyObject *
+shard_misclist(ShardedTyrant *self, TCLIST *list, int stride, const char *name)
+{
+    int i, j, node, ecode, ksiz, vsiz, ntasks;
+    const char *kbuf, *vbuf;
+    ShardTask *tasks;
+    
+    if (self->nnodes == 0)
+    {
+        tclistdel(list);
+        PyErr_SetString(TyrantError, "No nodes configured.");
+        return NULL;
+    }
+    
+    tasks = shard_tasks_new(self, &ntasks);
+    
+    if (!tasks)
+    {
+        tclistdel(list);
+        return NULL;
+    }
+    
+    for (i=0; i<tclistnum(list); i+=stride)
+    {
+        kbuf = tclistval(list, i, &ksiz);
+        node = shard_locate(self, kbuf, ksiz);
+        
+        if (!tasks[node].list)
+        {
+            tasks[node].list = tclistnew();
+            tasks[node].name = name;
+        }
+        
+        for (j=0; j<stride; j++)
+        {
+            vbuf = tclistval(list, i + j, &vsiz);
+            tclistpush(tasks[node].list, vbuf, vsiz);
+        }
+    }
+    
+    tclistdel(list);
+    
+    ecode = shard_tasks_run(tasks, ntasks, shard_task_misc);
+    shard_tasks_del(tasks, ntasks);
+    
+    if (ecode != TTESUCCESS)
+    {
+        raise_tyrant_code(ecode);
+        return NULL;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ShardedTyrant_putlist(ShardedTyrant *self, PyObject *args)
+{
+    TCLIST *list;
+    PyObject *items;
+    
+    if (!PyArg_ParseTuple(args, "O:putlist", &items))
+    {
+        return NULL;
+    }
+    
+    list = pyitems2tclist(items);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    return shard_misclist(self, list, 2, "putlist");
+}
+
+
+static PyObject *
+ShardedTyrant_outlist(ShardedTyrant *self, PyObject *args)
+{
+    TCLIST *list;
+    PyObject *keys;
+    
+    if (!PyArg_ParseTuple(args, "O:outlist", &keys))
+    {
+        return NULL;
+    }
+    
+    list = pystrings2tclist(keys);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    return shard_misclist(self, list, 1, "outlist");
+}
+
+
+typedef struct
+{
+    PyObject_HEAD
+    ShardedTyrant *db;
+    TCLIST *conds;
+    char *order;
+    int ordertype;
+    int max;
+    int skip;
+} ShardedQuery;
+
+
+typedef struct
+{
+    RDBQRY *q;
+    int mode;
+    TCLIST *results;
+    int count;
+    bool success;
+} ShardQueryTask;
+
+
+enum
+{
+    SHARDQRYSEARCH,
+    SHARDQRYSEARCHGET,
+    SHARDQRYSEARCHOUT,
+    SHARDQRYSEARCHCOUNT
+};
+
+
+static PyTypeObject ShardedQueryType;
+
+
+static void *
+shard_query_task(void *arg)
+{
+    ShardQueryTask *task = arg;
+    TCLIST *args, *results;
+    
+    switch (task->mode)
+    {
+        case SHARDQRYSEARCH:
+            task->results = tcrdbqrysearch(task->q);
+            task->success = task->results != NULL;
+            break;
+        case SHARDQRYSEARCHGET:
+            task->results = tcrdbqrysearchget(task->q);
+            task->success = task->results != NULL;
+            break;
+        case SHARDQRYSEARCHOUT:
+            task->success = tcrdbqrysearchout(task->q);
+            break;
+        case SHARDQRYSEARCHCOUNT:
+            /* tcrdbqrysearchcount() cannot tell a failure from an empty
+               result, so issue the count request directly. */
+            args = tclistdup(task->q->args);
+            tclistpush2(args, "count");
+            results = tcrdbmisc(task->q->rdb, "search", RDBMONOULOG, args);
+            tclistdel(args);
+            task->success = results != NULL;
+            if (results)
+            {
+                task->count = tclistnum(results) > 0 ?
+                    (int) tcatoi(tclistval2(results, 0)) : 0;
+                tclistdel(results);
+            }
+            break;
+    }
+    
+    return NULL;
+}
+
+
+/*
+ * Find the value of column `name` in a search result row, which is laid
+ * out as zero-separated name/value pairs.
+ */
+static const char *
+row_column(const char *rbuf, int rsiz, const char *name, int *vsiz)
+{
+    const char *ep = rbuf + rsiz;
+    const char *kp, *vp;
+    
+    while (rbuf < ep)
+    {
+        kp = rbuf;
+        rbuf += strlen(rbuf) + 1;
+        if (rbuf >= ep)
+        {
+            break;
+        }
+        vp = rbuf;
+        *vsiz = strlen(vp);
+        rbuf += *vsiz + 1;
+        
+        if (!strcmp(kp, name))
+        {
+            return vp;
+        }
+    }
+    
+    *vsiz = 0;
+    return "";
+}
+
+
+static int
+row_compare(const char *a, int asiz, const char *b, int bsiz, const char *order, int type)
+{
+    int avsiz, bvsiz, cmp;
+    const char *av, *bv;
+    double an, bn;
+    
+    av = row_column(a, asiz, order, &avsiz);
+    bv = row_column(b, bsiz, order, &bvsiz);
+    
+    switch (type)
+    {
+        case RDBQONUMASC:
+        case RDBQONUMDESC:
+            an = tcatof(av);
+            bn = tcatof(bv);
+            cmp = an < bn ? -1 : (an > bn ? 1 : 0);
+            break;
+        default:
+            cmp = memcmp(av, bv, avsiz < bvsiz ? avsiz : bvsiz);
+            if (cmp == 0)
+            {
+                cmp = avsiz - bvsiz;
+            }
+            break;
+    }
+    
+    return (type == RDBQOSTRDESC || type == RDBQONUMDESC) ? -cmp : cmp;
+}
+
+
+static void
+ShardedQuery_dealloc(ShardedQuery *self)
+{
+    if (self->conds)
+    {
+        tclistdel(self->conds);
+    }
+    free(self->order);
+    Py_XDECREF(self->db);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+ShardedQuery_addcond(ShardedQuery *self, PyObject *args, PyObject *kwargs)
+{
+    const char *name, *expr;
+    int op = 0;
+    TCXSTR *cond;
+    
+    name = expr = NULL;
+    
+    static char *kwlist[] = {"name", "op", "expr", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|s:addcond", kwlist,
+        &name, &op, &expr))
+    {
+        return NULL;
+    }
+    
+    /* Conditions are stored as name\0op\0expr and replayed on each node. */
+    cond = tcxstrnew();
+    tcxstrcat(cond, name, strlen(name) + 1);
+    tcxstrprintf(cond, "%d", op);
+    tcxstrcat(cond, "", 1);
+    tcxstrcat2(cond, expr ? expr : "");
+    tclistpush(self->conds, tcxstrptr(cond), tcxstrsize(cond));
+    tcxstrdel(cond);
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ShardedQuery_setorder(ShardedQuery *self, PyObject *args)
+{
+    const char *name;
+    int type;
+    
+    if (!PyArg_ParseTuple(args, "si:setorder", &name, &type))
+    {
+        return NULL;
+    }
+    
+    free(self->order);
+    self->order = strdup(name);
+    self->ordertype = type;
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ShardedQuery_setlimit(ShardedQuery *self, PyObject *args)
+{
+    int max, skip;
+    max = skip = -1;
+    
+    if (!PyArg_ParseTuple(args, "ii:setlimit", &max, &skip))
+    {
+        return NULL;
+    }
+    
+    self->max = max;
+    self->skip = skip > 0 ? skip : 0;
+    
+    Py_RETURN_NONE;
+}
+
+
+/*
+ * Build one RDBQRY per node from the recorded conditions and run them all
+ * concurrently. Each node is asked for max + skip rows without any offset,
+ * since the global offset can only be applied after merging. The number of
+ * tasks is stored in *num, since nodes may be added while the GIL is released.
+ */
+static ShardQueryTask *
+shard_query_run(ShardedQuery *self, int mode, int *num)
+{
+    int i, j, csiz, nnodes;
+    const char *cbuf, *name, *op, *expr;
+    ShardQueryTask *tasks;
+    
+    nnodes = self->db->nnodes;
+    tasks = calloc(nnodes > 0 ? nnodes : 1, sizeof(ShardQueryTask));
+    
+    if (!tasks)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate shard tasks.");
+        return NULL;
+    }
+    
+    for (i=0; i<nnodes; i++)
+    {
+        tasks[i].mode = mode;
+        tasks[i].q = tcrdbqrynew(self->db->nodes[i].db);
+        
+        if (!tasks[i].q)
+        {
+            raise_tyrant_error(self->db->nodes[i].db);
+            for (j=0; j<i; j++)
+            {
+                tcrdbqrydel(tasks[j].q);
+            }
+            free(tasks);
+            return NULL;
+        }
+        
+        for (j=0; j<tclistnum(self->conds); j++)
+        {
+            cbuf = tclistval(self->conds, j, &csiz);
+            name = cbuf;
+            op = name + strlen(name) + 1;
+            expr = op + strlen(op) + 1;
+            tcrdbqryaddcond(tasks[i].q, name, (int) tcatoi(op), expr);
+        }
+        
+        if (self->order)
+        {
+            tcrdbqrysetorder(tasks[i].q, self->order, self->ordertype);
+        }
+        
+        if (self->max >= 0)
+        {
+            tcrdbqrysetlimit(tasks[i].q, self->max + self->skip, 0);
+        }
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    run_parallel(shard_query_task, tasks, sizeof(ShardQueryTask), nnodes);
+    Py_END_ALLOW_THREADS
+    
+    *num = nnodes;
+    return tasks;
+}
+
+
+static void
+shard_query_tasks_del(ShardQueryTask *tasks, int num)
+{
+    int i;
+    
+    for (i=0; i<num; i++)
+    {
+        if (tasks[i].results)
+        {
+            tclistdel(tasks[i].results);
+        }
+        tcrdbqrydel(tasks[i].q);
+    }
+    
+    free(tasks);
+}
+
+
+static bool
+shard_query_check(ShardQueryTask *tasks, int num)
+{
+    int i;
+    
+    for (i=0; i<num; i++)
+    {
+        if (!tasks[i].success)
+        {
+            raise_tyrant_error(tasks[i].q->rdb);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+
+/*
+ * k-way merge of the per-node result lists. Each list is already sorted by
+ * the server, so only the current head of each list needs comparing. The
+ * global offset and limit are applied as rows come out of the merge.
+ * Returns a new list of row pointers into the node results.
+ */
+static PyObject *
+shard_query_merge(ShardedQuery *self, ShardQueryTask *tasks, int nnodes,
+                  bool keysonly)
+{
+    int i, best, bsiz, hsiz, taken = 0, emitted = 0;
+    int *heads;
+    const char *bbuf, *hbuf;
+    PyObject *pylist, *item;
+    
+    heads = calloc(nnodes > 0 ? nnodes : 1, sizeof(int));
+    pylist = PyList_New(0);
+    
+    if (!heads || !pylist)
+    {
+        free(heads);
+        Py_XDECREF(pylist);
+        return PyErr_NoMemory();
+    }
+    
+    while (self->max < 0 || emitted < self->max)
+    {
+        best = -1;
+        bbuf = NULL;
+        bsiz = 0;
+        
+        for (i=0; i<nnodes; i++)
+        {
+            if (heads[i] >= tclistnum(tasks[i].results))
+            {
+                continue;
+            }
+            
+            hbuf = tclistval(tasks[i].results, heads[i], &hsiz);
+            
+            if (best < 0 || (self->order && !keysonly &&
+                row_compare(hbuf, hsiz, bbuf, bsiz, self->order, self->ordertype) < 0))
+            {
+                best = i;
+                bbuf = hbuf;
+                bsiz = hsiz;
+            }
+        }
+        
+        if (best < 0)
+        {
+            break;
+        }
+        
+        heads[best]++;
+        
+        if (taken++ < self->skip)
+        {
+            continue;
+        }
+        
+        if (keysonly)
+        {
+            item = PyString_FromStringAndSize(bbuf, bsiz);
+        }
+        else
+        {
+            item = pycols2pydict(bbuf, bsiz, NULL);
+        }
+        
+        if (!item || PyList_Append(pylist, item) != 0)
+        {
+            Py_XDECREF(item);
+            Py_DECREF(pylist);
+            free(heads);
+            return NULL;
+        }
+        
+        Py_DECREF(item);
+        emitted++;
+    }
+    
+    free(heads);
+    
+    return pylist;
+}
+
+
+static PyObject *
+ShardedQuery_searchget(ShardedQuery *self)
+{
+    int ntasks;
+    ShardQueryTask *tasks;
+    PyObject *pylist = NULL;
+    
+    tasks = shard_query_run(self, SHARDQRYSEARCHGET, &ntasks);
+    
+    if (!tasks)
+    {
+        return NULL;
+    }
+    
+    if (shard_query_check(tasks, ntasks))
+    {
+        pylist = shard_query_merge(self, tasks, ntasks, false);
+    }
+    
+    shard_query_tasks_del(tasks, ntasks);
+    
+    return pylist;
+}
+
+
+static PyObject *
+ShardedQuery_search(ShardedQuery *self)
+{
+    int i, ntasks;
+    ShardQueryTask *tasks;
+    PyObject *rows, *pylist, *key;
+    
+    /* Ordered results need the order column to merge on, so fetch rows and
+       keep only their primary keys. */
+    if (self->order)
+    {
+        rows = ShardedQuery_searchget(self);
+        
+        if (!rows)
+        {
+            return NULL;
+        }
+        
+        pylist = PyList_New(PyList_GET_SIZE(rows));
+        
+        for (i=0; pylist && i<PyList_GET_SIZE(rows); i++)
+        {
+            key = PyDict_GetItemString(PyList_GET_ITEM(rows, i), "");
+            if (!key)
+            {
+                key = Py_None;
+            }
+            Py_INCREF(key);
+            PyList_SET_ITEM(pylist, i, key);
+        }
+        
+        Py_DECREF(rows);
+        return pylist;
+    }
+    
+    tasks = shard_query_run(self, SHARDQRYSEARCH, &ntasks);
+    
+    if (!tasks)
+    {
+        return NULL;
+    }
+    
+    pylist = NULL;
+    
+    if (shard_query_check(tasks, ntasks))
+    {
+        pylist = shard_query_merge(self, tasks, ntasks, true);
+    }
+    
+    shard_query_tasks_del(tasks, ntasks);
+    
+    return pylist;
+}
+
+
+static PyObject *
+ShardedQuery_searchcount(ShardedQuery *self)
+{
+    int i, ntasks, n = 0;
+    bool success;
+    ShardQueryTask *tasks;
+    
+    tasks = shard_query_run(self, SHARDQRYSEARCHCOUNT, &ntasks);
+    
+    if (!tasks)
+    {
+        return NULL;
+    }
+    
+    success = shard_query_check(tasks, ntasks);
+    
+    for (i=0; success && i<ntasks; i++)
+    {
+        n += tasks[i].count;
+    }
+    
+    shard_query_tasks_del(tasks, ntasks);
+    
+    if (!success)
+    {
+        return NULL;
+    }
+    
+    return Py_BuildValue("i", n);
+}
+
+
+static PyObject *
+ShardedQuery_searchout(ShardedQuery *self)
+{
+    int ntasks;
+    bool success;
+    ShardQueryTask *tasks;
+    
+    tasks = shard_query_run(self, SHARDQRYSEARCHOUT, &ntasks);
+    
+    if (!tasks)
+    {
+        return NULL;
+    }
+    
+    success = shard_query_check(tasks, ntasks);
+    PyErr_Clear();
+    
+    shard_query_tasks_del(tasks, ntasks);
+    
+    return Py_BuildValue("i", success);
+}
+
+
+static PyMethodDef ShardedQuery_methods[] = 
+{
+    {
+        "addcond", (PyCFunction) ShardedQuery_addcond,
+        METH_VARARGS | METH_KEYWORDS,
+        "Add a condition."
+    },
+    
+    {
+        "setorder", (PyCFunction) ShardedQuery_setorder,
+        METH_VARARGS,
+        "Set the column and direction to order by."
+    },
+    
+    {
+        "setlimit", (PyCFunction) ShardedQuery_setlimit,
+        METH_VARARGS,
+        "Set the offset and limit of the merged results."
+    },
+    
+    {
+        "search", (PyCFunction) ShardedQuery_search,
+        METH_NOARGS,
+        "Run the query on every node. Returns the keys of matching records"
+    },
+    
+    {
+        "searchget", (PyCFunction) ShardedQuery_searchget,
+        METH_NOARGS,
+        "Run the query on every node. Returns the merged matching records."
+    },
+    
+    {
+        "searchout", (PyCFunction) ShardedQuery_searchout,
+        METH_NOARGS,
+        "Remove all matching records on every node."
+    },
+    
+    {
+        "searchcount", (PyCFunction) ShardedQuery_searchcount,
+        METH_NOARGS,
+        "Get a count of matching records across every node."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject ShardedQueryType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.ShardedQuery",          /* tp_name */
+  sizeof(ShardedQuery),                        /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)ShardedQuery_dealloc,            /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  TyrantQuery_Hash,                            /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Tyrant query run on every node of a sharded database", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  0,                                           /* tp_iter */
+  0,                                           /* tp_iternext */
+  ShardedQuery_methods,                        /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  0,                                           /* tp_new */
+};
+
+
+static PyObject *
+ShardedTyrant_tblquery(ShardedTyrant *self)
+{
+    ShardedQuery *query;
+    
+    query = PyObject_New(ShardedQuery, &ShardedQueryType);
+    
+    if (!query)
+    {
+        return NULL;
+    }
+    
+    Py_INCREF(self);
+    query->db = self;
+    query->order = NULL;
+    query->ordertype = 0;
+    query->max = -1;
+    query->skip = 0;
+    query->conds = tclistnew();
+    
+    if (!query->conds)
+    {
+        Py_DECREF(query);
+        return PyErr_NoMemory();
+    }
+    
+    return (PyObject *) query;
+}
+
+
+static PyMethodDef ShardedTyrant_methods[] = 
+{
+    {
+        "add_node", (PyCFunction) ShardedTyrant_add_node,
+        METH_VARARGS,
+        "Connect to another server and add it to the hash ring."
+    },
+    
+    {
+        "locate", (PyCFunction) ShardedTyrant_locate,
+        METH_VARARGS,
+        "Get the (host, port) of the node that owns a key."
+    },
+    
+    {
+        "put", (PyCFunction) ShardedTyrant_put,
+        METH_VARARGS,
+        "Store a record. Overwrite existing record."
+    },
+    
+    {
+        "putkeep", (PyCFunction) ShardedTyrant_putkeep,
+        METH_VARARGS,
+        "Store a record. Don't overwrite an existing record."
+    },
+    
+    {
+        "putcat", (PyCFunction) ShardedTyrant_putcat,
+        METH_VARARGS,
+        "Concatenate value on the end of a record. Creates the record if it doesn't exist."
+    },
+    
+    {
+        "out", (PyCFunction) ShardedTyrant_out,
+        METH_VARARGS,
+        "Remove a record."
+    },
+    
+    {
+        "get", (PyCFunction) ShardedTyrant_get,
+        METH_VARARGS | METH_KEYWORDS,
+        "Retrieve a record. If none is found None or the supplied default value is returned."
+    },
+    
+    {
+        "mget", (PyCFunction) ShardedTyrant_mget,
+        METH_VARARGS,
+        "Retrieve multiple records, querying every node in parallel."
+    },
+    
+    {
+        "putlist", (PyCFunction) ShardedTyrant_putlist,
+        METH_VARARGS,
+        "Store multiple records, writing to every node in parallel."
+    },
+    
+    {
+        "outlist", (PyCFunction) ShardedTyrant_outlist,
+        METH_VARARGS,
+        "Remove multiple records, writing to every node in parallel."
+    },
+    
+    {
+        "addint", (PyCFunction) ShardedTyrant_addint,
+        METH_VARARGS,
+        "Add an integer to the selected record."
+    },
+    
+    {
+        "adddouble", (PyCFunction) ShardedTyrant_adddouble,
+        METH_VARARGS,
+        "Add a double to the selected record."
+    },
+    
+    {
+        "tblput", (PyCFunction) ShardedTyrant_tblput,
+        METH_VARARGS,
+        "Store a table record. Overwrite existing record."
+    },
+    
+    {
+        "tblout", (PyCFunction) ShardedTyrant_tblout,
+        METH_VARARGS,
+        "Remove a table record."
+    },
+    
+    {
+        "tblget", (PyCFunction) ShardedTyrant_tblget,
+        METH_VARARGS,
+        "Retrieve a table record. If none is found None is returned."
+    },
+    
+    {
+        "tblquery", (PyCFunction) ShardedTyrant_tblquery,
+        METH_NOARGS,
+        "Get a query object that searches every node and merges the results."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject ShardedTyrantType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.ShardedTyrant",         /* tp_name */
+  sizeof(ShardedTyrant),                       /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)ShardedTyrant_dealloc,           /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  Tyrant_Hash,                                 /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
+  "Tyrant client sharded over several servers by consistent hashing", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  0,                                           /* tp_iter */
+  0,                                           /* tp_iternext */
+  ShardedTyrant_methods,                       /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  ShardedTyrant_new,                           /* tp_new */
+};
+
+
+/*
+ * Binary protocol codec. Requests are encoded into a TCXSTR and replies are
+ * decoded from raw bytes, with no I/O of its own, so the same code serves
+ * event-loop driven clients and pipelined requests on a Tyrant connection.
+ */
+
+enum
+{
+    REPLYCODE,          /* status byte only */
+    REPLYKEEP,          /* status byte only, failure means the record exists */
+    REPLYNOREC,         /* status byte only, failure means no such record */
+    REPLYVALUE,         /* sized value, None on failure */
+    REPLYMGET,          /* counted key/value pairs */
+    REPLYINT32,         /* 32-bit number */
+    REPLYVSIZ,          /* 32-bit number, -1 on failure */
+    REPLYINT64,         /* 64-bit number */
+    REPLYDOUBLE,        /* integral and fractional 64-bit parts */
+    REPLYLIST,          /* counted list of sized strings */
+    REPLYCOLS,          /* REPLYLIST of alternating column names and values */
+    REPLYROWS           /* REPLYLIST of table search rows */
+};
+
+
+static void
+xstrint32(TCXSTR *xstr, uint32_t num)
+{
+    unsigned char buf[4];
+    
+    buf[0] = (unsigned char) (num >> 24);
+    buf[1] = (unsigned char) (num >> 16);
+    buf[2] = (unsigned char) (num >> 8);
+    buf[3] = (unsigned char) num;
+    tcxstrcat(xstr, buf, 4);
+}
+
+
+static void
+xstrint64(TCXSTR *xstr, uint64_t num)
+{
+    xstrint32(xstr, (uint32_t) (num >> 32));
+    xstrint32(xstr, (uint32_t) num);
+}
+
+
+static uint32_t
+readint32(const char *buf)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+        ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+
+static uint64_t
+readint64(const char *buf)
+{
+    return ((uint64_t) readint32(buf) << 32) | (uint64_t) readint32(buf + 4);
+}
+
+
+static void
+codec_command(TCXSTR *xstr, int cmd)
+{
+    unsigned char buf[2];
+    
+    buf[0] = TTMAGICNUM;
+    buf[1] = (unsigned char) cmd;
+    tcxstrcat(xstr, buf, 2);
+}
+
+
+static void
+codec_encode_key(TCXSTR *xstr, int cmd, const char *kbuf, int ksiz)
+{
+    codec_command(xstr, cmd);
+    xstrint32(xstr, ksiz);
+    tcxstrcat(xstr, kbuf, ksiz);
+}
+
+
+static void
+codec_encode_put(TCXSTR *xstr, int cmd, const char *kbuf, int ksiz,
+    const char *vbuf, int vsiz)
+{
+    codec_command(xstr, cmd);
+    xstrint32(xstr, ksiz);
+    xstrint32(xstr, vsiz);
+    tcxstrcat(xstr, kbuf, ksiz);
+    tcxstrcat(xstr, vbuf, vsiz);
+}
+
+
+static void
+codec_encode_addint(TCXSTR *xstr, const char *kbuf, int ksiz, int num)
+{
+    codec_command(xstr, TTCMDADDINT);
+    xstrint32(xstr, ksiz);
+    xstrint32(xstr, (uint32_t) num);
+    tcxstrcat(xstr, kbuf, ksiz);
+}
+
+
+static void
+codec_encode_adddouble(TCXSTR *xstr, const char *kbuf, int ksiz, double num)
+{
+    double integ, fract;
+    
+    fract = modf(num, &integ);
+    codec_command(xstr, TTCMDADDDOUBLE);
+    xstrint32(xstr, ksiz);
+    xstrint64(xstr, (uint64_t) (int64_t) integ);
+    xstrint64(xstr, (uint64_t) (int64_t) (fract * 1e12));
+    tcxstrcat(xstr, kbuf, ksiz);
+}
+
+
+static void
+codec_encode_mget(TCXSTR *xstr, const TCLIST *keys)
+{
+    int i, ksiz;
+    const char *kbuf;
+    
+    codec_command(xstr, TTCMDMGET);
+    xstrint32(xstr, tclistnum(keys));
+    
+    for (i=0; i<tclistnum(keys); i++)
+    {
+        kbuf = tclistval(keys, i, &ksiz);
+        xstrint32(xstr, ksiz);
+        tcxstrcat(xstr, kbuf, ksiz);
+    }
+}
+
+
+static void
+codec_encode_misc(TCXSTR *xstr, const char *name, int opts, const TCLIST *args)
+{
+    int i, asiz;
+    const char *abuf;
+    
+    codec_command(xstr, TTCMDMISC);
+    xstrint32(xstr, strlen(name));
+    xstrint32(xstr, opts);
+    xstrint32(xstr, tclistnum(args));
+    tcxstrcat2(xstr, name);
+    
+    for (i=0; i<tclistnum(args); i++)
+    {
+        abuf = tclistval(args, i, &asiz);
+        xstrint32(xstr, asiz);
+        tcxstrcat(xstr, abuf, asiz);
+    }
+}
+
+
+/*
+ * Work out how many bytes the next reply of the given kind occupies.
+ * Returns 0 while the buffer does not hold the whole reply yet and -1 if it
+ * is malformed. Touches no Python objects, so it is safe without the GIL.
+ */
+static int64_t
+codec_reply_size(int kind, const char *buf, int64_t size)
+{
+    int64_t pos, n, i, esiz;
+    
+    if (size < 1)
+    {
+        return 0;
+    }
+    
+    if (buf[0] != 0)
+    {
+        return 1;
+    }
+    
+    switch (kind)
+    {
+        case REPLYCODE:
+        case REPLYKEEP:
+        case REPLYNOREC:
+            return 1;
+        case REPLYINT32:
+        case REPLYVSIZ:
+            return size >= 5 ? 5 : 0;
+        case REPLYINT64:
+            return size >= 9 ? 9 : 0;
+        case REPLYDOUBLE:
+            return size >= 17 ? 17 : 0;
+        case REPLYVALUE:
+            if (size < 5)
+            {
+                return 0;
+            }
+            esiz = (int32_t) readint32(buf + 1);
+            if (esiz < 0)
+            {
+                return -1;
+            }
+            return size >= 5 + esiz ? 5 + esiz : 0;
+        case REPLYMGET:
+            if (size < 5)
+            {
+                return 0;
+            }
+            n = (int32_t) readint32(buf + 1);
+            pos = 5;
+            for (i=0; i<n; i++)
+            {
+                if (size < pos + 8)
+                {
+                    return 0;
+                }
+                esiz = (int64_t) readint32(buf + pos) + readint32(buf + pos + 4);
+                pos += 8 + esiz;
+            }
+            return size >= pos ? pos : 0;
+        case REPLYLIST:
+        case REPLYCOLS:
+        case REPLYROWS:
+            if (size < 5)
+            {
+                return 0;
+            }
+            n = (int32_t) readint32(buf + 1);
+            pos = 5;
+            for (i=0; i<n; i++)
+            {
+                if (size < pos + 4)
+                {
+                    return 0;
+                }
+                pos += 4 + readint32(buf + pos);
+            }
+            return size >= pos ? pos : 0;
+    }
+    
+    return -1;
+}
+
+
+/*
+ * Turn one complete reply into a Python object. Failed calls come back as
+ * exception instances rather than being raised, so one failure does not
+ * lose the replies queued behind it.
+ */
+static PyObject *
+codec_reply_decode(int kind, const char *buf, int64_t size)
+{
+    int64_t pos, i, n;
+    int ksiz, vsiz;
+    PyObject *result, *key, *value;
+    
+    if (buf[0] != 0)
+    {
+        switch (kind)
+        {
+            case REPLYVALUE:
+            case REPLYCOLS:
+                Py_RETURN_NONE;
+            case REPLYVSIZ:
+                return PyInt_FromLong(-1);
+            case REPLYNOREC:
+                return PyObject_CallFunction(PyExc_KeyError, "s", tcrdberrmsg(TTENOREC));
+            case REPLYKEEP:
+                return PyObject_CallFunction(TyrantError, "s", tcrdberrmsg(TTEKEEP));
+            default:
+                return PyObject_CallFunction(TyrantError, "s", tcrdberrmsg(TTEMISC));
+        }
+    }
+    
+    switch (kind)
+    {
+        case REPLYCODE:
+        case REPLYKEEP:
+        case REPLYNOREC:
+            Py_RETURN_NONE;
+        case REPLYINT32:
+        case REPLYVSIZ:
+            return PyInt_FromLong((long) (int32_t) readint32(buf + 1));
+        case REPLYINT64:
+            return PyLong_FromLongLong((long long) readint64(buf + 1));
+        case REPLYDOUBLE:
+            return PyFloat_FromDouble((double) (int64_t) readint64(buf + 1) +
+                (double) (int64_t) readint64(buf + 9) / 1e12);
+        case REPLYVALUE:
+            return PyString_FromStringAndSize(buf + 5, (Py_ssize_t) readint32(buf + 1));
+        case REPLYMGET:
+            result = PyDict_New();
+            n = (int32_t) readint32(buf + 1);
+            pos = 5;
+            for (i=0; result && i<n; i++)
+            {
+                ksiz = (int) readint32(buf + pos);
+                vsiz = (int) readint32(buf + pos + 4);
+                key = PyString_FromStringAndSize(buf + pos + 8, ksiz);
+                value = PyString_FromStringAndSize(buf + pos + 8 + ksiz, vsiz);
+                if (!key || !value || PyDict_SetItem(result, key, value) != 0)
+                {
+                    Py_CLEAR(result);
+                }
+                Py_XDECREF(key);
+                Py_XDECREF(value);
+                pos += 8 + ksiz + vsiz;
+            }
+            return result;
+        case REPLYLIST:
+        case REPLYCOLS:
+        case REPLYROWS:
+            n = (int32_t) readint32(buf + 1);
+            result = kind == REPLYCOLS ? _PyDict_NewPresized(n / 2) : PyList_New(0);
+            pos = 5;
+            for (i=0; result && i<n; i++)
+            {
+                vsiz = (int) readint32(buf + pos);
+                pos += 4;
+                if (kind == REPLYCOLS)
+                {
+                    if (i + 1 >= n)
+                    {
+                        break;
+                    }
+                    ksiz = vsiz;
+                    key = pycolname(buf + pos, ksiz);
+                    pos += ksiz;
+                    vsiz = (int) readint32(buf + pos);
+                    pos += 4;
+                    value = PyString_FromStringAndSize(buf + pos, vsiz);
+                    if (!key || !value || PyDict_SetItem(result, key, value) != 0)
+                    {
+                        Py_CLEAR(result);
+                    }
+                    Py_XDECREF(key);
+                    Py_XDECREF(value);
+                    i++;
+                }
+                else
+                {
+                    if (kind == REPLYROWS)
+                    {
+                        value = pycols2pydict(buf + pos, vsiz, NULL);
+                    }
+                    else
+                    {
+                        value = PyString_FromStringAndSize(buf + pos, vsiz);
+                    }
+                    if (!value || PyList_Append(result, value) != 0)
+                    {
+                        Py_CLEAR(result);
+                    }
+                    Py_XDECREF(value);
+                }
+                pos += vsiz;
+            }
+            return result;
+    }
+    
+    PyErr_SetString(TyrantError, "Unknown reply type.");
+    return NULL;
+}
+
+
+/*
+ * Append the misc arguments of a table query to `args`: the query's own
+ * conditions followed by "get" when whole rows are wanted.
+ */
+static void
+codec_query_args(TCLIST *args, RDBQRY *q, bool get)
+{
+    int i, asiz;
+    const char *abuf;
+    
+    for (i=0; i<tclistnum(q->args); i++)
+    {
+        abuf = tclistval(q->args, i, &asiz);
+        tclistpush(args, abuf, asiz);
+    }
+    
+    if (get)
+    {
+        tclistpush2(args, "get");
+    }
+}
+
+
+typedef struct
+{
+    PyObject_HEAD
+    TCXSTR *rbuf;
+    int64_t rpos;
+    int *kinds;
+    int khead;
+    int knum;
+    int kcap;
+} TyrantCodec;
+
+
+static PyTypeObject TyrantCodecType;
+
+
+static bool
+codec_expect(TyrantCodec *self, int kind)
+{
+    int *kinds;
+    int i;
+    
+    if (self->knum == self->kcap)
+    {
+        kinds = malloc(sizeof(int) * (self->kcap * 2 + 8));
+        if (!kinds)
+        {
+            PyErr_NoMemory();
+            return false;
+        }
+        for (i=0; i<self->knum; i++)
+        {
+            kinds[i] = self->kinds[(self->khead + i) % self->kcap];
+        }
+        free(self->kinds);
+        self->kinds = kinds;
+        self->khead = 0;
+        self->kcap = self->kcap * 2 + 8;
+    }
+    
+    self->kinds[(self->khead + self->knum) % self->kcap] = kind;
+    self->knum++;
+    
+    return true;
+}
+
+
+static PyObject *
+codec_frame(TyrantCodec *self, TCXSTR *xstr, int kind)
+{
+    PyObject *frame;
+    
+    if (kind >= 0 && !codec_expect(self, kind))
+    {
+        tcxstrdel(xstr);
+        return NULL;
+    }
+    
+    frame = PyString_FromStringAndSize(tcxstrptr(xstr), tcxstrsize(xstr));
+    tcxstrdel(xstr);
+    
+    return frame;
+}
+
+
+static void
+TyrantCodec_dealloc(TyrantCodec *self)
+{
+    if (self->rbuf)
+    {
+        tcxstrdel(self->rbuf);
+    }
+    free(self->kinds);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+TyrantCodec_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    TyrantCodec *self;
+    
+    self = (TyrantCodec *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate TyrantCodec instance.");
+        return NULL;
+    }
+    
+    self->rbuf = tcxstrnew();
+    
+    return (PyObject *) self;
+}
+
+
+static PyObject *
+codec_put(TyrantCodec *self, PyObject *args, const char *format, int cmd)
+{
+    char *kbuf;
+    int ksiz;
+    Py_buffer value;
+    TCXSTR *xstr;
+    
+    if (!PyArg_ParseTuple(args, format, &kbuf, &ksiz, &value))
+    {
+        return NULL;
+    }
+    
+    xstr = tcxstrnew();
+    codec_encode_put(xstr, cmd, kbuf, ksiz, value.buf, (int) value.len);
+    PyBuffer_Release(&value);
+    
+    return codec_frame(self, xstr,
+        cmd == TTCMDPUTNR ? -1 : (cmd == TTCMDPUTKEEP ? REPLYKEEP : REPLYCODE));
+}
+
+
+static PyObject *
+TyrantCodec_put(TyrantCodec *self, PyObject *args)
+{
+    return codec_put(self, args, "s#s*:put", TTCMDPUT);
+}
+
+
+static PyObject *
+TyrantCodec_putkeep(TyrantCodec *self, PyObject *args)
+{
+    return codec_put(self, args, "s#s*:putkeep", TTCMDPUTKEEP);
+}
+
+
+static PyObject *
+TyrantCodec_putcat(TyrantCodec *self, PyObject *args)
+{
+    return codec_put(self, args, "s#s*:putcat", TTCMDPUTCAT);
+}
+
+
+static PyObject *
+TyrantCodec_putnr(TyrantCodec *self, PyObject *args)
+{
+    return codec_put(self, args, "s#s*:putnr", TTCMDPUTNR);
+}
+
+
+static PyObject *
+codec_key(TyrantCodec *self, PyObject *args, const char *format, int cmd, int kind)
+{
+    char *kbuf;
+    int ksiz;
+    TCXSTR *xstr;
+    
+    if (!PyArg_ParseTuple(args, format, &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    xstr = tcxstrnew();
+    codec_encode_key(xstr, cmd, kbuf, ksiz);
+    
+    return codec_frame(self, xstr, kind);
+}
+
+
+static PyObject *
+TyrantCodec_out(TyrantCodec *self, PyObject *args)
+{
+    return codec_key(self, args, "s#:out", TTCMDOUT, REPLYNOREC);
+}
+
+
+static PyObject *
+TyrantCodec_get(TyrantCodec *self, PyObject *args)
+{
+    return codec_key(self, args, "s#:get", TTCMDGET, REPLYVALUE);
+}
+
+
+static PyObject *
+TyrantCodec_vsiz(TyrantCodec *self, PyObject *args)
+{
+    return codec_key(self, args, "s#:vsiz", TTCMDVSIZ, REPLYVSIZ);
+}
+
+
+static PyObject *
+TyrantCodec_mget(TyrantCodec *self, PyObject *args)
+{
+    PyObject *keys;
+    TCLIST *list;
+    TCXSTR *xstr;
+    
+    if (!PyArg_ParseTuple(args, "O:mget", &keys))
+    {
+        return NULL;
+    }
+    
+    list = pystrings2tclist(keys);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    xstr = tcxstrnew();
+    codec_encode_mget(xstr, list);
+    tclistdel(list);
+    
+    return codec_frame(self, xstr, REPLYMGET);
+}
+
+
+static PyObject *
+TyrantCodec_addint(TyrantCodec *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz, num;
+    TCXSTR *xstr;
+    
+    if (!PyArg_ParseTuple(args, "s#i:addint", &kbuf, &ksiz, &num))
+    {
+        return NULL;
+    }
+    
+    xstr = tcxstrnew();
+    codec_encode_addint(xstr, kbuf, ksiz, num);
+    
+    return codec_frame(self, xstr, REPLYINT32);
+}
+
+
+static PyObject *
+TyrantCodec_adddouble(TyrantCodec *self, PyObject *args)
+{
+    char *kbuf;
+    int ksiz;
+    double num;
+    TCXSTR *xstr;
+    
+    if (!PyArg_ParseTuple(args, "s#d:adddouble", &kbuf, &ksiz, &num))
+    {
+        return NULL;
+    }
+    
+    xstr = tcxstrnew();
+    codec_encode_adddouble(xstr, kbuf, ksiz, num);
+    
+    return codec_frame(self, xstr, REPLYDOUBLE);
+}
+
+
+static PyObject *
+codec_misc(TyrantCodec *self, const char *name, int opts, TCLIST *list, int kind)
+{
+    TCXSTR *xstr;
+    
+    xstr = tcxstrnew();
+    codec_encode_misc(xstr, name, opts, list);
+    tclistdel(list);
+    
+    return codec_frame(self, xstr, kind);
+}
+
+
+static PyObject *
+TyrantCodec_misc(TyrantCodec *self, PyObject *args, PyObject *kwargs)
+{
+    const char *name;
+    int opts = 0;
+    TCLIST *list;
+    PyObject *pyargs = NULL;
+    
+    static char *kwlist[] = {"name", "args", "opts", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|Oi:misc", kwlist,
+        &name, &pyargs, &opts))
+    {
+        return NULL;
+    }
+    
+    list = pyargs ? pystrings2tclist(pyargs) : tclistnew2(1);
+    
+    if (!list)
+    {
+        return NULL;
+    }
+    
+    return codec_misc(self, name, opts, list, REPLYLIST);
+}
+
+
+static PyObject *
+codec_tblput(TyrantCodec *self, PyObject *args, const char *format, const char *name)
+{
+    char *kbuf;
+    int ksiz, csiz;
+    const char *cbuf;
+    PyObject *dict;
+    TCMAP *cols;
+    TCLIST *list;
+    
+    if (!PyArg_ParseTuple(args, format, &kbuf, &ksiz, &dict))
+    {
+        return NULL;
+    }
+    
+    cols = pydict2tcmap(dict);
+    
+    if (!cols)
+    {
+        return NULL;
+    }
+    
+    list = tclistnew();
+    tclistpush(list, kbuf, ksiz);
+    tcmapiterinit(cols);
+    
+    while ((cbuf = tcmapiternext(cols, &csiz)) != NULL)
+    {
+        tclistpush(list, cbuf, csiz);
+        cbuf = tcmapiterval(cbuf, &csiz);
+        tclistpush(list, cbuf, csiz);
+    }
+    
+    tcmapdel(cols);
+    
+    return codec_misc(self, name, 0, list, REPLYCODE);
+}
+
+
+static PyObject *
+TyrantCodec_tblput(TyrantCodec *self, PyObject *args)
+{
+    return codec_tblput(self, args, "s#O:tblput", "put");
+}
+
+
+static PyObject *
+TyrantCodec_tblputkeep(TyrantCodec *self, PyObject *args)
+{
+    return codec_tblput(self, args, "s#O:tblputkeep", "putkeep");
+}
+
+
+static PyObject *
+TyrantCodec_tblputcat(TyrantCodec *self, PyObject *args)
+{
+    return codec_tblput(self, args, "s#O:tblputcat", "putcat");
+}
+
+
+static PyObject *
+codec_tblkey(TyrantCodec *self, PyObject *args, const char *format,
+    const char *name, int kind)
+{
+    char *kbuf;
+    int ksiz;
+    TCLIST *list;
+    
+    if (!PyArg_ParseTuple(args, format, &kbuf, &ksiz))
+    {
+        return NULL;
+    }
+    
+    list = tclistnew2(1);
+    tclistpush(list, kbuf, ksiz);
+    
+    return codec_misc(self, name, kind == REPLYCOLS ? RDBMONOULOG : 0, list, kind);
+}
+
+
+static PyObject *
+TyrantCodec_tblout(TyrantCodec *self, PyObject *args)
+{
+    return codec_tblkey(self, args, "s#:tblout", "out", REPLYCODE);
+}
+
+
+static PyObject *
+TyrantCodec_tblget(TyrantCodec *self, PyObject *args)
+{
+    return codec_tblkey(self, args, "s#:tblget", "get", REPLYCOLS);
+}
+
+
+static PyObject *
+TyrantCodec_search(TyrantCodec *self, PyObject *args, PyObject *kwargs)
+{
+    TyrantQuery *query;
+    PyObject *get = NULL;
+    TCLIST *list;
+    bool rows;
+    
+    static char *kwlist[] = {"query", "get", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|O:search", kwlist,
+        &TyrantQueryType, &query, &get))
+    {
+        return NULL;
+    }
+    
+    rows = get && PyObject_IsTrue(get);
+    list = tclistnew();
+    codec_query_args(list, query->q, rows);
+    
+    return codec_misc(self, "search", RDBMONOULOG, list, rows ? REPLYROWS : REPLYLIST);
+}
+
+
+static PyObject *
+codec_simple(TyrantCodec *self, int cmd, int kind)
+{
+    TCXSTR *xstr;
+    
+    xstr = tcxstrnew();
+    codec_command(xstr, cmd);
+    
+    return codec_frame(self, xstr, kind);
+}
+
+
+static PyObject *
+TyrantCodec_rnum(TyrantCodec *self)
+{
+    return codec_simple(self, TTCMDRNUM, REPLYINT64);
+}
+
+
+static PyObject *
+TyrantCodec_size(TyrantCodec *self)
+{
+    return codec_simple(self, TTCMDSIZE, REPLYINT64);
+}
+
+
+static PyObject *
+TyrantCodec_stat(TyrantCodec *self)
+{
+    return codec_simple(self, TTCMDSTAT, REPLYVALUE);
+}
+
+
+static PyObject *
+TyrantCodec_feed(TyrantCodec *self, PyObject *args)
+{
+    char *buf;
+    int siz;
+    int64_t rsiz, avail;
+    const char *rp;
+    PyObject *results, *reply;
+    
+    if (!PyArg_ParseTuple(args, "s#:feed", &buf, &siz))
+    {
+        return NULL;
+    }
+    
+    tcxstrcat(self->rbuf, buf, siz);
+    
+    results = PyList_New(0);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    while (self->knum > 0)
+    {
+        rp = (const char *) tcxstrptr(self->rbuf) + self->rpos;
+        avail = tcxstrsize(self->rbuf) - self->rpos;
+        rsiz = codec_reply_size(self->kinds[self->khead], rp, avail);
+        
+        if (rsiz == 0)
+        {
+            break;
+        }
+        
+        if (rsiz < 0)
+        {
+            Py_DECREF(results);
+            PyErr_SetString(TyrantError, "Malformed reply from server.");
+            return NULL;
+        }
+        
+        reply = codec_reply_decode(self->kinds[self->khead], rp, rsiz);
+        
+        if (!reply || PyList_Append(results, reply) != 0)
+        {
+            Py_XDECREF(reply);
+            Py_DECREF(results);
+            return NULL;
+        }
+        
+        Py_DECREF(reply);
+        self->rpos += rsiz;
+        self->khead = (self->khead + 1) % self->kcap;
+        self->knum--;
+    }
+    
+    /* Compact once everything buffered has been consumed. */
+    if (self->rpos == tcxstrsize(self->rbuf))
+    {
+        tcxstrclear(self->rbuf);
+        self->rpos = 0;
+    }
+    
+    return results;
+}
+
+
+static PyObject *
+TyrantCodec_pending(TyrantCodec *self)
+{
+    return PyInt_FromLong(self->knum);
+}
+
+
+static PyMethodDef TyrantCodec_methods[] = 
+{
+    {
+        "put", (PyCFunction) TyrantCodec_put,
+        METH_VARARGS,
+        "Encode a put request."
+    },
+    
+    {
+        "putkeep", (PyCFunction) TyrantCodec_putkeep,
+        METH_VARARGS,
+        "Encode a putkeep request."
+    },
+    
+    {
+        "putcat", (PyCFunction) TyrantCodec_putcat,
+        METH_VARARGS,
+        "Encode a putcat request."
+    },
+    
+    {
+        "putnr", (PyCFunction) TyrantCodec_putnr,
+        METH_VARARGS,
+        "Encode a putnr request. The server sends no reply."
+    },
+    
+    {
+        "out", (PyCFunction) TyrantCodec_out,
+        METH_VARARGS,
+        "Encode an out request."
+    },
+    
+    {
+        "get", (PyCFunction) TyrantCodec_get,
+        METH_VARARGS,
+        "Encode a get request."
+    },
+    
+    {
+        "mget", (PyCFunction) TyrantCodec_mget,
+        METH_VARARGS,
+        "Encode an mget request."
+    },
+    
+    {
+        "vsiz", (PyCFunction) TyrantCodec_vsiz,
+        METH_VARARGS,
+        "Encode a vsiz request."
+    },
+    
+    {
+        "addint", (PyCFunction) TyrantCodec_addint,
+        METH_VARARGS,
+        "Encode an addint request."
+    },
+    
+    {
+        "adddouble", (PyCFunction) TyrantCodec_adddouble,
+        METH_VARARGS,
+        "Encode an adddouble request."
+    },
+    
+    {
+        "misc", (PyCFunction) TyrantCodec_misc,
+        METH_VARARGS | METH_KEYWORDS,
+        "Encode a misc request."
+    },
+    
+    {
+        "tblput", (PyCFunction) TyrantCodec_tblput,
+        METH_VARARGS,
+        "Encode a table put request."
+    },
+    
+    {
+        "tblputkeep", (PyCFunction) TyrantCodec_tblputkeep,
+        METH_VARARGS,
+        "Encode a table putkeep request."
+    },
+    
+    {
+        "tblputcat", (PyCFunction) TyrantCodec_tblputcat,
+        METH_VARARGS,
+        "Encode a table putcat request."
+    },
+    
+    {
+        "tblout", (PyCFunction) TyrantCodec_tblout,
+        METH_VARARGS,
+        "Encode a table out request."
+    },
+    
+    {
+        "tblget", (PyCFunction) TyrantCodec_tblget,
+        METH_VARARGS,
+        "Encode a table get request."
+    },
+    
+    {
+        "search", (PyCFunction) TyrantCodec_search,
+        METH_VARARGS | METH_KEYWORDS,
+        "Encode the search for a query. Pass get=True to receive whole records."
+    },
+    
+    {
+        "rnum", (PyCFunction) TyrantCodec_rnum,
+        METH_NOARGS,
+        "Encode an rnum request."
+    },
+    
+    {
+        "size", (PyCFunction) TyrantCodec_size,
+        METH_NOARGS,
+        "Encode a size request."
+    },
+    
+    {
+        "stat", (PyCFunction) TyrantCodec_stat,
+        METH_NOARGS,
+        "Encode a stat request."
+    },
+    
+    {
+        "feed", (PyCFunction) TyrantCodec_feed,
+        METH_VARARGS,
+        "Feed bytes read from the server. Returns the replies completed so far, in request order."
+    },
+    
+    {
+        "pending", (PyCFunction) TyrantCodec_pending,
+        METH_NOARGS,
+        "Get the number of requests still waiting for a reply."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject TyrantCodecType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantCodec",           /* tp_name */
+  sizeof(TyrantCodec),                         /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantCodec_dealloc,             /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
+  "Tyrant binary protocol encoder and incremental reply decoder", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  0,                                           /* tp_iter */
+  0,                                           /* tp_iternext */
+  TyrantCodec_methods,                         /* tp_methods */
+  0,                                           /* tp_members */
+  0,                                           /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  TyrantCodec_new,                             /* tp_new */
+};
+
+
+typedef struct
+{
+    PyObject_HEAD
+    Tyrant *db;
+    TyrantCodec *codec;
+    TCXSTR *wbuf;
+    PyObject *results;
+    bool writes;
+    bool executing;
+} TyrantPipeline;
+
+
+typedef struct
+{
+    PyObject_HEAD
+    TyrantPipeline *pipeline;
+    PyObject *method;
+    bool write;
+} TyrantPipelineMethod;
+
+
+static PyTypeObject TyrantPipelineType;
+static PyTypeObject TyrantPipelineMethodType;
+
+
+/*
+ * Send a buffer of encoded requests on the connection and read until every
+ * expected reply is complete, recording the size of each in `sizes`. Bytes
+ * the socket object has already buffered are taken first, then the rest is
+ * read straight from the descriptor, waiting no longer than the socket
+ * timeout for each chunk. Must be called without the GIL.
+ */
+static int
+rdbpipeline(TCRDB *rdb, const TCXSTR *wbuf, const int *kinds, int khead,
+    int kcap, int knum, TCXSTR *rbuf, int64_t *sizes)
+{
+    int i = 0, ecode = TTESUCCESS;
+    int64_t pos = 0, rsiz;
+    ssize_t n;
+    char chunk[0x10000];
+    
+    pthread_mutex_lock(&rdb->mmtx);
+    
+    if (rdb->fd < 0 || !rdb->sock)
+    {
+        pthread_mutex_unlock(&rdb->mmtx);
+        return TTEINVALID;
+    }
+    
+    if (!ttsocksend(rdb->sock, tcxstrptr(wbuf), tcxstrsize(wbuf)))
+    {
+        pthread_mutex_unlock(&rdb->mmtx);
+        return TTESEND;
+    }
+    
+    if (rdb->sock->rp < rdb->sock->ep)
+    {
+        tcxstrcat(rbuf, rdb->sock->rp, rdb->sock->ep - rdb->sock->rp);
+        rdb->sock->rp = rdb->sock->ep = rdb->sock->buf;
+    }
+    
+    while (i < knum)
+    {
+        rsiz = codec_reply_size(kinds[(khead + i) % kcap],
+            (const char *) tcxstrptr(rbuf) + pos, tcxstrsize(rbuf) - pos);
+        
+        if (rsiz < 0)
+        {
+            ecode = TTERECV;
+            break;
+        }
+        
+        if (rsiz > 0)
+        {
+            sizes[i++] = rsiz;
+            pos += rsiz;
+            continue;
+        }
+        
+        if (!ttsockwait(rdb->sock))
+        {
+            ecode = TTERECV;
+            break;
+        }
+        
+        n = recv(rdb->fd, chunk, sizeof(chunk), 0);
+        
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            ecode = TTERECV;
+            break;
+        }
+        
+        tcxstrcat(rbuf, chunk, (int) n);
+    }
+    
+    pthread_mutex_unlock(&rdb->mmtx);
+    
+    return ecode;
+}
+
+
+static void
+TyrantPipelineMethod_dealloc(TyrantPipelineMethod *self)
+{
+    Py_XDECREF(self->pipeline);
+    Py_XDECREF(self->method);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+TyrantPipelineMethod_call(TyrantPipelineMethod *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *frame;
+    char *buf;
+    Py_ssize_t siz;
+    
+    if (self->pipeline->results)
+    {
+        PyErr_SetString(TyrantError, "Pipeline has already been executed.");
+        return NULL;
+    }
+    
+    /* execute() reads the queued reply kinds without the GIL. */
+    if (self->pipeline->executing)
+    {
+        PyErr_SetString(TyrantError, "Pipeline is being executed.");
+        return NULL;
+    }
+    
+    frame = PyObject_Call(self->method, args, kwargs);
+    
+    if (!frame)
+    {
+        return NULL;
+    }
+    
+    PyString_AsStringAndSize(frame, &buf, &siz);
+    tcxstrcat(self->pipeline->wbuf, buf, (int) siz);
+    Py_DECREF(frame);
+    
+    if (self->write)
+    {
+        self->pipeline->writes = true;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyTypeObject TyrantPipelineMethodType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantPipelineMethod",  /* tp_name */
+  sizeof(TyrantPipelineMethod),                /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantPipelineMethod_dealloc,    /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  (ternaryfunc)TyrantPipelineMethod_call,      /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Queue a command on a pipeline",             /* tp_doc */
+};
+
+
+static void
+TyrantPipeline_dealloc(TyrantPipeline *self)
+{
+    if (self->wbuf)
+    {
+        tcxstrdel(self->wbuf);
+    }
+    Py_XDECREF(self->results);
+    Py_XDECREF(self->codec);
+    Py_XDECREF(self->db);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+TyrantPipeline_getattro(TyrantPipeline *self, PyObject *name)
+{
+    PyObject *attr, *method;
+    TyrantPipelineMethod *queued;
+    const char *cname;
+    
+    attr = PyObject_GenericGetAttr((PyObject *) self, name);
+    
+    if (attr || !PyErr_ExceptionMatches(PyExc_AttributeError))
+    {
+        return attr;
+    }
+    
+    cname = PyString_AsString(name);
+    
+    if (!cname || cname[0] == '_' || !strcmp(cname, "feed") || !strcmp(cname, "pending"))
+    {
+        return NULL;
+    }
+    
+    PyErr_Clear();
+    
+    method = PyObject_GetAttr((PyObject *) self->codec, name);
+    
+    if (!method)
+    {
+        return NULL;
+    }
+    
+    queued = PyObject_New(TyrantPipelineMethod, &TyrantPipelineMethodType);
+    
+    if (!queued)
+    {
+        Py_DECREF(method);
+        return NULL;
+    }
+    
+    Py_INCREF(self);
+    queued->pipeline = self;
+    queued->method = method;
+    queued->write = strcmp(cname, "get") && strcmp(cname, "mget") &&
+        strcmp(cname, "vsiz") && strcmp(cname, "tblget") &&
+        strcmp(cname, "search") && strcmp(cname, "rnum") &&
+        strcmp(cname, "size") && strcmp(cname, "stat");
+    
+    return (PyObject *) queued;
+}
+
+
+static PyObject *
+TyrantPipeline_execute(TyrantPipeline *self)
+{
+    int i, ecode, knum;
+    int64_t pos, *sizes;
+    TyrantCodec *codec = self->codec;
+    TCXSTR *rbuf;
+    PyObject *results, *reply;
+    
+    if (self->results)
+    {
+        Py_INCREF(self->results);
+        return self->results;
+    }
+    
+    if (self->executing)
+    {
+        PyErr_SetString(TyrantError, "Pipeline is being executed.");
+        return NULL;
+    }
+    
+    knum = codec->knum;
+    results = PyList_New(knum);
+    
+    if (!results)
+    {
+        return NULL;
+    }
+    
+    if (tcxstrsize(self->wbuf) == 0)
+    {
+        self->results = results;
+        Py_INCREF(results);
+        return results;
+    }
+    
+    sizes = malloc(sizeof(int64_t) * (knum > 0 ? knum : 1));
+    rbuf = tcxstrnew();
+    
+    if (!sizes || !rbuf)
+    {
+        free(sizes);
+        if (rbuf)
+        {
+            tcxstrdel(rbuf);
+        }
+        Py_DECREF(results);
+        return PyErr_NoMemory();
+    }
+    
+    self->executing = true;
+    
+    Py_BEGIN_ALLOW_THREADS
+    ecode = rdbpipeline(self->db->db, self->wbuf, codec->kinds, codec->khead,
+        codec->kcap, knum, rbuf, sizes);
+    /* After a failed send or receive the stream is out of step with the
+       replies still owed, so the connection cannot be used again. */
+    if (ecode == TTESEND || ecode == TTERECV)
+    {
+        tcrdbclose(self->db->db);
+    }
+    Py_END_ALLOW_THREADS
+    
+    self->executing = false;
+    
+    tcxstrclear(self->wbuf);
+    
+    if (self->writes)
+    {
+        tyrant_cache_clear(self->db);
+    }
+    
+    if (ecode != TTESUCCESS)
+    {
+        codec->knum = 0;
+        codec->khead = 0;
+        free(sizes);
+        tcxstrdel(rbuf);
+        Py_DECREF(results);
+        raise_tyrant_code(ecode);
+        return NULL;
+    }
+    
+    pos = 0;
+    
+    for (i=0; i<knum; i++)
+    {
+        reply = codec_reply_decode(codec->kinds[(codec->khead + i) % codec->kcap],
+            (const char *) tcxstrptr(rbuf) + pos, sizes[i]);
+        
+        if (!reply)
+        {
+            free(sizes);
+            tcxstrdel(rbuf);
+            Py_DECREF(results);
+            return NULL;
+        }
+        
+        PyList_SET_ITEM(results, i, reply);
+        pos += sizes[i];
+    }
+    
+    codec->knum = 0;
+    codec->khead = 0;
+    
+    free(sizes);
+    tcxstrdel(rbuf);
+    
+    self->results = results;
+    Py_INCREF(results);
+    
+    return results;
+}
+
+
+static PyObject *
+TyrantPipeline_enter(TyrantPipeline *self)
+{
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+
+static PyObject *
+TyrantPipeline_exit(TyrantPipeline *self, PyObject *args)
+{
+    PyObject *type, *value, *traceback, *results;
+    
+    if (!PyArg_ParseTuple(args, "OOO:__exit__", &type, &value, &traceback))
+    {
+        return NULL;
+    }
+    
+    /* Only send the queued commands if the block finished cleanly. */
+    if (type == Py_None)
+    {
+        results = TyrantPipeline_execute(self);
+        
+        if (!results)
+        {
+            return NULL;
+        }
+        
+        Py_DECREF(results);
+    }
+    
+    Py_RETURN_FALSE;
+}
+
+
+static PyObject *
+TyrantPipeline_get_results(TyrantPipeline *self, void *closure)
+{
+    if (!self->results)
+    {
+        Py_RETURN_NONE;
+    }
+    
+    Py_INCREF(self->results);
+    return self->results;
+}
+
+
+static PyGetSetDef TyrantPipeline_getset[] = 
+{
+    {
+        "results", (getter) TyrantPipeline_get_results, NULL,
+        "Replies of the executed pipeline, in the order the commands were queued.",
+        NULL
+    },
+    
+    { NULL }
+};
+
+
+static PyMethodDef TyrantPipeline_methods[] = 
+{
+    {
+        "execute", (PyCFunction) TyrantPipeline_execute,
+        METH_NOARGS,
+        "Send every queued command in one write and return their replies in order."
+    },
+    
+    {
+        "__enter__", (PyCFunction) TyrantPipeline_enter,
+        METH_NOARGS,
+        "Start queueing commands."
+    },
+    
+    {
+        "__exit__", (PyCFunction) TyrantPipeline_exit,
+        METH_VARARGS,
+        "Execute the queued commands unless the block raised."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject TyrantPipelineType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.TyrantPipeline",        /* tp_name */
+  sizeof(TyrantPipeline),                      /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)TyrantPipeline_dealloc,          /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  (getattrofunc)TyrantPipeline_getattro,       /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Commands queued on a Tyrant connection and sent together", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  0,                                           /* tp_iter */
+  0,                                           /* tp_iternext */
+  TyrantPipeline_methods,                      /* tp_methods */
+  0,                                           /* tp_members */
+  TyrantPipeline_getset,                       /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  0,                                           /* tp_new */
+};
+
+
+static PyObject *
+Tyrant_pipeline(Tyrant *self)
+{
+    TyrantPipeline *pipeline;
+    
+    pipeline = PyObject_New(TyrantPipeline, &TyrantPipelineType);
+    
+    if (!pipeline)
+    {
+        return NULL;
+    }
+    
+    Py_INCREF(self);
+    pipeline->db = self;
+    pipeline->results = NULL;
+    pipeline->writes = false;
+    pipeline->executing = false;
+    pipeline->wbuf = tcxstrnew();
+    pipeline->codec = (TyrantCodec *) TyrantCodec_new(&TyrantCodecType, NULL, NULL);
+    
+    if (!pipeline->codec)
+    {
+        Py_DECREF(pipeline);
+        return NULL;
+    }
+    
+    return (PyObject *) pipeline;
+}
+
+
+/*
+ * One batch of records parsed by load. Hash records are collected for a
+ * single putlist call; table records are encoded as misc put commands and
+ * sent as one pipeline.
+ */
+typedef struct
+{
+    TCRDB *db;
+    bool table;
+    TCLIST *list;
+    TCXSTR *wbuf;
+    int num;
+    int failed;
+    int ecode;
+    double wire;
+} TyrantLoadBatch;
+
+
+static void
+loadbatch_clear(TyrantLoadBatch *batch)
+{
+    tclistclear(batch->list);
+    tcxstrclear(batch->wbuf);
+    batch->num = 0;
+    batch->failed = 0;
+    batch->ecode = TTESUCCESS;
+    batch->wire = 0;
+}
+
+
+/*
+ * Parse one line into the batch. Lines are "key<TAB>value" or "key=value"
+ * for hash databases, and "pkey<TAB>name<TAB>value..." or
+ * "pkey<TAB>name=value..." for table databases. Returns false if the line
+ * is malformed.
+ */
+static bool
+loadbatch_parse(TyrantLoadBatch *batch, const char *line, int len, bool kv)
+{
+    int i, n;
+    const char *rp, *ep, *sep, *end = line + len;
+    TCLIST *args;
+    
+    if (!batch->table)
+    {
+        sep = memchr(line, kv ? '=' : '\t', len);
+        if (!sep)
+        {
+            return false;
+        }
+        tclistpush(batch->list, line, sep - line);
+        tclistpush(batch->list, sep + 1, end - sep - 1);
+        batch->num++;
+        return true;
+    }
+    
+    args = tclistnew();
+    
+    for (rp = line; rp <= end; rp = ep + 1)
+    {
+        ep = memchr(rp, '\t', end - rp);
+        ep = ep ? ep : end;
+        
+        if (kv && tclistnum(args) > 0)
+        {
+            sep = memchr(rp, '=', ep - rp);
+            if (!sep)
+            {
+                tclistdel(args);
+                return false;
+            }
+            tclistpush(args, rp, sep - rp);
+            tclistpush(args, sep + 1, ep - sep - 1);
+        }
+        else
+        {
+            tclistpush(args, rp, ep - rp);
+        }
+    }
+    
+    n = tclistnum(args);
+    
+    if (n % 2 == 0 || tclistval2(args, 0)[0] == '\0')
+    {
+        tclistdel(args);
+        return false;
+    }
+    
+    /* Empty column names would collide with the primary key column. */
+    for (i=1; i<n; i+=2)
+    {
+        if (tclistval2(args, i)[0] == '\0')
+        {
+            tclistdel(args);
+            return false;
+        }
+    }
+    
+    codec_encode_misc(batch->wbuf, "put", 0, args);
+    tclistdel(args);
+    batch->num++;
+    
+    return true;
+}
+
+
+static void *
+loadbatch_send(void *arg)
+{
+    int i, *kinds;
+    int64_t pos, *sizes;
+    double start = metrics_now();
+    TyrantLoadBatch *batch = arg;
+    TCLIST *results;
+    TCXSTR *rbuf;
+    
+    if (!batch->table)
+    {
+        results = tcrdbmisc(batch->db, "putlist", 0, batch->list);
+        if (results)
+        {
+            tclistdel(results);
+        }
+        else
+        {
+            batch->ecode = tcrdbecode(batch->db);
+            batch->failed = batch->num;
+        }
+        batch->wire = metrics_now() - start;
+        return NULL;
+    }
+    
+    kinds = malloc(sizeof(int) * batch->num);
+    sizes = malloc(sizeof(int64_t) * batch->num);
+    rbuf = tcxstrnew();
+    
+    if (!kinds || !sizes)
+    {
+        batch->ecode = TTEMISC;
+    }
+    else
+    {
+        for (i=0; i<batch->num; i++)
+        {
+            kinds[i] = REPLYLIST;
+        }
+        batch->ecode = rdbpipeline(batch->db, batch->wbuf, kinds, 0, batch->num,
+            batch->num, rbuf, sizes);
+    }
+    
+    batch->wire = metrics_now() - start;
+    
+    /* As in TyrantPipeline_execute, unread replies make the connection unusable. */
+    if (batch->ecode == TTESEND || batch->ecode == TTERECV)
+    {
+        tcrdbclose(batch->db);
+    }
+    
+    if (batch->ecode != TTESUCCESS)
+    {
+        batch->failed = batch->num;
+    }
+    else
+    {
+        /* Each reply starts with its status byte. */
+        for (i=0, pos=0; i<batch->num; pos+=sizes[i++])
+        {
+            if (((const char *) tcxstrptr(rbuf))[pos] != 0)
+            {
+                batch->failed++;
+            }
+        }
+    }
+    
+    free(kinds);
+    free(sizes);
+    tcxstrdel(rbuf);
+    
+    return NULL;
+}
+
+
+/*
+ * Bulk load a file. The file is mapped and parsed without the GIL while a
+ * worker thread sends the previous batch, so parsing overlaps the network.
+ * An optional progress callable is called with the loaded and failed counts
+ * after every batch. Only the time spent sending batches counts as wire time.
+ */
+static PyObject *
+Tyrant_load(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    const char *path, *format = "tsv", *map = NULL, *rp, *ep, *end;
+    int i, fd, cur = 0, batchsize = 1000, len, ecode = TTESUCCESS;
+    bool kv, running = false, stop = false;
+    double wire = 0;
+    struct stat sbuf;
+    uint64_t loaded = 0, failed = 0, malformed = 0;
+    pthread_t thread;
+    TyrantLoadBatch batches[2];
+    PyObject *table = NULL, *progress = Py_None, *result;
+    
+    static char *kwlist[] = {"path", "format", "batch", "table", "progress", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|siOO:load", kwlist,
+        &path, &format, &batchsize, &table, &progress))
+    {
+        return NULL;
+    }
+    
+    if (strcmp(format, "tsv") && strcmp(format, "kv"))
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected format to be 'tsv' or 'kv'.");
+        return NULL;
+    }
+    
+    if (batchsize < 1)
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected batch to be positive.");
+        return NULL;
+    }
+    
+    kv = !strcmp(format, "kv");
+    fd = open(path, O_RDONLY);
+    
+    if (fd < 0 || fstat(fd, &sbuf) != 0)
+    {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *) path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+    
+    if (sbuf.st_size > 0)
+    {
+        map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *) path);
+            close(fd);
+            return NULL;
+        }
+        madvise((void *) map, sbuf.st_size, MADV_SEQUENTIAL);
+    }
+    
+    close(fd);
+    
+    for (i=0; i<2; i++)
+    {
+        batches[i].db = self->db;
+        batches[i].table = table && PyObject_IsTrue(table);
+        batches[i].list = tclistnew2(batchsize * 2);
+        batches[i].wbuf = tcxstrnew();
+        loadbatch_clear(&batches[i]);
+    }
+    
+    rp = map;
+    end = map + sbuf.st_size;
+    
+    Py_BEGIN_ALLOW_THREADS
+    
+    while (!stop)
+    {
+        loadbatch_clear(&batches[cur]);
+        
+        while (rp < end && batches[cur].num < batchsize)
+        {
+            ep = memchr(rp, '\n', end - rp);
+            ep = ep ? ep : end;
+            len = (int) (ep - rp);
+            
+            if (len > 0 && rp[len-1] == '\r')
+            {
+                len--;
+            }
+            
+            if (len > 0 && !loadbatch_parse(&batches[cur], rp, len, kv))
+            {
+                malformed++;
+            }
+            
+            rp = ep + 1;
+        }
+        
+        if (running)
+        {
+            pthread_join(thread, NULL);
+            running = false;
+            
+            loaded += batches[!cur].num - batches[!cur].failed;
+            failed += batches[!cur].failed;
+            wire += batches[!cur].wire;
+            
+            if (!tyrant_ecode_healthy(batches[!cur].ecode))
+            {
+                ecode = batches[!cur].ecode;
+                break;
+            }
+            
+            if (progress != Py_None)
+            {
+                Py_BLOCK_THREADS
+                result = PyObject_CallFunction(progress, "KK",
+                    (unsigned PY_LONG_LONG) loaded, (unsigned PY_LONG_LONG) failed);
+                stop = !result;
+                Py_XDECREF(result);
+                Py_UNBLOCK_THREADS
+            }
+        }
+        
+        if (stop || batches[cur].num == 0)
+        {
+            break;
+        }
+        
+        if (pthread_create(&thread, NULL, loadbatch_send, &batches[cur]) == 0)
+        {
+            running = true;
+        }
+        else
+        {
+            loadbatch_send(&batches[cur]);
+            loaded += batches[cur].num - batches[cur].failed;
+            failed += batches[cur].failed;
+            wire += batches[cur].wire;
+            batches[cur].num = 0;
+            
+            if (!tyrant_ecode_healthy(batches[cur].ecode))
+            {
+                ecode = batches[cur].ecode;
+                break;
+            }
+        }
+        
+        cur = !cur;
+    }
+    
+    if (running)
+    {
+        pthread_join(thread, NULL);
+    }
+    
+    Py_END_ALLOW_THREADS
+    
+    if (metrics_active)
+    {
+        metrics_wire += wire;
+    }
+    
+    for (i=0; i<2; i++)
+    {
+        tclistdel(batches[i].list);
+        tcxstrdel(batches[i].wbuf);
+    }
+    
+    if (map)
+    {
+        munmap((void *) map, sbuf.st_size);
+    }
+    
+    tyrant_cache_clear(self);
+    
+    if (stop)
+    {
+        return NULL;
+    }
+    
+    if (ecode != TTESUCCESS)
+    {
+        raise_tyrant_code(ecode);
+        return NULL;
+    }
+    
+    return Py_BuildValue("{s:K,s:K,s:K}",
+        "loaded", (unsigned PY_LONG_LONG) loaded,
+        "failed", (unsigned PY_LONG_LONG) failed,
+        "malformed", (unsigned PY_LONG_LONG) malformed);
+}
+
+
+/*
+ * Append one record to the dump buffer in the line format load reads.
+ * Returns false, writing nothing, if a field contains a byte that would
+ * split it when loaded again.
+ */
+static bool
+dump_record(TCXSTR *out, const char *kbuf, int ksiz, const char *vbuf, int vsiz,
+    bool table, bool kv)
+{
+    int i, n, fsiz;
+    const char *fbuf;
+    TCLIST *cols;
+    
+    if (!table)
+    {
+        if (ksiz == 0 || memchr(kbuf, kv ? '=' : '\t', ksiz) || memchr(kbuf, '\n', ksiz) ||
+            memchr(vbuf, '\n', vsiz) || (vsiz > 0 && vbuf[vsiz-1] == '\r'))
+        {
+            return false;
+        }
+        tcxstrcat(out, kbuf, ksiz);
+        tcxstrcat(out, kv ? "=" : "\t", 1);
+        tcxstrcat(out, vbuf, vsiz);
+        tcxstrcat(out, "\n", 1);
+        return true;
+    }
+    
+    if (ksiz == 0 || memchr(kbuf, '\t', ksiz) || memchr(kbuf, '\n', ksiz))
+    {
+        return false;
+    }
+    
+    cols = tcstrsplit2(vbuf, vsiz);
+    n = tclistnum(cols) / 2 * 2;
+    
+    for (i=0; i<n; i++)
+    {
+        fbuf = tclistval(cols, i, &fsiz);
+        
+        if ((i % 2 == 0 && (fsiz == 0 || (kv && memchr(fbuf, '=', fsiz)))) ||
+            memchr(fbuf, '\t', fsiz) || memchr(fbuf, '\n', fsiz) ||
+            (i == n - 1 && fsiz > 0 && fbuf[fsiz-1] == '\r'))
+        {
+            tclistdel(cols);
+            return false;
+        }
+    }
+    
+    tcxstrcat(out, kbuf, ksiz);
+    
+    for (i=0; i<n; i++)
+    {
+        fbuf = tclistval(cols, i, &fsiz);
+        tcxstrcat(out, i % 2 == 0 ? "\t" : (kv ? "=" : "\t"), 1);
+        tcxstrcat(out, fbuf, fsiz);
+    }
+    
+    tclistdel(cols);
+    tcxstrcat(out, "\n", 1);
+    
+    return true;
+}
+
+
+static bool
+dump_flush(int fd, TCXSTR *out)
+{
+    const char *buf = tcxstrptr(out);
+    int size = tcxstrsize(out);
+    ssize_t n;
+    
+    while (size > 0)
+    {
+        n = write(fd, buf, size);
+        
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        
+        buf += n;
+        size -= n;
+    }
+    
+    tcxstrclear(out);
+    
+    return true;
+}
+
+
+/*
+ * Stream the whole database to a file without the GIL. Keys are fetched a
+ * batch at a time with pipelined iternext commands and their values with
+ * one mget, so memory use is bounded by the batch size. This uses the
+ * connection's server-side iterator, so it fails while a key iteration is
+ * active.
+ */
+static PyObject *
+Tyrant_dump(Tyrant *self, PyObject *args, PyObject *kwargs)
+{
+    const char *format = "tsv", *path = NULL, *kbuf, *vbuf;
+    int i, fd, batchsize = 1000, ksiz, vsiz, ecode = TTESUCCESS;
+    bool kv, table = false, success = true;
+    uint64_t dumped = 0, skipped = 0;
+    TCLIST *keys;
+    TCMAP *recs;
+    TCXSTR *out;
+    PyObject *target, *pytable = NULL;
+    
+    static char *kwlist[] = {"target", "format", "batch", "table", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|siO:dump", kwlist,
+        &target, &format, &batchsize, &pytable))
+    {
+        return NULL;
+    }
+    
+    if (strcmp(format, "tsv") && strcmp(format, "kv"))
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected format to be 'tsv' or 'kv'.");
+        return NULL;
+    }
+    
+    if (batchsize < 1)
+    {
+        PyErr_SetString(PyExc_ValueError, "Expected batch to be positive.");
+        return NULL;
+    }
+    
+    kv = !strcmp(format, "kv");
+    table = pytable && PyObject_IsTrue(pytable);
+    
+    if (PyInt_Check(target))
+    {
+        fd = (int) PyInt_AS_LONG(target);
+    }
+    else if (PyString_Check(target))
+    {
+        path = PyString_AS_STRING(target);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *) path);
+            return NULL;
+        }
+    }
+    else
+    {
+        PyErr_SetString(PyExc_TypeError, "Expected target to be a path or a file descriptor.");
+        return NULL;
+    }
+    
+    if (!tyrant_iter_claim(self))
+    {
+        if (path)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+    
+    keys = tclistnew2(batchsize);
+    recs = tcmapnew2(batchsize + 1);
+    out = tcxstrnew3(0x100000 + 1);
+    
+    TYRANT_WIRE_BEGIN
+    
+    if (!tcrdbiterinit(self->db))
+    {
+        ecode = tcrdbecode(self->db);
+    }
+    
+    while (ecode == TTESUCCESS)
+    {
+        tclistclear(keys);
+        tcmapclear(recs);
+        
+        ecode = rdbiternextbatch(self->db, batchsize, keys);
+        
+        if (ecode != TTESUCCESS && ecode != TTENOREC)
+        {
+            break;
+        }
+        
+        for (i=0; i<tclistnum(keys); i++)
+        {
+            kbuf = tclistval(keys, i, &ksiz);
+            tcmapput(recs, kbuf, ksiz, "", 0);
+        }
+        
+        /* Records removed between iternext and mget are simply missing. */
+        if (tcmaprnum(recs) > 0 && !tcrdbget3(self->db, recs))
+        {
+            ecode = tcrdbecode(self->db);
+            break;
+        }
+        
+        tcmapiterinit(recs);
+        
+        while ((kbuf = tcmapiternext(recs, &ksiz)) != NULL)
+        {
+            vbuf = tcmapiterval(kbuf, &vsiz);
+            
+            if (dump_record(out, kbuf, ksiz, vbuf, vsiz, table, kv))
+            {
+                dumped++;
+            }
+            else
+            {
+                skipped++;
+            }
+        }
+        
+        if (tcxstrsize(out) >= 0x100000 && !dump_flush(fd, out))
+        {
+            success = false;
+            break;
+        }
+        
+        if (ecode == TTENOREC || tclistnum(keys) == 0)
+        {
+            ecode = TTESUCCESS;
+            break;
+        }
+    }
+    
+    if (success && ecode == TTESUCCESS)
+    {
+        success = dump_flush(fd, out);
+    }
+    
+    TYRANT_WIRE_END
+    
+    self->iterating = false;
+    
+    if (!success)
+    {
+        PyErr_SetFromErrno(PyExc_IOError);
+    }
+    
+    if (path && close(fd) != 0 && success)
+    {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *) path);
+        success = false;
+    }
+    
+    tclistdel(keys);
+    tcmapdel(recs);
+    tcxstrdel(out);
+    
+    if (!success)
+    {
+        return NULL;
+    }
+    
+    if (ecode != TTESUCCESS)
+    {
+        raise_tyrant_code(ecode);
+        return NULL;
+    }
+    
+    return Py_BuildValue("{s:K,s:K}",
+        "dumped", (unsigned PY_LONG_LONG) dumped,
+        "skipped", (unsigned PY_LONG_LONG) skipped);
+}
+
+
+/*
+ * A subscriber to a server's update log, speaking the protocol a slave
+ * uses after setmst through the replication client of the Tyrant library.
+ * Iterating yields (timestamp, command, key, value, ok) for every logged
+ * update from `ts` on, where `ok` tells whether the command succeeded on
+ * the server. Failed commands are logged too and must not be replayed as
+ * updates.
+ */
+typedef struct
+{
+    PyObject_HEAD
+    TCREPL *repl;
+    uint64_t ts;
+    uint32_t mid;
+} ReplicationStream;
+
+
+static void
+ReplicationStream_close_repl(ReplicationStream *self)
+{
+    if (self->repl)
+    {
+        tcreplclose(self->repl);
+        tcrepldel(self->repl);
+        self->repl = NULL;
+    }
+}
+
+
+static void
+ReplicationStream_dealloc(ReplicationStream *self)
+{
+    ReplicationStream_close_repl(self);
+    self->ob_type->tp_free(self);
+}
+
+
+static PyObject *
+ReplicationStream_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    ReplicationStream *self;
+    const char *host;
+    int port;
+    bool success;
+    unsigned PY_LONG_LONG ts = 0;
+    unsigned int sid = 0;
+    
+    static char *kwlist[] = {"host", "port", "ts", "sid", NULL};
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|KI:ReplicationStream", kwlist,
+        &host, &port, &ts, &sid))
+    {
+        return NULL;
+    }
+    
+    self = (ReplicationStream *) type->tp_alloc(type, 0);
+    if (!self)
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate ReplicationStream instance.");
+        return NULL;
+    }
+    
+    self->ts = ts;
+    self->repl = tcreplnew();
+    
+    if (!self->repl)
+    {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    
+    Py_BEGIN_ALLOW_THREADS
+    success = tcreplopen(self->repl, host, port, ts, sid);
+    Py_END_ALLOW_THREADS
+    
+    if (!success)
+    {
+        Py_DECREF(self);
+        raise_tyrant_code(TTEREFUSED);
+        return NULL;
+    }
+    
+    /* The server answers the request with its own server id. */
+    self->mid = self->repl->mid;
+    
+    return (PyObject *) self;
+}
+
+
+static const char *
+repl_command_name(int cmd)
+{
+    switch (cmd)
+    {
+        case TTCMDPUT: return "put";
+        case TTCMDPUTKEEP: return "putkeep";
+        case TTCMDPUTCAT: return "putcat";
+        case TTCMDPUTSHL: return "putshl";
+        case TTCMDPUTNR: return "putnr";
+        case TTCMDOUT: return "out";
+        case TTCMDADDINT: return "addint";
+        case TTCMDADDDOUBLE: return "adddouble";
+        case TTCMDVANISH: return "vanish";
+        case TTCMDOPTIMIZE: return "optimize";
+        case TTCMDMISC: return "misc";
+        default: return NULL;
+    }
+}
+
+
+/*
+ * Decode the body of an update log record: the magic byte, the command,
+ * its arguments as in the request protocol and a trailing status byte.
+ * Returns false if the body is not understood.
+ */
+static bool
+repl_decode(const char *buf, int size, const char **name, PyObject **key, PyObject **value)
+{
+    int i, cmd, ksiz, vsiz, nsiz, anum, asiz;
+    const char *rp, *end;
+    PyObject *arg;
+    
+    if (size < 3 || (unsigned char) buf[0] != TTMAGICNUM)
+    {
+        return false;
+    }
+    
+    cmd = (unsigned char) buf[1];
+    *name = repl_command_name(cmd);
+    rp = buf + 2;
+    end = buf + size - 1;
+    *key = NULL;
+    *value = NULL;
+    
+    if (!*name)
+    {
+        return false;
+    }
+    
+    switch (cmd)
+    {
+        case TTCMDPUT:
+        case TTCMDPUTKEEP:
+        case TTCMDPUTCAT:
+        case TTCMDPUTSHL:
+        case TTCMDPUTNR:
+            i = cmd == TTCMDPUTSHL ? 12 : 8;
+            if (end - rp < i)
+            {
+                return false;
+            }
+            ksiz = (int) readint32(rp);
+            vsiz = (int) readint32(rp + 4);
+            rp += i;
+            if (ksiz < 0 || vsiz < 0 || end - rp < (int64_t) ksiz + vsiz)
+            {
+                return false;
+            }
+            *key = PyString_FromStringAndSize(rp, ksiz);
+            *value = PyString_FromStringAndSize(rp + ksiz, vsiz);
+            break;
+        case TTCMDOUT:
+        case TTCMDOPTIMIZE:
+            if (end - rp < 4)
+            {
+                return false;
+            }
+            ksiz = (int) readint32(rp);
+            rp += 4;
+            if (ksiz < 0 || end - rp < ksiz)
+            {
+                return false;
+            }
+            *key = PyString_FromStringAndSize(rp, ksiz);
+            Py_INCREF(Py_None);
+            *value = Py_None;
+            break;
+        case TTCMDADDINT:
+            if (end - rp < 8)
+            {
+                return false;
+            }
+            ksiz = (int) readint32(rp);
+            if (ksiz < 0 || end - rp - 8 < ksiz)
+            {
+                return false;
+            }
+            *value = PyInt_FromLong((int32_t) readint32(rp + 4));
+            *key = PyString_FromStringAndSize(rp + 8, ksiz);
+            break;
+        case TTCMDADDDOUBLE:
+            if (end - rp < 20)
+            {
+                return false;
+            }
+            ksiz = (int) readint32(rp);
+            if (ksiz < 0 || end - rp - 20 < ksiz)
+            {
+                return false;
+            }
+            *value = PyFloat_FromDouble((int64_t) readint64(rp + 4) +
+                (int64_t) readint64(rp + 12) / 1e12);
+            *key = PyString_FromStringAndSize(rp + 20, ksiz);
+            break;
+        case TTCMDVANISH:
+            Py_INCREF(Py_None);
+            *key = Py_None;
+            Py_INCREF(Py_None);
+            *value = Py_None;
+            break;
+        case TTCMDMISC:
+            if (end - rp < 12)
+            {
+                return false;
+            }
+            nsiz = (int) readint32(rp);
+            anum = (int) readint32(rp + 8);
+            rp += 12;
+            if (nsiz < 0 || anum < 0 || end - rp < nsiz)
+            {
+                return false;
+            }
+            *key = PyString_FromStringAndSize(rp, nsiz);
+            *value = PyList_New(0);
+            rp += nsiz;
+            for (i=0; *value && i<anum; i++)
+            {
+                asiz = end - rp >= 4 ? (int) readint32(rp) : -1;
+                if (asiz < 0 || end - rp - 4 < asiz)
+                {
+                    Py_XDECREF(*key);
+                    Py_CLEAR(*value);
+                    return false;
+                }
+                arg = PyString_FromStringAndSize(rp + 4, asiz);
+                if (!arg || PyList_Append(*value, arg) != 0)
+                {
+                    Py_CLEAR(*value);
+                }
+                Py_XDECREF(arg);
+                rp += 4 + asiz;
+            }
+            break;
+    }
+    
+    return true;
+}
+
+
+static PyObject *
+ReplicationStream_iternext(ReplicationStream *self)
+{
+    int rsiz;
+    bool ok;
+    uint64_t ts;
+    uint32_t sid;
+    const char *rbuf, *name;
+    PyObject *key, *value;
+    
+    while (self->repl)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        rbuf = tcreplread(self->repl, &rsiz, &ts, &sid);
+        Py_END_ALLOW_THREADS
+        
+        if (!rbuf)
+        {
+            ReplicationStream_close_repl(self);
+            raise_tyrant_code(TTERECV);
+            return NULL;
+        }
+        
+        /* Heartbeats arrive while the log is idle; use them to notice signals. */
+        if (rsiz < 1)
+        {
+            if (PyErr_CheckSignals() != 0)
+            {
+                return NULL;
+            }
+            continue;
+        }
+        
+        self->ts = ts;
+        
+        /* The last byte of a record is the status the command returned. */
+        ok = rbuf[rsiz-1] == 0;
+        
+        if (!repl_decode(rbuf, rsiz, &name, &key, &value))
+        {
+            return Py_BuildValue("(KsOs#N)", (unsigned PY_LONG_LONG) ts, "unknown",
+                Py_None, rbuf, rsiz, PyBool_FromLong(ok));
+        }
+        
+        if (!key || !value)
+        {
+            Py_XDECREF(key);
+            Py_XDECREF(value);
+            return NULL;
+        }
+        
+        return Py_BuildValue("(KsNNN)", (unsigned PY_LONG_LONG) ts, name, key, value,
+            PyBool_FromLong(ok));
+    }
+    
+    return NULL;
+}
+
+
+static PyObject *
+ReplicationStream_close(ReplicationStream *self)
+{
+    ReplicationStream_close_repl(self);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+ReplicationStream_get_ts(ReplicationStream *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->ts);
+}
+
+
+static PyObject *
+ReplicationStream_get_master_sid(ReplicationStream *self, void *closure)
+{
+    return PyLong_FromUnsignedLong(self->mid);
+}
+
+
+static PyGetSetDef ReplicationStream_getset[] = 
+{
+    {
+        "ts", (getter) ReplicationStream_get_ts, NULL,
+        "Timestamp of the last record read. Pass it to a new stream to resume.",
+        NULL
+    },
+    
+    {
+        "master_sid", (getter) ReplicationStream_get_master_sid, NULL,
+        "Server id of the server the stream is reading from.",
+        NULL
+    },
+    
+    { NULL }
+};
+
+
+static PyMethodDef ReplicationStream_methods[] = 
+{
+    {
+        "close", (PyCFunction) ReplicationStream_close,
+        METH_NOARGS,
+        "Close the connection. Iteration stops."
+    },
+    
+    { NULL }
+};
+
+
+static PyTypeObject ReplicationStreamType = {
+  PyObject_HEAD_INIT(NULL)
+  0,                                           /* ob_size */
+  "tokyocabinet.tyrant.ReplicationStream",     /* tp_name */
+  sizeof(ReplicationStream),                   /* tp_basicsize */
+  0,                                           /* tp_itemsize */
+  (destructor)ReplicationStream_dealloc,       /* tp_dealloc */
+  0,                                           /* tp_print */
+  0,                                           /* tp_getattr */
+  0,                                           /* tp_setattr */
+  0,                                           /* tp_compare */
+  0,                                           /* tp_repr */
+  0,                                           /* tp_as_number */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
+  0,                                           /* tp_call */
+  0,                                           /* tp_str */
+  0,                                           /* tp_getattro */
+  0,                                           /* tp_setattro */
+  0,                                           /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "Stream of update log records from a Tokyo Tyrant server", /* tp_doc */
+  0,                                           /* tp_traverse */
+  0,                                           /* tp_clear */
+  0,                                           /* tp_richcompare */
+  0,                                           /* tp_weaklistoffset */
+  PyObject_SelfIter,                           /* tp_iter */
+  (iternextfunc)ReplicationStream_iternext,    /* tp_iternext */
+  ReplicationStream_methods,                   /* tp_methods */
+  0,                                           /* tp_members */
+  ReplicationStream_getset,                    /* tp_getset */
+  0,                                           /* tp_base */
+  0,                                           /* tp_dict */
+  0,                                           /* tp_descr_get */
+  0,                                           /* tp_descr_set */
+  0,                                           /* tp_dictoffset */
+  0,                                           /* tp_init */
+  0,                                           /* tp_alloc */
+  ReplicationStream_new,                       /* tp_new */
+};
+
+
+/*
+ * A small ttserver for tests and benchmarks. It runs the server framework
+ * of the Tyrant library on its own thread and answers the binary protocol
+ * from an abstract database, "*" (on-memory hash) by default, so Tyrant
+ * and the other clients connect to it unchanged. A port of 0 makes host
+ * the path of a Unix socket. Each request can be delayed by `latency`
+ * seconds and fail with probability `failure_rate`; failures come from a
+ * seeded generator so runs are reproducible.
+ */
+#define FAKESERV_MAXSIZE (256 * 1024 * 1024)
+
+
+typedef struct
+{
+    PyObject_HEAD
+    TTSERV *serv;
+    TCADB *db;
+    char *host;
+    int port;
+    int threads;
+    double latency;
+    double failure_rate;
+    uint64_t rand;
+    uint64_t requests;
+    uint64_t failures;
+    bool running;
+    bool exited;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+} TyrantServer;
+
+
+static double
+fakeserv_random(TyrantServer *self)
+{
+    uint64_t x = self->rand;
+    
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    self->rand = x;
+    
+    return (double) ((x * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+
+static void
+fakeserv_int32(TCXSTR *xstr, uint32_t num)
+{
+    char buf[4];
+    
+    buf[0] = (char) (num >> 24);
+    buf[1] = (char) (num >> 16);
+    buf[2] = (char) (num >> 8);
+    buf[3] = (char) num;
+    tcxstrcat(xstr, buf, 4);
+}
+
+
+static void
+fakeserv_int64(TCXSTR *xstr, uint64_t num)
+{
+    fakeserv_int32(xstr, (uint32_t) (num >> 32));
+    fakeserv_int32(xstr, (uint32_t) num);
 }
 
 
-static Py_ssize_t
-Tyrant_length(Tyrant *self)
+static void
+fakeserv_code(TCXSTR *xstr, bool success)
 {
-    uint64_t rnum;
-    
-    Py_BEGIN_ALLOW_THREADS
-    rnum = tcrdbrnum(self->db);
-    Py_END_ALLOW_THREADS
-    
-    return (Py_ssize_t) rnum;
+    tcxstrcat(xstr, success ? "\0" : "\1", 1);
 }
 
 
-static PyObject *
-Tyrant_subscript(Tyrant *self, PyObject *key)
+/*
+ * Read a size-prefixed field of `size` bytes. The buffer is terminated so
+ * that paths and names can be used as strings.
+ */
+static char *
+fakeserv_recv(TTSOCK *sock, int size)
 {
-    char *kbuf, *vbuf;
-    Py_ssize_t ksiz;
-    int vsiz;
-    PyObject *value;
+    char *buf;
     
-    if (!PyString_Check(key))
+    if (size < 0 || size > FAKESERV_MAXSIZE || ttsockcheckend(sock))
     {
-        PyErr_SetString(PyExc_ValueError, "Expected key to be a string.");
         return NULL;
     }
     
-    PyString_AsStringAndSize(key, &kbuf, &ksiz);
+    buf = malloc(size + 1);
     
-    if (!kbuf)
+    if (!buf || !ttsockrecv(sock, buf, size))
     {
+        free(buf);
         return NULL;
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    vbuf = tcrdbget(self->db, kbuf, (int) ksiz, &vsiz);
-    Py_END_ALLOW_THREADS
-    
-    if (!vbuf)
-    {
-        raise_tyrant_error(self->db);
-        return NULL;
-    }
+    buf[size] = '\0';
+    return buf;
+}
+
+
+static void
+fakeserv_list(TCXSTR *xstr, const TCLIST *list)
+{
+    int i, vsiz;
+    const char *vbuf;
     
-    value = PyString_FromStringAndSize(vbuf, vsiz);
-    free(vbuf);
+    fakeserv_int32(xstr, tclistnum(list));
     
-    if (!value)
+    for (i=0; i<tclistnum(list); i++)
     {
-        return NULL;
+        vbuf = tclistval(list, i, &vsiz);
+        fakeserv_int32(xstr, vsiz);
+        tcxstrcat(xstr, vbuf, vsiz);
+    }
+}
+
+
+/*
+ * Read the arguments of one command, run it unless `fail` is set, and
+ * write the reply to `xstr`. Returns false if the request could not be
+ * read, which closes the connection.
+ */
+static bool
+fakeserv_command(TyrantServer *self, TTSOCK *sock, int cmd, bool fail, TCXSTR *xstr)
+{
+    bool success = false;
+    char *buf = NULL, *vbuf;
+    const char *rkbuf, *rvbuf;
+    int i, ksiz, vsiz, num, rnum;
+    int64_t integ, fract;
+    double dnum;
+    TCADB *db = self->db;
+    TCLIST *list, *results;
+    TCMAP *recs;
+    
+    switch (cmd)
+    {
+        case TTCMDPUT:
+        case TTCMDPUTKEEP:
+        case TTCMDPUTCAT:
+        case TTCMDPUTNR:
+            ksiz = ttsockgetint32(sock);
+            vsiz = ttsockgetint32(sock);
+            if (ksiz < 0 || vsiz < 0 || ksiz > FAKESERV_MAXSIZE - vsiz ||
+                !(buf = fakeserv_recv(sock, ksiz + vsiz)))
+            {
+                return false;
+            }
+            if (!fail)
+            {
+                success = cmd == TTCMDPUTKEEP ? tcadbputkeep(db, buf, ksiz, buf + ksiz, vsiz) :
+                    cmd == TTCMDPUTCAT ? tcadbputcat(db, buf, ksiz, buf + ksiz, vsiz) :
+                    tcadbput(db, buf, ksiz, buf + ksiz, vsiz);
+            }
+            if (cmd != TTCMDPUTNR)
+            {
+                fakeserv_code(xstr, success);
+            }
+            break;
+        
+        case TTCMDOUT:
+        case TTCMDGET:
+        case TTCMDVSIZ:
+            ksiz = ttsockgetint32(sock);
+            if (!(buf = fakeserv_recv(sock, ksiz)))
+            {
+                return false;
+            }
+            if (cmd == TTCMDOUT)
+            {
+                fakeserv_code(xstr, !fail && tcadbout(db, buf, ksiz));
+            }
+            else if (cmd == TTCMDVSIZ)
+            {
+                vsiz = fail ? -1 : tcadbvsiz(db, buf, ksiz);
+                fakeserv_code(xstr, vsiz >= 0);
+                if (vsiz >= 0)
+                {
+                    fakeserv_int32(xstr, vsiz);
+                }
+            }
+            else
+            {
+                vbuf = fail ? NULL : tcadbget(db, buf, ksiz, &vsiz);
+                fakeserv_code(xstr, vbuf != NULL);
+                if (vbuf)
+                {
+                    fakeserv_int32(xstr, vsiz);
+                    tcxstrcat(xstr, vbuf, vsiz);
+                    free(vbuf);
+                }
+            }
+            break;
+        
+        case TTCMDMGET:
+            rnum = ttsockgetint32(sock);
+            if (rnum < 0)
+            {
+                return false;
+            }
+            recs = tcmapnew2(rnum + 1);
+            for (i=0; i<rnum; i++)
+            {
+                ksiz = ttsockgetint32(sock);
+                if (!(buf = fakeserv_recv(sock, ksiz)))
+                {
+                    tcmapdel(recs);
+                    return false;
+                }
+                vbuf = fail ? NULL : tcadbget(db, buf, ksiz, &vsiz);
+                if (vbuf)
+                {
+                    tcmapput(recs, buf, ksiz, vbuf, vsiz);
+                    free(vbuf);
+                }
+                free(buf);
+            }
+            buf = NULL;
+            fakeserv_code(xstr, !fail);
+            if (!fail)
+            {
+                fakeserv_int32(xstr, tcmaprnum(recs));
+                tcmapiterinit(recs);
+                while ((rkbuf = tcmapiternext(recs, &ksiz)) != NULL)
+                {
+                    rvbuf = tcmapiterval(rkbuf, &vsiz);
+                    fakeserv_int32(xstr, ksiz);
+                    fakeserv_int32(xstr, vsiz);
+                    tcxstrcat(xstr, rkbuf, ksiz);
+                    tcxstrcat(xstr, rvbuf, vsiz);
+                }
+            }
+            tcmapdel(recs);
+            break;
+        
+        case TTCMDITERINIT:
+            fakeserv_code(xstr, !fail && tcadbiterinit(db));
+            break;
+        
+        case TTCMDITERNEXT:
+            vbuf = fail ? NULL : tcadbiternext(db, &vsiz);
+            fakeserv_code(xstr, vbuf != NULL);
+            if (vbuf)
+            {
+                fakeserv_int32(xstr, vsiz);
+                tcxstrcat(xstr, vbuf, vsiz);
+                free(vbuf);
+            }
+            break;
+        
+        case TTCMDFWMKEYS:
+            ksiz = ttsockgetint32(sock);
+            num = ttsockgetint32(sock);
+            if (!(buf = fakeserv_recv(sock, ksiz)))
+            {
+                return false;
+            }
+            fakeserv_code(xstr, !fail);
+            if (!fail)
+            {
+                list = tcadbfwmkeys(db, buf, ksiz, num);
+                fakeserv_list(xstr, list);
+                tclistdel(list);
+            }
+            break;
+        
+        case TTCMDADDINT:
+            ksiz = ttsockgetint32(sock);
+            num = ttsockgetint32(sock);
+            if (!(buf = fakeserv_recv(sock, ksiz)))
+            {
+                return false;
+            }
+            num = fail ? INT_MIN : tcadbaddint(db, buf, ksiz, num);
+            fakeserv_code(xstr, num != INT_MIN);
+            if (num != INT_MIN)
+            {
+                fakeserv_int32(xstr, (uint32_t) num);
+            }
+            break;
+        
+        case TTCMDADDDOUBLE:
+            ksiz = ttsockgetint32(sock);
+            integ = ttsockgetint64(sock);
+            fract = ttsockgetint64(sock);
+            if (!(buf = fakeserv_recv(sock, ksiz)))
+            {
+                return false;
+            }
+            dnum = fail ? NAN : tcadbadddouble(db, buf, ksiz, integ + fract / 1e12);
+            fakeserv_code(xstr, !isnan(dnum));
+            if (!isnan(dnum))
+            {
+                fakeserv_int64(xstr, (uint64_t) (int64_t) dnum);
+                fakeserv_int64(xstr, (uint64_t) (int64_t) ((dnum - (int64_t) dnum) * 1e12));
+            }
+            break;
+        
+        case TTCMDSYNC:
+            fakeserv_code(xstr, !fail && tcadbsync(db));
+            break;
+        
+        case TTCMDVANISH:
+            fakeserv_code(xstr, !fail && tcadbvanish(db));
+            break;
+        
+        case TTCMDOPTIMIZE:
+        case TTCMDCOPY:
+            ksiz = ttsockgetint32(sock);
+            if (!(buf = fakeserv_recv(sock, ksiz)))
+            {
+                return false;
+            }
+            if (!fail)
+            {
+                success = cmd == TTCMDCOPY ? tcadbcopy(db, buf) :
+                    tcadboptimize(db, ksiz > 0 ? buf : NULL);
+            }
+            fakeserv_code(xstr, success);
+            break;
+        
+        case TTCMDRNUM:
+        case TTCMDSIZE:
+            fakeserv_code(xstr, !fail);
+            if (!fail)
+            {
+                fakeserv_int64(xstr, cmd == TTCMDRNUM ? tcadbrnum(db) : tcadbsize(db));
+            }
+            break;
+        
+        case TTCMDSTAT:
+            fakeserv_code(xstr, !fail);
+            if (!fail)
+            {
+                buf = tcsprintf("version\tfake\nrnum\t%llu\nsize\t%llu\n",
+                    (unsigned long long) tcadbrnum(db), (unsigned long long) tcadbsize(db));
+                fakeserv_int32(xstr, strlen(buf));
+                tcxstrcat2(xstr, buf);
+            }
+            break;
+        
+        case TTCMDMISC:
+            ksiz = ttsockgetint32(sock);
+            ttsockgetint32(sock);
+            rnum = ttsockgetint32(sock);
+            if (rnum < 0 || !(buf = fakeserv_recv(sock, ksiz)))
+            {
+                return false;
+            }
+            list = tclistnew2(rnum + 1);
+            for (i=0; i<rnum; i++)
+            {
+                vsiz = ttsockgetint32(sock);
+                if (!(vbuf = fakeserv_recv(sock, vsiz)))
+                {
+                    tclistdel(list);
+                    free(buf);
+                    return false;
+                }
+                tclistpushmalloc(list, vbuf, vsiz);
+            }
+            results = fail ? NULL : tcadbmisc(db, buf, list);
+            fakeserv_code(xstr, results != NULL);
+            if (results)
+            {
+                fakeserv_list(xstr, results);
+                tclistdel(results);
+            }
+            tclistdel(list);
+            break;
+        
+        default:
+            /* Extension scripts, restore, replication and unknown commands. */
+            return false;
     }
     
-    return value;
+    free(buf);
+    return true;
 }
 
 
-static int
-Tyrant_ass_subscript(Tyrant *self, PyObject *key, PyObject *value)
+static void
+fakeserv_task(TTSOCK *sock, void *opq, TTREQ *req)
 {
-    bool success;
-    char *kbuf, *vbuf;
-    Py_ssize_t ksiz, vsiz;
+    TyrantServer *self = opq;
+    TCXSTR *xstr;
+    bool fail;
+    double latency;
+    int cmd;
     
-    if (!PyString_Check(key))
+    if (ttsockgetc(sock) != TTMAGICNUM)
     {
-        PyErr_SetString(PyExc_ValueError, "Expected key to be a string.");
-        return -1;
+        return;
     }
     
-    if (!PyString_Check(value))
-    {
-        PyErr_SetString(PyExc_ValueError, "Expected value to be a string.");
-        return -1;
-    }
+    cmd = ttsockgetc(sock);
     
-    PyString_AsStringAndSize(key, &kbuf, &ksiz);
-    if (!kbuf)
-    {
-        return -1;
-    }
+    pthread_mutex_lock(&self->mutex);
+    self->requests++;
+    fail = self->failure_rate > 0 && fakeserv_random(self) < self->failure_rate;
+    self->failures += fail ? 1 : 0;
+    latency = self->latency;
+    pthread_mutex_unlock(&self->mutex);
     
-    PyString_AsStringAndSize(value, &vbuf, &vsiz);
-    if (!vbuf)
+    if (latency > 0)
     {
-        return -1;
+        usleep((useconds_t) (latency * 1e6));
     }
     
-    Py_BEGIN_ALLOW_THREADS
-    success = tcrdbput(self->db, kbuf, (int) ksiz, vbuf, (int) vsiz);
-    Py_END_ALLOW_THREADS
+    xstr = tcxstrnew();
     
-    if (!success)
+    if (fakeserv_command(self, sock, cmd, fail, xstr) &&
+        (TCXSTRSIZE(xstr) == 0 || ttsocksend(sock, TCXSTRPTR(xstr), TCXSTRSIZE(xstr))))
     {
-        raise_tyrant_error(self->db);
-        return -1;
+        req->keep = true;
     }
     
-    return 0;
+    tcxstrdel(xstr);
 }
 
 
-static PyMappingMethods Tyrant_as_mapping = 
+static void *
+fakeserv_run(void *arg)
 {
-    (lenfunc) Tyrant_length,
-    (binaryfunc) Tyrant_subscript,
-    (objobjargproc) Tyrant_ass_subscript
-};
+    TyrantServer *self = arg;
+    
+    ttservstart(self->serv);
+    
+    pthread_mutex_lock(&self->mutex);
+    self->exited = true;
+    pthread_mutex_unlock(&self->mutex);
+    
+    return NULL;
+}
 
 
-static int
-Tyrant_contains(Tyrant *self, PyObject *value)
+/*
+ * Stop the server thread and wait for it. The framework checks its kill
+ * flag between polls, so this can take up to one poll interval.
+ */
+static void
+fakeserv_stop(TyrantServer *self)
 {
-    char *kbuf;
-    Py_ssize_t ksiz;
-    int vsiz;
-    
-    if (!PyString_Check(value))
-    {
-        PyErr_SetString(PyExc_ValueError, "Expected value to be a string");
-        return -1;
-    }
-    
-    PyString_AsStringAndSize(value, &kbuf, &ksiz);
-    if (!kbuf)
+    if (!self->running)
     {
-        return -1;
+        return;
     }
     
     Py_BEGIN_ALLOW_THREADS
-    vsiz = tcrdbvsiz(self->db, kbuf, (int) ksiz);
+    ttservkill(self->serv);
+    pthread_join(self->thread, NULL);
+    ttservdel(self->serv);
     Py_END_ALLOW_THREADS
     
-    return vsiz != -1;
+    self->serv = NULL;
+    self->running = false;
 }
 
 
-static PySequenceMethods Tyrant_as_sequence = 
+static void
+TyrantServer_dealloc(TyrantServer *self)
 {
-    0,                             /* sq_length */
-    0,                             /* sq_concat */
-    0,                             /* sq_repeat */
-    0,                             /* sq_item */
-    0,                             /* sq_slice */
-    0,                             /* sq_ass_item */
-    0,                             /* sq_ass_slice */
-    (objobjproc) Tyrant_contains,  /* sq_contains */
-    0,                             /* sq_inplace_concat */
-    0                              /* sq_inplace_repeat */
-};
+    fakeserv_stop(self);
+    if (self->db)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        tcadbdel(self->db);
+        Py_END_ALLOW_THREADS
+    }
+    pthread_mutex_destroy(&self->mutex);
+    free(self->host);
+    self->ob_type->tp_free(self);
+}
 
 
-static PyMethodDef Tyrant_methods[] = 
+static PyObject *
+TyrantServer_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
-    {
-        "tune", (PyCFunction) Tyrant_tune,
-        METH_VARARGS | METH_KEYWORDS,
-        "Set tuning parameters."
-    },
-    
-    {
-        "open", (PyCFunction) Tyrant_open, 
-        METH_VARARGS | METH_KEYWORDS,
-        "Open the database connection"
-    },
-    
-    {
-        "close", (PyCFunction) Tyrant_close,
-        METH_NOARGS,
-        "Close the database connection"
-    },
-    
-    {
-        "put", (PyCFunction) Tyrant_put,
-        METH_VARARGS,
-        "Store a record. Overwrite existing record."
-    },
+    TyrantServer *self;
+    const char *host, *path = "*";
+    int port, threads = 4;
+    double latency = 0.0, failure_rate = 0.0;
+    unsigned PY_LONG_LONG seed = 0;
+    bool success;
     
-    {
-        "putkeep", (PyCFunction) Tyrant_putkeep,
-        METH_VARARGS,
-        "Store a record. Don't overwrite an existing record."
-    },
+    static char *kwlist[] = {"host", "port", "path", "threads", "latency", "failure_rate",
+        "seed", NULL};
     
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|siddK:TyrantServer", kwlist,
+        &host, &port, &path, &threads, &latency, &failure_rate, &seed))
     {
-        "putcat", (PyCFunction) Tyrant_putcat,
-        METH_VARARGS,
-        "Concatenate value on the end of a record. Creates the record if it doesn't exist."
-    },
+        return NULL;
+    }
     
+    if (threads < 1 || latency < 0 || failure_rate < 0 || failure_rate > 1)
     {
-        "putnr", (PyCFunction) Tyrant_putnr,
-        METH_VARARGS,
-        "Store a record. Overwrite existing record. Don't wait for a server response."
-    },
+        PyErr_SetString(PyExc_ValueError,
+            "threads must be positive, latency not negative and failure_rate between 0 and 1.");
+        return NULL;
+    }
     
+    self = (TyrantServer *) type->tp_alloc(type, 0);
+    if (!self)
     {
-        "out", (PyCFunction) Tyrant_out,
-        METH_VARARGS,
-        "Remove a record. If there are duplicates only the first is removed."
-    },
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate TyrantServer instance.");
+        return NULL;
+    }
     
-    {
-        "get", (PyCFunction) Tyrant_get,
-        METH_VARARGS | METH_KEYWORDS,
-        "Retrieve a record. If none is found None or the supplied default value is returned."
-    },
+    pthread_mutex_init(&self->mutex, NULL);
+    self->host = strdup(host);
+    self->port = port;
+    self->threads = threads;
+    self->latency = latency;
+    self->failure_rate = failure_rate;
+    self->rand = seed ? (uint64_t) seed : 0x9e3779b97f4a7c15ULL;
+    self->db = tcadbnew();
     
-    {
-        "vsiz", (PyCFunction) Tyrant_vsiz,
-        METH_VARARGS,
-        "Get the size of the of the record for key. If duplicates are found, the first record is used."
-    },
+    Py_BEGIN_ALLOW_THREADS
+    success = tcadbopen(self->db, path);
+    Py_END_ALLOW_THREADS
     
+    if (!success)
     {
-        "fwmkeys", (PyCFunction) Tyrant_fwmkeys,
-        METH_VARARGS | METH_KEYWORDS,
-        "Get a list of of keys that match the given prefix."
-    },
+        PyErr_Format(TyrantError, "Cannot open database %s.", path);
+        Py_DECREF(self);
+        return NULL;
+    }
     
-    {
-        "addint", (PyCFunction) Tyrant_addint,
-        METH_VARARGS,
-        "Add an integer to the selected record."
-    },
+    return (PyObject *) self;
+}
+
+
+static int
+fakeserv_probe(TyrantServer *self)
+{
+    return self->port > 0 ? ttopensock(self->host, self->port) : ttopensockunix(self->host);
+}
+
+
+static PyObject *
+TyrantServer_start(TyrantServer *self)
+{
+    bool success, exited = false;
+    int i, fd = -1;
     
+    if (self->running)
     {
-        "adddouble", (PyCFunction) Tyrant_adddouble,
-        METH_VARARGS,
-        "Add a double to the selected record."
-    },
+        PyErr_SetString(TyrantError, "The server is already running.");
+        return NULL;
+    }
     
+    /* Something else answering here would make the probe below meaningless. */
+    Py_BEGIN_ALLOW_THREADS
+    fd = fakeserv_probe(self);
+    if (fd >= 0)
     {
-        "sync", (PyCFunction) Tyrant_sync,
-        METH_NOARGS,
-        "Sync data with the disk device."
-    },
+        ttclosesock(fd);
+    }
+    Py_END_ALLOW_THREADS
     
+    if (fd >= 0)
     {
-        "optimize", (PyCFunction) Tyrant_optimize,
-        METH_VARARGS,
-        "Optimize a fragmented database."
-    },
+        PyErr_Format(TyrantError, "Address %s:%d is already in use.", self->host, self->port);
+        return NULL;
+    }
     
-    {
-        "vanish", (PyCFunction) Tyrant_vanish,
-        METH_NOARGS,
-        "Remove all records from the database."
-    },
+    self->serv = ttservnew();
     
+    if (!ttservconf(self->serv, self->host, self->port))
     {
-        "copy", (PyCFunction) Tyrant_copy,
-        METH_VARARGS,
-        "Copy the database to a new file."
-    },
+        ttservdel(self->serv);
+        self->serv = NULL;
+        PyErr_Format(TyrantError, "Cannot listen on %s:%d.", self->host, self->port);
+        return NULL;
+    }
     
-    {
-        "restore", (PyCFunction) Tyrant_restore,
-        METH_VARARGS | METH_KEYWORDS,
-        "Restore the database from the update logs."
-    },
+    ttservtune(self->serv, self->threads, 0);
+    ttservsetreqhandler(self->serv, fakeserv_task, self);
+    self->exited = false;
     
+    if (pthread_create(&self->thread, NULL, fakeserv_run, self) != 0)
     {
-        "setmst", (PyCFunction) Tyrant_setmst,
-        METH_VARARGS | METH_KEYWORDS,
-        "Set the replication master."
-    },
+        ttservdel(self->serv);
+        self->serv = NULL;
+        PyErr_SetString(PyExc_RuntimeError, "Cannot start server thread.");
+        return NULL;
+    }
     
-    {
-        "rnum", (PyCFunction) Tyrant_rnum,
-        METH_NOARGS,
-        "Get the number of records in the database."
-    },
+    self->running = true;
     
+    /* Return once the server accepts connections, for up to two seconds. The
+       server thread returns early when the socket cannot be bound. */
+    Py_BEGIN_ALLOW_THREADS
+    for (i=0; i<200 && fd < 0 && !exited; i++)
     {
-        "size", (PyCFunction) Tyrant_size,
-        METH_NOARGS,
-        "Get the size of the database in bytes."
-    },
+        fd = fakeserv_probe(self);
+        if (fd < 0)
+        {
+            usleep(10000);
+        }
+        pthread_mutex_lock(&self->mutex);
+        exited = self->exited;
+        pthread_mutex_unlock(&self->mutex);
+    }
+    if (fd >= 0)
+    {
+        ttclosesock(fd);
+    }
+    Py_END_ALLOW_THREADS
     
+    success = fd >= 0 && !exited;
+    
+    if (!success)
     {
-        "stat", (PyCFunction) Tyrant_stat,
-        METH_NOARGS,
-        "Get the server status string."
-    },
+        fakeserv_stop(self);
+        PyErr_Format(TyrantError, "Server on %s:%d did not start.", self->host, self->port);
+        return NULL;
+    }
+    
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+TyrantServer_stop(TyrantServer *self)
+{
+    fakeserv_stop(self);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+TyrantServer_stats(TyrantServer *self)
+{
+    uint64_t requests, failures;
+    
+    pthread_mutex_lock(&self->mutex);
+    requests = self->requests;
+    failures = self->failures;
+    pthread_mutex_unlock(&self->mutex);
+    
+    return Py_BuildValue("{s:K,s:K,s:K}",
+        "requests", (unsigned PY_LONG_LONG) requests,
+        "failures", (unsigned PY_LONG_LONG) failures,
+        "rnum", (unsigned PY_LONG_LONG) tcadbrnum(self->db));
+}
+
+
+static PyObject *
+TyrantServer_get_host(TyrantServer *self, void *closure)
+{
+    return PyString_FromString(self->host);
+}
+
+
+static PyObject *
+TyrantServer_get_port(TyrantServer *self, void *closure)
+{
+    return PyInt_FromLong(self->port);
+}
+
+
+static PyObject *
+TyrantServer_get_latency(TyrantServer *self, void *closure)
+{
+    return PyFloat_FromDouble(self->latency);
+}
+
+
+static int
+TyrantServer_set_latency(TyrantServer *self, PyObject *value, void *closure)
+{
+    double latency = value ? PyFloat_AsDouble(value) : -1;
     
+    if (latency < 0)
     {
-        "tblput", (PyCFunction) Tyrant_tblput,
-        METH_VARARGS,
-        "Store a record. Overwrite existing record."
-    },
+        if (!PyErr_Occurred())
+        {
+            PyErr_SetString(PyExc_ValueError, "latency must not be negative.");
+        }
+        return -1;
+    }
+    
+    pthread_mutex_lock(&self->mutex);
+    self->latency = latency;
+    pthread_mutex_unlock(&self->mutex);
     
+    return 0;
+}
+
+
+static PyObject *
+TyrantServer_get_failure_rate(TyrantServer *self, void *closure)
+{
+    return PyFloat_FromDouble(self->failure_rate);
+}
+
+
+static int
+TyrantServer_set_failure_rate(TyrantServer *self, PyObject *value, void *closure)
+{
+    double rate = value ? PyFloat_AsDouble(value) : -1;
+    
+    if (rate < 0 || rate > 1)
     {
-        "tblputkeep", (PyCFunction) Tyrant_tblputkeep,
-        METH_VARARGS,
-        "Store a record. Don't overwrite an existing record."
-    },
+        if (!PyErr_Occurred())
+        {
+            PyErr_SetString(PyExc_ValueError, "failure_rate must be between 0 and 1.");
+        }
+        return -1;
+    }
     
+    pthread_mutex_lock(&self->mutex);
+    self->failure_rate = rate;
+    pthread_mutex_unlock(&self->mutex);
+    
+    return 0;
+}
+
+
+static PyGetSetDef TyrantServer_getset[] = 
+{
     {
-        "tblputcat", (PyCFunction) Tyrant_tblputcat,
-        METH_VARARGS,
-        "Concatenate value on the end of a record. Creates the record if it doesn't exist."
+        "host", (getter) TyrantServer_get_host, NULL,
+        "Address the server listens on, or the Unix socket path if port is 0.",
+        NULL
     },
     
     {
-        "tblout", (PyCFunction) Tyrant_tblout,
-        METH_VARARGS,
-        "Remove a record. If there are duplicates only the first is removed."
+        "port", (getter) TyrantServer_get_port, NULL,
+        "Port the server listens on.",
+        NULL
     },
     
     {
-        "tblget", (PyCFunction) Tyrant_tblget,
-        METH_VARARGS,
-        "Retrieve a record. If none is found None or the supplied default value is returned."
+        "latency", (getter) TyrantServer_get_latency, (setter) TyrantServer_set_latency,
+        "Seconds to wait before answering each request.",
+        NULL
     },
     
     {
-        "tblsetindex", (PyCFunction) Tyrant_tblsetindex,
-        METH_VARARGS,
-        "Set an index on a column."
+        "failure_rate", (getter) TyrantServer_get_failure_rate,
+        (setter) TyrantServer_set_failure_rate,
+        "Fraction of requests that are answered with an error instead of being run.",
+        NULL
     },
     
+    { NULL }
+};
+
+
+static PyMethodDef TyrantServer_methods[] = 
+{
     {
-        "tblgenuid", (PyCFunction) Tyrant_tblgenuid,
-        METH_VARARGS,
-        "Generate a unique record id."
+        "start", (PyCFunction) TyrantServer_start,
+        METH_NOARGS,
+        "Start serving on a background thread. Returns once connections are accepted."
     },
     
     {
-        "tblquery", (PyCFunction) Tyrant_tblquery,
+        "stop", (PyCFunction) TyrantServer_stop,
         METH_NOARGS,
-        "Get a query object for this database."
+        "Stop serving. The data is kept and served again on the next start."
     },
     
     {
-        "metasearch", (PyCFunction) Tyrant_metasearch,
-        METH_VARARGS,
-        "Use multiple query objects and a set operation to retrieve records."
+        "stats", (PyCFunction) TyrantServer_stats,
+        METH_NOARGS,
+        "Get the number of requests served and failed, and of records held."
     },
     
     { NULL }
 };
 
 
-static PyTypeObject TyrantType = {
+static PyTypeObject TyrantServerType = {
   PyObject_HEAD_INIT(NULL)
   0,                                           /* ob_size */
-  "tokyocabinet.tyrant.Tyrant",                /* tp_name */
-  sizeof(Tyrant),                              /* tp_basicsize */
+  "tokyocabinet.tyrant.TyrantServer",          /* tp_name */
+  sizeof(TyrantServer),                        /* tp_basicsize */
   0,                                           /* tp_itemsize */
-  (destructor)Tyrant_dealloc,                  /* tp_dealloc */
+  (destructor)TyrantServer_dealloc,            /* tp_dealloc */
   0,                                           /* tp_print */
   0,                                           /* tp_getattr */
   0,                                           /* tp_setattr */
   0,                                           /* tp_compare */
   0,                                           /* tp_repr */
   0,                                           /* tp_as_number */
-  &Tyrant_as_sequence,                         /* tp_as_sequence */
-  &Tyrant_as_mapping,                          /* tp_as_mapping */
-  Tyrant_Hash,                                 /* tp_hash  */
+  0,                                           /* tp_as_sequence */
+  0,                                           /* tp_as_mapping */
+  0,                                           /* tp_hash  */
   0,                                           /* tp_call */
   0,                                           /* tp_str */
   0,                                           /* tp_getattro */
   0,                                           /* tp_setattro */
   0,                                           /* tp_as_buffer */
-  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,    /* tp_flags */
-  "Tyrant database",                           /* tp_doc */
+  Py_TPFLAGS_DEFAULT,                          /* tp_flags */
+  "In-process Tyrant server for tests and benchmarks", /* tp_doc */
   0,                                           /* tp_traverse */
   0,                                           /* tp_clear */
   0,                                           /* tp_richcompare */
   0,                                           /* tp_weaklistoffset */
   0,                                           /* tp_iter */
   0,                                           /* tp_iternext */
-  Tyrant_methods,                              /* tp_methods */
+  TyrantServer_methods,                        /* tp_methods */
   0,                                           /* tp_members */
-  0,                                           /* tp_getset */
+  TyrantServer_getset,                         /* tp_getset */
   0,                                           /* tp_base */
   0,                                           /* tp_dict */
   0,                                           /* tp_descr_get */
@@ -1746,7 +14097,7 @@ static PyTypeObject TyrantType = {
   0,                                           /* tp_dictoffset */
   0,                                           /* tp_init */
   0,                                           /* tp_alloc */
-  Tyrant_new,                                  /* tp_new */
+  TyrantServer_new,                            /* tp_new */
 };
 
 
@@ -1784,14 +14135,125 @@ inittokyotyrant(void)
         return;
     }
     
+    if (PyType_Ready(&TyrantIterType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&TyrantSearchIterType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&TyrantMetricsMethodType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&TyrantPoolType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&TyrantPoolMethodType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&ReplicatedTyrantType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&LocalTyrantType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&LocalTyrantIterType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&ReplicatedTyrantMethodType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&ShardedTyrantType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&ShardedQueryType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&TyrantCodecType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&TyrantPipelineType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&TyrantPipelineMethodType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&PreparedQueryType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&ReplicationStreamType) < 0)
+    {
+        return;
+    }
+    
+    if (PyType_Ready(&TyrantServerType) < 0)
+    {
+        return;
+    }
+    
     Py_INCREF(&TyrantType);
     PyModule_AddObject(m, "Tyrant", (PyObject *) &TyrantType);
     
     Py_INCREF(&TyrantQueryType);
     PyModule_AddObject(m, "TyrantQuery", (PyObject *) &TyrantQueryType);
     
+    Py_INCREF(&TyrantPoolType);
+    PyModule_AddObject(m, "TyrantPool", (PyObject *) &TyrantPoolType);
+    
+    Py_INCREF(&ReplicatedTyrantType);
+    PyModule_AddObject(m, "ReplicatedTyrant", (PyObject *) &ReplicatedTyrantType);
+    
+    Py_INCREF(&LocalTyrantType);
+    PyModule_AddObject(m, "LocalTyrant", (PyObject *) &LocalTyrantType);
+    
+    Py_INCREF(&PreparedQueryType);
+    PyModule_AddObject(m, "PreparedQuery", (PyObject *) &PreparedQueryType);
+    
+    Py_INCREF(&ShardedTyrantType);
+    PyModule_AddObject(m, "ShardedTyrant", (PyObject *) &ShardedTyrantType);
+    
+    Py_INCREF(&TyrantCodecType);
+    PyModule_AddObject(m, "TyrantCodec", (PyObject *) &TyrantCodecType);
+    
+    Py_INCREF(&ReplicationStreamType);
+    PyModule_AddObject(m, "ReplicationStream", (PyObject *) &ReplicationStreamType);
+    
+    Py_INCREF(&TyrantServerType);
+    PyModule_AddObject(m, "TyrantServer", (PyObject *) &TyrantServerType);
+    
     ADD_INT_CONSTANT(m, RDBROCHKCON);
     
+    ADD_INT_CONSTANT(m, RDBMONOULOG);
+    
     ADD_INT_CONSTANT(m, RDBITLEXICAL);
     ADD_INT_CONSTANT(m, RDBITDECIMAL);
     ADD_INT_CONSTANT(m, RDBITTOKEN);